@@ -28,9 +28,7 @@ void ApplyTransform(NIImageHandle SrcImage, int StartLine, int EndLine, double D
 	CHECK_ERROR_IN(ErrorCluster);
 	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
 
-	//ImgSrc = ADV_LVDTToAddress(SrcImage);
-	LV_SetThreadCore(1); //must be called prior to LV_LVDTToGRImage
-	LV_LVDTToGRImage(SrcImage, &ImgSrc);
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
 	
 	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
 
@@ -48,6 +46,7 @@ void ApplyTransform(NIImageHandle SrcImage, int StartLine, int EndLine, double D
 			return;
 	}
 
+	uint64_t start = __rdtsc();
 	register double temp0, temp1, temp2;
 	LVImagePtrSrcSGL += (StartLine * LVLineWidthSrc);
 	for (y = StartLine; y < EndLine; y++){
@@ -65,6 +64,7 @@ void ApplyTransform(NIImageHandle SrcImage, int StartLine, int EndLine, double D
 		}
 		LVImagePtrSrcSGL += (LVLineWidthSrc - LVWidth);
 	}
+	ADV_ProfileEnd(&ADV_Profile.transform, start);
 }
 
 void ApplyPower(NIImageHandle SrcImage, double Power, LVErrorCluster *ErrorCluster)
@@ -76,9 +76,7 @@ void ApplyPower(NIImageHandle SrcImage, double Power, LVErrorCluster *ErrorClust
 	CHECK_ERROR_IN(ErrorCluster);
 	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
 
-	//ImgSrc = ADV_LVDTToAddress(SrcImage);
-	LV_SetThreadCore(1); //must be called prior to LV_LVDTToGRImage
-	LV_LVDTToGRImage(SrcImage, &ImgSrc);
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
 	
 	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
 
@@ -96,6 +94,7 @@ void ApplyPower(NIImageHandle SrcImage, double Power, LVErrorCluster *ErrorClust
 			return;
 	}
 
+	uint64_t start = __rdtsc();
 	double register temp;
 	for (y = 0; y < LVHeight; y++){
 		for (x = 0; x < LVWidth; x++){
@@ -104,9 +103,16 @@ void ApplyPower(NIImageHandle SrcImage, double Power, LVErrorCluster *ErrorClust
 		}
 		LVImagePtrSrcSGL += (LVLineWidthSrc - LVWidth);
 	}
+	ADV_ProfileEnd(&ADV_Profile.post, start);
 }
 
 
+//Called by ImagesPool.vi with 0 when it starts, which turns the image cache on,
+//and with the handle before every IMAQ Dispose. Any call flushes the whole cache
+void ImageCacheInvalidate(NIImageHandle Image)
+{
+	ADV_ImageCacheInvalidate(Image);
+}
 
 //==============================================================================
 // DLL main entry-point functions
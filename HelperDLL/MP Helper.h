@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include "extcode.h"
 #include "nivision.h"
+#include <intrin.h>
 #include <utility.h>
 
 typedef uintptr_t NIImageHandle;
@@ -176,6 +177,103 @@ Image* ADV_LVDTToAddress(const void *LVImageHdl)
 	return ret;
 }
 
+//Resolved image cache, direct mapped by NIImageHandle. Nothing of a cached
+//Image* is read to check it, only the image pool knows that one is gone:
+//the cache stays off until ImagesPool.vi calls the invalidate export, with
+//0 when it starts and with the handle before every IMAQ Dispose. Each call
+//starts a new generation and entries of older ones miss, disposals are rare
+#define IMAGE_CACHE_SIZE 64
+
+typedef struct {
+	NIImageHandle handle;
+	Image *image;
+	LONG generation;
+} ADV_ImageCacheEntry;
+
+static ADV_ImageCacheEntry ADV_ImageCache[IMAGE_CACHE_SIZE];
+static SRWLOCK ADV_ImageCacheLock = SRWLOCK_INIT;
+static LONG ADV_ImageCacheGeneration; //0 - off, the pool has not called the invalidate export yet
+
+static int ADV_ImageCacheSlot(NIImageHandle niImageHandle)
+{
+	return (int)(((uint64_t)niImageHandle * 0x9E3779B97F4A7C15ull) >> 58); //64 slots
+}
+
+Image* ADV_LVDTToGRImageCached(NIImageHandle niImageHandle)
+{
+	Image *image = NULL;
+	ADV_ImageCacheEntry entry;
+	LONG generation;
+	int slot = ADV_ImageCacheSlot(niImageHandle);
+
+	AcquireSRWLockShared(&ADV_ImageCacheLock);
+	entry = ADV_ImageCache[slot];
+	generation = ADV_ImageCacheGeneration;
+	ReleaseSRWLockShared(&ADV_ImageCacheLock);
+	if (generation && (entry.generation == generation) && (entry.handle == niImageHandle) && entry.image) return entry.image;
+
+	LV_SetThreadCore(1); //must be called prior to LV_LVDTToGRImage
+	LV_LVDTToGRImage(niImageHandle, &image);
+	if (!image || !generation) return image;
+
+	//an invalidation since the lookup may be about this handle
+	AcquireSRWLockExclusive(&ADV_ImageCacheLock);
+	if (ADV_ImageCacheGeneration == generation){
+		ADV_ImageCache[slot].handle = niImageHandle;
+		ADV_ImageCache[slot].image = image;
+		ADV_ImageCache[slot].generation = generation;
+	}
+	ReleaseSRWLockExclusive(&ADV_ImageCacheLock);
+	
+	return image;
+}
+
+void ADV_ImageCacheInvalidate(NIImageHandle niImageHandle) //0 - the pool starts
+{
+	AcquireSRWLockExclusive(&ADV_ImageCacheLock);
+	ADV_ImageCacheGeneration = ADV_ImageCacheGeneration == MAXLONG ? 1 : ADV_ImageCacheGeneration + 1;
+	ReleaseSRWLockExclusive(&ADV_ImageCacheLock);
+}
+
+//Stage timing into the profile of OpenCVWrapper (opencv2ProfileStats).
+//OpenCVWrapper.dll is looked up once, on the first sample, and pinned so
+//the cached entry point outlives an unload by LabVIEW. If it is not loaded
+//by then the samples are dropped for the life of the process
+typedef int (*ADV_ProfileStageIdFn)(const char *Name);
+typedef void (*ADV_ProfileRecordFn)(int Stage, uint64_t Ticks);
+
+typedef struct {
+	ADV_ProfileRecordFn record;
+	int transform, post;
+} ADV_ProfileTarget;
+
+static ADV_ProfileTarget ADV_Profile;
+static INIT_ONCE ADV_ProfileOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK ADV_ProfileResolve(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+	HMODULE wrapper = NULL;
+	ADV_ProfileStageIdFn stageId;
+
+	ADV_Profile.record = NULL;
+	if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_PIN, "OpenCVWrapper.dll", &wrapper)) return TRUE; //not retried
+	stageId = (ADV_ProfileStageIdFn)GetProcAddress(wrapper, "opencv2ProfileStageId");
+	ADV_Profile.record = (ADV_ProfileRecordFn)GetProcAddress(wrapper, "opencv2ProfileRecord");
+	if (!stageId || !ADV_Profile.record){ ADV_Profile.record = NULL; return TRUE; } //older wrapper
+	ADV_Profile.transform = stageId("transform");
+	ADV_Profile.post = stageId("post power");
+	return TRUE;
+}
+
+//stage - a field of ADV_Profile, start - __rdtsc() at the beginning of the stage
+static void ADV_ProfileEnd(const int *stage, uint64_t start)
+{
+	uint64_t end = __rdtsc();
+
+	if (!InitOnceExecuteOnce(&ADV_ProfileOnce, ADV_ProfileResolve, NULL, NULL) || !ADV_Profile.record) return;
+	ADV_Profile.record(*stage, end - start);
+}
+
 int ADV_SetLVError(int ErrorCode, const char *errText, LVErrorCluster *ErrorCluster)
 {
 	int strsize, strerrsize, len;
@@ -270,6 +368,7 @@ int ADV_SetLVErrorWithCallChain(int ErrorCode, LVErrorCluster *ErrorCluster)
 #endif
 
 void ApplyPower(NIImageHandle SrcImage, double Power, LVErrorCluster *ErrorCluster);
+void ImageCacheInvalidate(NIImageHandle Image);
 void ApplyTransform(NIImageHandle SrcImage, int StartLine, int EndLine, double Divider, double Power, double Multiplier,  LVErrorCluster *ErrorCluster);
 
 #ifdef __cplusplus
@@ -0,0 +1,173 @@
+//==============================================================================
+//
+// Title:       Async
+// Purpose:     Asynchronous submit/complete interface to the pipeline.
+//
+//==============================================================================
+
+#include <new>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Async.h"
+#include "Context.h"
+
+using namespace cv;
+
+typedef struct {
+	int64_t ticket;
+	Mat src, dst;
+	MSParameters params;
+	double submitted;
+} MSAsyncJob;
+
+struct MSAsync {
+	MSContext *ctx;
+	int depth;
+	MSAsyncCallback callback;
+	void *user;
+
+	std::mutex lock;
+	std::condition_variable queued, freed, completed;
+	std::deque<MSAsyncJob> jobs;
+	int inFlight;
+	int64_t nextTicket, lastCompleted;
+	MSAsyncCompletion history[MS_ASYNC_HISTORY];
+	bool stop;
+
+	std::thread worker;
+};
+
+static double MSNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static void MSAsyncWorker(MSAsync *async)
+{
+	for (;;){
+		MSAsyncJob job;
+		MSAsyncCompletion done;
+		double start;
+
+		{
+			std::unique_lock<std::mutex> guard(async->lock);
+			async->queued.wait(guard, [&]{ return async->stop || !async->jobs.empty(); });
+			if (async->jobs.empty()) return;
+			job = std::move(async->jobs.front());
+			async->jobs.pop_front();
+		}
+
+		start = MSNowUs();
+		done.ticket = job.ticket;
+		done.waitUs = start - job.submitted;
+		{
+			MSContextTimer timer(async->ctx, MS_EXPORT_MULTISCALE);
+			done.status = MSProcess(async->ctx, job.src, job.dst, job.params);
+		}
+		done.processUs = MSNowUs() - start;
+		job.src.release();
+
+		if (async->callback) async->callback(&done, async->user);
+
+		{
+			std::lock_guard<std::mutex> guard(async->lock);
+			async->history[job.ticket % MS_ASYNC_HISTORY] = done;
+			async->lastCompleted = job.ticket;
+			async->inFlight--;
+		}
+		async->freed.notify_one();
+		async->completed.notify_all();
+	}
+}
+
+MSAsync* MSAsyncCreate(MSContext *ctx, int depth, MSAsyncCallback callback, void *user)
+{
+	MSAsync *async;
+
+	if (!ctx || (depth <= 0) || (depth > MS_ASYNC_MAX_DEPTH)) return NULL;
+	if (!(async = new (std::nothrow) MSAsync)) return NULL;
+
+	async->ctx = ctx;
+	async->depth = depth;
+	async->callback = callback;
+	async->user = user;
+	async->inFlight = 0;
+	async->nextTicket = 1;
+	async->lastCompleted = 0;
+	async->stop = false;
+	try {
+		async->worker = std::thread(MSAsyncWorker, async);
+	}
+	catch (const std::system_error &){
+		delete async;
+		return NULL;
+	}
+	return async;
+}
+
+void MSAsyncDestroy(MSAsync *async)
+{
+	if (!async) return;
+	{
+		std::lock_guard<std::mutex> guard(async->lock);
+		async->stop = true;
+	}
+	async->queued.notify_one();
+	async->worker.join();
+	delete async;
+}
+
+int MSAsyncSubmit(MSAsync *async, const Mat &src, const Mat &dst, const MSParameters &params,
+	int timeoutMs, int64_t *ticket)
+{
+	MSAsyncJob job;
+	auto room = [&]{ return async->inFlight < async->depth; };
+
+	// copied before taking a slot, the caller may reuse its buffer on return
+	try {
+		job.src = src.clone();
+	}
+	catch (const cv::Exception &){
+		return MS_ERR_OUT_OF_MEMORY;
+	}
+	job.dst = dst;
+	job.params = params;
+
+	{
+		std::unique_lock<std::mutex> guard(async->lock);
+		if (timeoutMs < 0) async->freed.wait(guard, room);
+		else if (!async->freed.wait_for(guard, std::chrono::milliseconds(timeoutMs), room)) return MS_ERR_TIMEOUT;
+
+		job.ticket = *ticket = async->nextTicket++;
+		job.submitted = MSNowUs();
+		async->jobs.push_back(std::move(job));
+		async->inFlight++;
+	}
+	async->queued.notify_one();
+	return MS_OK;
+}
+
+int MSAsyncWait(MSAsync *async, int64_t ticket, int timeoutMs, MSAsyncCompletion *completion)
+{
+	std::unique_lock<std::mutex> guard(async->lock);
+	auto done = [&]{ return async->lastCompleted >= ticket; };
+
+	if ((ticket <= 0) || (ticket >= async->nextTicket)) return MS_ERR_INVALID_PARAMETER;
+	if (timeoutMs < 0) async->completed.wait(guard, done);
+	else if (!async->completed.wait_for(guard, std::chrono::milliseconds(timeoutMs), done)) return MS_ERR_TIMEOUT;
+
+	// frames complete in order, older tickets have left the history
+	if (async->lastCompleted - ticket >= MS_ASYNC_HISTORY) return MS_ERR_INVALID_PARAMETER;
+	if (completion) *completion = async->history[ticket % MS_ASYNC_HISTORY];
+	return async->history[ticket % MS_ASYNC_HISTORY].status;
+}
+
+int MSAsyncInFlight(MSAsync *async)
+{
+	std::lock_guard<std::mutex> guard(async->lock);
+	return async->inFlight;
+}
@@ -0,0 +1,55 @@
+//==============================================================================
+//
+// Title:       Async
+// Purpose:     Asynchronous submit/complete interface to the pipeline.
+//
+//              MSAsyncSubmit copies the frame, queues it and returns a ticket
+//              at once, so the acquisition of the next frame overlaps the
+//              processing of the previous ones. A worker thread runs the
+//              queued frames in order on the context and reports every one
+//              through the callback and MSAsyncWait. At most depth frames
+//              are in flight, further submits block (back-pressure).
+//
+//==============================================================================
+
+#ifndef __Async_H__
+#define __Async_H__
+
+#include <stdint.h>
+#include "opencv2/core.hpp"
+#include "Pipeline.h"
+
+struct MSContext;
+struct MSAsync;
+
+#define MS_ASYNC_MAX_DEPTH	64
+#define MS_ASYNC_HISTORY	256 //completions kept for MSAsyncWait
+
+// Also the data of the LabVIEW user event
+typedef struct {
+	int64_t ticket;
+	double waitUs;       // queued before processing started
+	double processUs;
+	int32_t status;      // MSStatus
+} MSAsyncCompletion;
+
+// Runs on the worker thread, keep it short
+typedef void (*MSAsyncCallback)(const MSAsyncCompletion *completion, void *user);
+
+// The context belongs to the queue until MSAsyncDestroy, callback may be NULL
+MSAsync* MSAsyncCreate(MSContext *ctx, int depth, MSAsyncCallback callback, void *user);
+// Finishes the queued frames first
+void MSAsyncDestroy(MSAsync *async);
+
+// dst must stay untouched until the ticket completes. timeoutMs < 0 waits for
+// a free slot, otherwise MS_ERR_TIMEOUT when the queue stays full
+int MSAsyncSubmit(MSAsync *async, const cv::Mat &src, const cv::Mat &dst, const MSParameters &params,
+	int timeoutMs, int64_t *ticket);
+
+// Waits for the ticket, MS_ERR_TIMEOUT if it is not done in time
+int MSAsyncWait(MSAsync *async, int64_t ticket, int timeoutMs, MSAsyncCompletion *completion);
+
+// Frames submitted and not yet completed
+int MSAsyncInFlight(MSAsync *async);
+
+#endif  /* ndef __Async_H__ */
@@ -0,0 +1,100 @@
+//==============================================================================
+//
+// Title:       Batch
+// Purpose:     Frame-level batch processing of many images.
+//
+//==============================================================================
+
+#include <atomic>
+#include <chrono>
+#include "Batch.h"
+#include "Context.h"
+
+using namespace cv;
+
+// Pyramid, bands and pyrUp scratch take about 16 bytes per input pixel
+#define MS_BATCH_BYTES_PER_PIXEL	16
+
+int MSBatchChooseMode(int width, int height, int count, int threads, int *workers, int *threadsPerWorker)
+{
+	int64_t pixels = (int64_t)width * height;
+	int n = count < threads ? count : threads;
+
+	if ((n > 1) && (pixels < MS_BATCH_INTRA_PIXELS)){
+		while ((n > 1) && (n * pixels * MS_BATCH_BYTES_PER_PIXEL > MS_BATCH_MEMORY_BUDGET)) n--;
+	}
+	else n = 1;
+
+	*workers = n;
+	*threadsPerWorker = threads / n;
+	return n > 1 ? MS_BATCH_FRAMES : MS_BATCH_INTRA;
+}
+
+//Worker contexts are kept in the parent context while the split stays the same
+static void MSBatchWorkers(MSContext *ctx, int workers, int threadsPerWorker)
+{
+	if (((int)ctx->batch.size() == workers) && (ctx->batchThreads == threadsPerWorker)) return;
+
+	for (size_t i = 0; i < ctx->batch.size(); i++) MSContextDestroy(ctx->batch[i]);
+	ctx->batch.clear();
+	for (int i = 0; i < workers; i++) ctx->batch.push_back(MSContextCreate(threadsPerWorker));
+	ctx->batchThreads = threadsPerWorker;
+}
+
+int MSProcessBatch(MSContext *ctx, const Mat *src, Mat *dst, int count,
+	const MSParameters &params, int mode, MSBatchStats *stats)
+{
+	std::atomic<int> next(0), failed(0), firstError(MS_OK);
+	int workers, threadsPerWorker, chosen;
+	auto t0 = std::chrono::steady_clock::now();
+
+	if (count <= 0) return MS_ERR_INVALID_PARAMETER;
+
+	chosen = MSBatchChooseMode(src[0].cols, src[0].rows, count, ctx->pool.size(), &workers, &threadsPerWorker);
+	if (mode == MS_BATCH_INTRA || ((mode == MS_BATCH_AUTO) && (chosen == MS_BATCH_INTRA))){
+		chosen = MS_BATCH_INTRA;
+		workers = 1;
+	}
+	else{
+		chosen = MS_BATCH_FRAMES;
+		if (workers < 2) workers = count < ctx->pool.size() ? count : ctx->pool.size();
+		threadsPerWorker = ctx->pool.size() / (workers > 0 ? workers : 1);
+	}
+
+	auto process = [&](MSContext *worker){
+		int i, status;
+		while ((i = next++) < count){
+			status = MSProcess(worker, src[i], dst[i], params);
+			if (status != MS_OK){
+				int ok = MS_OK;
+				firstError.compare_exchange_strong(ok, status);
+				failed++;
+			}
+		}
+	};
+
+	if (chosen == MS_BATCH_INTRA){
+		threadsPerWorker = ctx->pool.size();
+		process(ctx);
+	}
+	else{
+		MSBatchWorkers(ctx, workers, threadsPerWorker);
+		for (int w = 0; w < workers; w++)
+			if (!ctx->batch[w]) return MS_ERR_OUT_OF_MEMORY;
+		// one chunk per worker, so every worker context is used by one thread only
+		for (int w = 0; w < workers; w++) ctx->batch[w]->ingest = ctx->ingest;
+		ctx->pool.parallelFor(workers, 1, [&](int begin, int end){
+			for (int w = begin; w < end; w++) process(ctx->batch[w]);
+		});
+	}
+
+	if (stats){
+		stats->mode = chosen;
+		stats->workers = workers;
+		stats->threads = threadsPerWorker;
+		stats->failed = failed;
+		stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		stats->imagesPerSecond = stats->seconds > 0 ? (count - failed) / stats->seconds : 0;
+	}
+	return firstError;
+}
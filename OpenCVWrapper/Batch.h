@@ -0,0 +1,49 @@
+//==============================================================================
+//
+// Title:       Batch
+// Purpose:     Frame-level batch processing of many images.
+//
+//              Coarse pyramid levels are too small to keep many threads busy,
+//              so for batches of moderate sized frames it is faster to run
+//              whole frames concurrently, one frame per worker, than to split
+//              every frame across all threads.
+//
+//==============================================================================
+
+#ifndef __Batch_H__
+#define __Batch_H__
+
+#include <stdint.h>
+#include "opencv2/core.hpp"
+#include "Pipeline.h"
+
+struct MSContext;
+
+// Frames of this size and above are split across threads instead
+#define MS_BATCH_INTRA_PIXELS	(8 << 20)
+// Upper limit for the working sets of all concurrent frames
+#define MS_BATCH_MEMORY_BUDGET	((int64_t)2 << 30)
+
+enum MSBatchMode {
+	MS_BATCH_AUTO = 0,
+	MS_BATCH_FRAMES,   // one frame per worker, remaining cores split among the workers
+	MS_BATCH_INTRA     // one frame after the other on all threads
+};
+
+typedef struct {
+	int32_t mode;          // mode actually used
+	int32_t workers;       // frames in flight
+	int32_t threads;       // threads per frame
+	int32_t failed;        // frames with an error
+	double seconds;
+	double imagesPerSecond;
+} MSBatchStats;
+
+// Picks the mode for count frames of width x height on threads cores
+int MSBatchChooseMode(int width, int height, int count, int threads, int *workers, int *threadsPerWorker);
+
+// dst[i] as in MSProcess, the mode is chosen from the first frame. Returns the first error
+int MSProcessBatch(MSContext *ctx, const cv::Mat *src, cv::Mat *dst, int count,
+	const MSParameters &params, int mode, MSBatchStats *stats);
+
+#endif  /* ndef __Batch_H__ */
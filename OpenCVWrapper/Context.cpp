@@ -0,0 +1,105 @@
+//==============================================================================
+//
+// Title:       Context
+// Purpose:     Processing context for reentrant, parallel callers.
+//
+//==============================================================================
+
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <algorithm>
+#include "Context.h"
+#include "Plan.h"
+
+using namespace cv;
+
+// Rows per chunk, keeps chunks of a 1024 wide SGL image around 64 KB
+#define MS_ROW_GRAIN 16
+#define MS_PYR_GRAIN 32 //destination rows per pyramid chunk, the halo is re-read by each
+#define MS_PYR_HALO 4 //pyrDown source rows above and below a chunk, even
+#define MS_CONTEXT_CORE_SHARE 2 //default contexts get 1/n of the cores, LabVIEW and other contexts keep the rest
+
+static int64_t MSNowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MSContext::MSContext(int numThreads) : pool(numThreads), plan(NULL), batchThreads(0)
+{
+	memset(&params, 0, sizeof(params));
+	memset(stats, 0, sizeof(stats));
+}
+
+MSContext::~MSContext()
+{
+	MSPlanDestroy(plan);
+	for (size_t i = 0; i < batch.size(); i++) MSContextDestroy(batch[i]);
+}
+
+MSContext* MSContextCreate(int numThreads)
+{
+	if (numThreads <= 0) numThreads = (int)std::thread::hardware_concurrency() / MS_CONTEXT_CORE_SHARE;
+	if (numThreads <= 0) numThreads = 1;
+	return new (std::nothrow) MSContext(numThreads);
+}
+
+void MSContextDestroy(MSContext *ctx)
+{
+	delete ctx;
+}
+
+void MSContextApplyTransform(MSContext *ctx, Mat &img, double divider, double power, double multiplier)
+{
+	ctx->pool.parallelFor(img.rows, MS_ROW_GRAIN, [&](int begin, int end){
+		MSApplyTransform(img, begin, end, divider, power, multiplier);
+	});
+}
+
+void MSContextApplyPower(MSContext *ctx, Mat &img, double power)
+{
+	ctx->pool.parallelFor(img.rows, MS_ROW_GRAIN, [&](int begin, int end){
+		MSApplyPower(img, begin, end, power);
+	});
+}
+
+// Chunks of dst rows, each from a source window that starts on an even row
+// and ends with the image or a halo past the chunk, so every chunk has the
+// same rows as the pyrDown of the whole image
+void MSContextPyrDown(MSContext *ctx, const Mat &src, Mat &dst)
+{
+	ctx->pool.parallelFor(dst.rows, MS_PYR_GRAIN, [&](int d0, int d1){
+		int s0 = std::max(0, 2 * d0 - MS_PYR_HALO), s1 = std::min(src.rows, 2 * d1 + MS_PYR_HALO);
+		Mat tile;
+
+		pyrDown(src.rowRange(s0, s1), tile, Size(dst.cols, s1 == src.rows ? dst.rows - s0 / 2 : (s1 - s0) / 2));
+		tile.rowRange(d0 - s0 / 2, d1 - s0 / 2).copyTo(dst.rowRange(d0, d1));
+	});
+}
+
+void MSContextPyrUp(MSContext *ctx, const Mat &src, Mat &dst)
+{
+	ctx->pool.parallelFor(dst.rows, MS_PYR_GRAIN, [&](int r0, int r1){
+		int a0 = std::max(0, r0 / 2 - 2), a1 = std::min(src.rows, (r1 + 1) / 2 + 2);
+		Mat tile;
+
+		pyrUp(src.rowRange(a0, a1), tile, Size(dst.cols, a1 == src.rows ? dst.rows - 2 * a0 : 2 * (a1 - a0)));
+		tile.rowRange(r0 - 2 * a0, r1 - 2 * a0).copyTo(dst.rowRange(r0, r1));
+	});
+}
+
+MSContextTimer::MSContextTimer(MSContext *ctx, MSExport id)
+	: stats(&ctx->stats[id]), start(MSNowNs())
+{
+}
+
+MSContextTimer::~MSContextTimer()
+{
+	double us = (MSNowNs() - start) / 1000.0;
+
+	stats->calls++;
+	stats->totalUs += us;
+	stats->lastUs = us;
+	if (us > stats->maxUs) stats->maxUs = us;
+}
@@ -0,0 +1,92 @@
+//==============================================================================
+//
+// Title:       Context
+// Purpose:     Processing context for reentrant, parallel callers.
+//
+//              A context holds its own parameters, scratch images, worker
+//              threads and statistics. One context must be used by one
+//              caller at a time, different contexts run fully independent.
+//
+//==============================================================================
+
+#ifndef __Context_H__
+#define __Context_H__
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include "Multiscale.h"
+#include "Pipeline.h"
+#include "ThreadPool.h"
+
+struct MSPlan;
+struct MSIngest;
+
+enum MSExport {
+	MS_EXPORT_PYRDOWN = 0,
+	MS_EXPORT_PYRUP,
+	MS_EXPORT_CLAHE,
+	MS_EXPORT_UNSHARP,
+	MS_EXPORT_TRANSFORM,
+	MS_EXPORT_POWER,
+	MS_EXPORT_MULTISCALE,
+	MS_EXPORT_BATCH,
+	MS_EXPORT_COUNT
+};
+
+typedef struct {
+	int64_t calls;
+	double totalUs;
+	double lastUs;
+	double maxUs;
+} MSExportStats;
+
+typedef struct {
+	MSClaheParams clahe;
+	MSUnsharpParams unsharp;
+} MSContextParams;
+
+// Aligned to cache lines, so contexts used by different threads never share one
+struct alignas(64) MSContext {
+	MSContext(int numThreads);
+	~MSContext();
+
+	MSContextParams params;
+	MSThreadPool pool;
+
+	cv::Mat scratch[3];
+	cv::Ptr<cv::CLAHE> clahe;
+	MSPlan *plan; //cached by MSProcess
+	std::shared_ptr<MSIngest> ingest; //raw frame calibration, shared with the batch workers
+
+	std::vector<MSContext*> batch; //frame-parallel workers of MSProcessBatch
+	int batchThreads;
+
+	alignas(64) MSExportStats stats[MS_EXPORT_COUNT];
+};
+
+MSContext* MSContextCreate(int numThreads); //0 - half of the cores
+void MSContextDestroy(MSContext *ctx);
+
+// Row-parallel kernels on the context's own threads
+void MSContextApplyTransform(MSContext *ctx, cv::Mat &img, double divider, double power, double multiplier);
+void MSContextApplyPower(MSContext *ctx, cv::Mat &img, double power);
+
+// pyrDown/pyrUp of src into the allocated dst, row chunks on the context threads
+void MSContextPyrDown(MSContext *ctx, const cv::Mat &src, cv::Mat &dst);
+void MSContextPyrUp(MSContext *ctx, const cv::Mat &src, cv::Mat &dst);
+
+// Accounts one export call in the context statistics
+class MSContextTimer
+{
+public:
+	MSContextTimer(MSContext *ctx, MSExport id);
+	~MSContextTimer();
+private:
+	MSExportStats *stats;
+	int64_t start;
+};
+
+#endif  /* ndef __Context_H__ */
@@ -0,0 +1,123 @@
+//==============================================================================
+//
+// Title:       Deadline
+// Purpose:     Latency budget mode for live processing.
+//
+//==============================================================================
+
+#include <string.h>
+#include <chrono>
+#include "Deadline.h"
+#include "Context.h"
+
+using namespace cv;
+
+static const int MSShedOrder[] = { MS_SHED_UNSHARP, MS_SHED_FILTERS, MS_SHED_FAST_POW, MS_SHED_LEVEL0 };
+#define MS_SHED_STEPS	(int)(sizeof(MSShedOrder) / sizeof(MSShedOrder[0]))
+
+static double MSNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static int MSToneVariant(int shed)
+{
+	return (shed & MS_SHED_LEVEL0) ? 2 : (shed & MS_SHED_FAST_POW) ? 1 : 0;
+}
+
+// Steps that change anything with these parameters
+static int MSShedApplicable(const MSPlan *plan)
+{
+	int mask = 0;
+
+	if (plan->params.unsharp.amount != 0) mask |= MS_SHED_UNSHARP;
+	for (int k = 0; k < plan->levels; k++) if (!plan->kernels[k].empty()) mask |= MS_SHED_FILTERS;
+	if (plan->levels || plan->postPower) mask |= MS_SHED_FAST_POW;
+	if (plan->levels) mask |= MS_SHED_LEVEL0;
+	return mask;
+}
+
+static double MSPredict(const MSPlan *plan, int shed)
+{
+	const double *cost = plan->stageCost;
+	int variant = MSToneVariant(shed);
+	double tone = plan->toneCost[variant], us;
+
+	// variants not run yet are guessed from the table version
+	if (!tone) tone = plan->toneCost[0] * (variant == 1 ? 0.7 : 0.5);
+
+	us = cost[MS_STAGE_INPUT] + cost[MS_STAGE_DECOMPOSE] + tone + cost[MS_STAGE_RECONSTRUCT];
+	if (!(shed & MS_SHED_FILTERS)) us += cost[MS_STAGE_FILTERS];
+	if ((plan->params.unsharp.amount != 0) && !(shed & MS_SHED_UNSHARP)) us += cost[MS_STAGE_UNSHARP];
+	else us += cost[MS_STAGE_OUTPUT] ? cost[MS_STAGE_OUTPUT] : cost[MS_STAGE_INPUT]; //a conversion like the input
+	return us;
+}
+
+static void MSSmooth(double *cost, double us)
+{
+	*cost = *cost ? (1 - MS_DEADLINE_SMOOTHING) * *cost + MS_DEADLINE_SMOOTHING * us : us;
+}
+
+// Stage costs from a frame of the level schedule
+static void MSDeadlineStages(MSPlan *plan, int shed, const double *stageUs)
+{
+	MSSmooth(&plan->stageCost[MS_STAGE_INPUT], stageUs[MS_STAGE_INPUT]);
+	MSSmooth(&plan->stageCost[MS_STAGE_DECOMPOSE], stageUs[MS_STAGE_DECOMPOSE]);
+	MSSmooth(&plan->stageCost[MS_STAGE_RECONSTRUCT], stageUs[MS_STAGE_RECONSTRUCT]);
+	MSSmooth(&plan->toneCost[MSToneVariant(shed)], stageUs[MS_STAGE_TONE]);
+	if (!(shed & MS_SHED_FILTERS)) MSSmooth(&plan->stageCost[MS_STAGE_FILTERS], stageUs[MS_STAGE_FILTERS]);
+	if (stageUs[MS_STAGE_UNSHARP] > 0) MSSmooth(&plan->stageCost[MS_STAGE_UNSHARP], stageUs[MS_STAGE_UNSHARP]);
+	if (stageUs[MS_STAGE_OUTPUT] > 0) MSSmooth(&plan->stageCost[MS_STAGE_OUTPUT], stageUs[MS_STAGE_OUTPUT]);
+}
+
+int MSProcessDeadline(MSContext *ctx, const Mat &src, Mat &dst, const MSParameters &params,
+	double budgetUs, MSFrameReport *report)
+{
+	double stageUs[MS_STAGE_COUNT], start = MSNowUs(), predicted = 0;
+	int status, shed = 0, applicable;
+	bool graph;
+	MSPlan *plan;
+
+	if (!(plan = MSContextPlan(ctx, src, params, &status))) return status;
+	applicable = MSShedApplicable(plan);
+
+	// the graph frames are timed whole, 0 - the first one measures it
+	graph = (plan->schedule == MS_SCHEDULE_GRAPH) && (plan->graphCost <= budgetUs);
+	if (graph) predicted = plan->graphCost;
+
+	// the first frame runs in full to measure the stages
+	else if (plan->stageCost[MS_STAGE_INPUT] > 0){
+		for (int i = 0; (i < MS_SHED_STEPS) && ((predicted = MSPredict(plan, shed)) > budgetUs); i++){
+			shed |= MSShedOrder[i];
+			if (shed & MS_SHED_LEVEL0) shed |= MS_SHED_FAST_POW;
+		}
+		if (predicted > budgetUs) predicted = MSPredict(plan, shed);
+	}
+	shed &= applicable;
+
+	// the graph schedule is only timed without shedding, also while nothing is left to shed
+	if ((plan->schedule == MS_SCHEDULE_GRAPH) && !shed && (graph || (plan->stageCost[MS_STAGE_INPUT] > 0))){
+		double begin = MSNowUs();
+
+		memset(stageUs, 0, sizeof(stageUs));
+		status = MSPlanExecuteShed(plan, src, dst, 0, NULL);
+		if (status == MS_OK) MSSmooth(&plan->graphCost, MSNowUs() - begin);
+		if (!graph) predicted = plan->graphCost;
+	}
+	else{
+		status = MSPlanExecuteShed(plan, src, dst, shed, stageUs);
+		if (status == MS_OK) MSDeadlineStages(plan, shed, stageUs);
+	}
+
+
+	if (report){
+		report->shed = shed;
+		report->budgetUs = budgetUs;
+		report->predictedUs = predicted;
+		report->elapsedUs = MSNowUs() - start;
+		report->missed = report->elapsedUs > budgetUs;
+		memcpy(report->stageUs, stageUs, sizeof(stageUs));
+	}
+	return status;
+}
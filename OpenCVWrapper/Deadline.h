@@ -0,0 +1,44 @@
+//==============================================================================
+//
+// Title:       Deadline
+// Purpose:     Latency budget mode for live processing.
+//
+//              The cost of every stage is measured online. When the frame
+//              would not fit into the budget, work is shed in a fixed order
+//              until it does: unsharp mask, per-level filters, table pow in
+//              favour of the fast approximation, full precision tone curve
+//              of level 0. Each frame reports what was shed.
+//
+//              The graph schedule runs only unshed and is timed as a whole
+//              frame. It is kept while that fits the budget; otherwise the
+//              level schedule is timed per stage and the shedding is chosen
+//              from those costs.
+//
+//==============================================================================
+
+#ifndef __Deadline_H__
+#define __Deadline_H__
+
+#include <stdint.h>
+#include "opencv2/core.hpp"
+#include "Pipeline.h"
+#include "Plan.h"
+
+struct MSContext;
+
+#define MS_DEADLINE_SMOOTHING	0.2 //weight of the latest frame in the stage costs
+
+typedef struct {
+	int32_t shed;            // MSShed mask actually left out
+	int32_t missed;          // elapsed time over budget
+	double budgetUs;
+	double predictedUs;      // estimate for the chosen mask, 0 while calibrating
+	double elapsedUs;
+	double stageUs[MS_STAGE_COUNT];
+} MSFrameReport;
+
+// MSProcess that sheds work to finish within budgetUs, report may be NULL
+int MSProcessDeadline(MSContext *ctx, const cv::Mat &src, cv::Mat &dst, const MSParameters &params,
+	double budgetUs, MSFrameReport *report);
+
+#endif  /* ndef __Deadline_H__ */
@@ -0,0 +1,206 @@
+//==============================================================================
+//
+// Title:       FrameRing
+// Purpose:     Lock-free single producer/single consumer ring of frame slots.
+//
+//==============================================================================
+
+#include <new>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <math.h>
+#include "FrameRing.h"
+#include "Context.h"
+
+using namespace cv;
+
+#define MS_RING_SPIN 64 //peeks before the consumer sleeps, about the cost of a wake-up
+
+static double MSNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+MSFrameRing* MSFrameRingCreate(int width, int height, int type, int slots)
+{
+	MSFrameRing *ring;
+
+	if ((type != CV_16UC1) && (type != CV_32FC1)) return NULL;
+	if ((width <= 0) || (height <= 0) || (slots < 2) || (slots > MS_RING_MAX_SLOTS)) return NULL;
+	if (!(ring = new (std::nothrow) MSFrameRing)) return NULL;
+
+	ring->width = width;
+	ring->height = height;
+	ring->type = type;
+	ring->count = slots;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->acquired = false;
+	ring->waiting = 0;
+	try {
+		ring->slots.resize(slots);
+		for (int i = 0; i < slots; i++){
+			ring->slots[i].frame.create(height, width, type);
+			ring->slots[i].sequence = -1;
+			ring->slots[i].committedUs = 0;
+		}
+	}
+	catch (const cv::Exception &){
+		delete ring;
+		return NULL;
+	}
+	return ring;
+}
+
+void MSFrameRingDestroy(MSFrameRing *ring)
+{
+	delete ring;
+}
+
+Mat* MSFrameRingAcquire(MSFrameRing *ring)
+{
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+	if (head - ring->tail.load(std::memory_order_acquire) >= (uint64_t)ring->count) return NULL;
+	ring->acquired = true;
+	return &ring->slots[head % ring->count].frame;
+}
+
+int MSFrameRingCommit(MSFrameRing *ring)
+{
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	MSFrameSlot &slot = ring->slots[head % ring->count];
+
+	// the slot at head may still be read by the consumer if it was not acquired
+	if (!ring->acquired || (head - ring->tail.load(std::memory_order_acquire) >= (uint64_t)ring->count))
+		return MS_ERR_INVALID_PARAMETER;
+	ring->acquired = false;
+
+	slot.sequence = (int64_t)head;
+	slot.committedUs = MSNowUs();
+	// head is stored before waiting is read and MSFrameRingWait does the opposite,
+	// so either the consumer sees the frame or the producer sees the consumer
+	ring->head.store(head + 1, std::memory_order_seq_cst);
+	if (ring->waiting.load()){
+		std::lock_guard<std::mutex> guard(ring->lock);
+		ring->committed.notify_one();
+	}
+	return MS_OK;
+}
+
+MSFrameSlot* MSFrameRingPeek(MSFrameRing *ring)
+{
+	uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+	if (tail == ring->head.load(std::memory_order_acquire)) return NULL;
+	return &ring->slots[tail % ring->count];
+}
+
+void MSFrameRingRelease(MSFrameRing *ring)
+{
+	ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+MSFrameSlot* MSFrameRingWait(MSFrameRing *ring, int timeoutMs)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+	MSFrameSlot *slot;
+
+	// a frame that is about to arrive is picked up without a wake-up
+	for (int i = 0; i < MS_RING_SPIN; i++){
+		if ((slot = MSFrameRingPeek(ring))) return slot;
+		std::this_thread::yield();
+	}
+
+	std::unique_lock<std::mutex> guard(ring->lock);
+	ring->waiting.fetch_add(1);
+	auto ready = [ring]{ return ring->tail.load(std::memory_order_relaxed) != ring->head.load(); };
+	if (timeoutMs < 0) ring->committed.wait(guard, ready);
+	else ring->committed.wait_until(guard, deadline, ready);
+	ring->waiting.fetch_sub(1);
+	return MSFrameRingPeek(ring);
+}
+
+int MSFrameRingProcess(MSFrameRing *ring, MSContext *ctx, Mat &dst, const MSParameters &params,
+	int timeoutMs, int64_t *sequence)
+{
+	MSFrameSlot *slot;
+	int status;
+
+	if (!(slot = MSFrameRingWait(ring, timeoutMs))) return MS_ERR_TIMEOUT;
+
+	status = MSProcess(ctx, slot->frame, dst, params);
+	if (sequence) *sequence = slot->sequence;
+	MSFrameRingRelease(ring);
+	return status;
+}
+
+int MSFrameRingBenchmark(MSContext *ctx, int width, int height, int type, const MSParameters &params,
+	double fps, int frames, int slots, MSRingStats *stats)
+{
+	MSFrameRing *ring;
+	std::vector<double> latency;
+	Mat pattern, dst;
+	std::atomic<int> dropped(0);
+	int status = MS_OK;
+	double start, sum = 0, sq = 0;
+
+	if ((fps <= 0) || (frames <= 0)) return MS_ERR_INVALID_PARAMETER;
+	if (!(ring = MSFrameRingCreate(width, height, type, slots))) return MS_ERR_INVALID_PARAMETER;
+
+	// detector data, copied row by row into the slot as a frame grabber would
+	pattern.create(height, width, type);
+	randu(pattern, 0, type == CV_16UC1 ? 4096 : 1);
+	latency.reserve(frames);
+
+	std::thread producer([&]{
+		auto period = std::chrono::duration<double>(1.0 / fps);
+		auto next = std::chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++){
+			std::this_thread::sleep_until(next);
+			next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+			Mat *slot = MSFrameRingAcquire(ring);
+			if (!slot){
+				dropped++;
+				continue;
+			}
+			pattern.copyTo(*slot);
+			MSFrameRingCommit(ring);
+		}
+	});
+
+	// short waits, the last frames may be dropped while the consumer sleeps
+	start = MSNowUs();
+	while ((int)latency.size() + dropped < frames){
+		MSFrameSlot *slot = MSFrameRingWait(ring, 10);
+		if (!slot) continue;
+		if (status == MS_OK) status = MSProcess(ctx, slot->frame, dst, params);
+		latency.push_back(MSNowUs() - slot->committedUs);
+		MSFrameRingRelease(ring);
+	}
+	producer.join();
+
+	if (stats){
+		stats->frames = (int)latency.size();
+		stats->dropped = dropped;
+		stats->fps = latency.size() / ((MSNowUs() - start) / 1e6);
+		stats->meanUs = stats->p50Us = stats->p99Us = stats->maxUs = stats->jitterUs = 0;
+		if (!latency.empty()){
+			for (size_t i = 0; i < latency.size(); i++){
+				sum += latency[i];
+				sq += latency[i] * latency[i];
+			}
+			stats->meanUs = sum / latency.size();
+			stats->jitterUs = sqrt(std::max(0.0, sq / latency.size() - stats->meanUs * stats->meanUs));
+			std::sort(latency.begin(), latency.end());
+			stats->p50Us = latency[latency.size() / 2];
+			stats->p99Us = latency[std::min(latency.size() - 1, latency.size() * 99 / 100)];
+			stats->maxUs = latency.back();
+		}
+	}
+	MSFrameRingDestroy(ring);
+
+	return status;
+}
@@ -0,0 +1,85 @@
+//==============================================================================
+//
+// Title:       FrameRing
+// Purpose:     Lock-free single producer/single consumer ring of frame slots.
+//
+//              The slots are allocated once through the wrapper's MatPool.
+//              The acquisition thread writes detector data straight into the
+//              slot returned by MSFrameRingAcquire and publishes it with
+//              MSFrameRingCommit, the processing thread runs the pipeline on
+//              the slot in place and hands it back with MSFrameRingRelease.
+//              Exactly one thread may produce and one consume. A consumer
+//              waiting for a frame spins briefly, then sleeps until a commit.
+//
+//==============================================================================
+
+#ifndef __FrameRing_H__
+#define __FrameRing_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "Pipeline.h"
+
+struct MSContext;
+
+#define MS_RING_MAX_SLOTS	64
+
+typedef struct {
+	cv::Mat frame;
+	int64_t sequence;
+	double committedUs;     // steady clock at commit
+} MSFrameSlot;
+
+struct MSFrameRing {
+	int width, height, type;
+	int count;
+	std::vector<MSFrameSlot> slots;
+
+	alignas(64) std::atomic<uint64_t> head;  // written by the producer only
+	bool acquired;                           // producer holds the slot at head
+	alignas(64) std::atomic<uint64_t> tail;  // written by the consumer only
+	std::atomic<int> waiting;                // consumer sleeps on committed
+	std::mutex lock;
+	std::condition_variable committed;
+};
+
+// Results of MSFrameRingBenchmark
+typedef struct {
+	int32_t frames;         // processed
+	int32_t dropped;        // ring full when the frame arrived
+	double fps;             // achieved
+	double meanUs, p50Us, p99Us, maxUs;  // commit to processed
+	double jitterUs;        // standard deviation of the latency
+} MSRingStats;
+
+// type CV_16UC1 or CV_32FC1, NULL on failure
+MSFrameRing* MSFrameRingCreate(int width, int height, int type, int slots);
+void MSFrameRingDestroy(MSFrameRing *ring);
+
+// Producer: free slot to fill or NULL if the ring is full, then commit it.
+// Commit without an acquired slot is MS_ERR_INVALID_PARAMETER
+cv::Mat* MSFrameRingAcquire(MSFrameRing *ring);
+int MSFrameRingCommit(MSFrameRing *ring);
+
+// Consumer: oldest committed slot or NULL if empty, released after use
+MSFrameSlot* MSFrameRingPeek(MSFrameRing *ring);
+void MSFrameRingRelease(MSFrameRing *ring);
+
+// Consumer: oldest committed slot, waits up to timeoutMs (< 0 forever), NULL on timeout
+MSFrameSlot* MSFrameRingWait(MSFrameRing *ring, int timeoutMs);
+
+// Consumer: waits up to timeoutMs (< 0 forever) for a frame, runs the pipeline
+// on it in place into dst and releases the slot
+int MSFrameRingProcess(MSFrameRing *ring, MSContext *ctx, cv::Mat &dst, const MSParameters &params,
+	int timeoutMs, int64_t *sequence);
+
+// Feeds frames at fps from a producer thread for the given number of frames
+// and processes them on ctx, latency is from commit to processed
+int MSFrameRingBenchmark(MSContext *ctx, int width, int height, int type, const MSParameters &params,
+	double fps, int frames, int slots, MSRingStats *stats);
+
+#endif  /* ndef __FrameRing_H__ */
@@ -0,0 +1,137 @@
+//==============================================================================
+//
+// Title:       Ingest
+// Purpose:     Fused ingest of raw U16 detector frames.
+//
+//==============================================================================
+
+#include <new>
+#include <algorithm>
+#include "opencv2/imgproc.hpp"
+#include "Ingest.h"
+#include "Context.h"
+#include "Plan.h"
+
+using namespace cv;
+
+MSIngest* MSIngestCreate(int width, int height, const Mat &dark, const Mat &gain,
+	const int32_t *defects, int count, int *status)
+{
+	MSIngest *ingest;
+	const int dx[4] = { 0, -1, 1, 0 }, dy[4] = { -1, 0, 0, 1 };
+
+	*status = MS_OK;
+	if ((width < MS_MIN_LEVEL_SIZE) || (height < MS_MIN_LEVEL_SIZE)) { *status = MS_ERR_TOO_SMALL; return NULL; }
+	if ((!dark.empty() && (dark.size() != Size(width, height))) || (!gain.empty() && (gain.size() != Size(width, height))) ||
+		((count > 0) && !defects)) { *status = MS_ERR_INVALID_PARAMETER; return NULL; }
+	if ((!dark.empty() && (dark.type() != CV_16UC1) && (dark.type() != CV_32FC1)) || (!gain.empty() && (gain.type() != CV_32FC1)))
+		{ *status = MS_ERR_INVALID_TYPE; return NULL; }
+
+	ingest = new (std::nothrow) MSIngest;
+	if (!ingest) { *status = MS_ERR_OUT_OF_MEMORY; return NULL; }
+
+	ingest->width = width;
+	ingest->height = height;
+	try {
+		if (!dark.empty()) dark.convertTo(ingest->dark, CV_32FC1);
+		if (!gain.empty()) gain.copyTo(ingest->gain);
+
+		std::vector<int32_t> &list = ingest->defects;
+		for (int i = 0; i < count; i++){
+			int x = defects[2 * i], y = defects[2 * i + 1];
+			if ((x >= 0) && (x < width) && (y >= 0) && (y < height)) list.push_back(y * width + x);
+		}
+		std::sort(list.begin(), list.end());
+		list.erase(std::unique(list.begin(), list.end()), list.end());
+
+		// neighbours that are defects themselves do not count
+		ingest->neighbours.assign(list.size() * 4, -1);
+		for (size_t i = 0; i < list.size(); i++){
+			int x = list[i] % width, y = list[i] / width;
+			for (int n = 0; n < 4; n++){
+				int nx = x + dx[n], ny = y + dy[n];
+				if ((nx < 0) || (nx >= width) || (ny < 0) || (ny >= height)) continue;
+				if (!std::binary_search(list.begin(), list.end(), ny * width + nx)) ingest->neighbours[i * 4 + n] = ny * width + nx;
+			}
+		}
+	}
+	catch (const cv::Exception &){
+		delete ingest;
+		*status = MS_ERR_OPENCV;
+		return NULL;
+	}
+	catch (const std::bad_alloc &){
+		delete ingest;
+		*status = MS_ERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+
+	return ingest;
+}
+
+void MSIngestDestroy(MSIngest *ingest)
+{
+	delete ingest;
+}
+
+void MSIngestRows(const MSIngest *ingest, const Mat &src, Mat &dst, int begin, int end, const Mat &kernel)
+{
+	int halo = kernel.empty() ? 0 : kernel.rows / 2, cols = src.cols;
+	// rows the kernel reads, and one more on each side for the defect neighbours
+	int a = std::max(0, begin - halo), b = std::min(src.rows, end + halo);
+	int c0 = std::max(0, a - 1), c1 = std::min(src.rows, b + 1);
+	Mat buf(c1 - c0, cols, CV_32FC1);
+
+	for (int y = c0; y < c1; y++){
+		const uint16_t *in = src.ptr<uint16_t>(y);
+		float *out = buf.ptr<float>(y - c0);
+		for (int x = 0; x < cols; x++) out[x] = in[x];
+		if (!ingest->dark.empty()){
+			const float *dark = ingest->dark.ptr<float>(y);
+			for (int x = 0; x < cols; x++) out[x] -= dark[x];
+		}
+		if (!ingest->gain.empty()){
+			const float *gain = ingest->gain.ptr<float>(y);
+			for (int x = 0; x < cols; x++) out[x] *= gain[x];
+		}
+	}
+
+	// the neighbours are healthy, so the order of the replacements does not matter
+	const std::vector<int32_t> &defects = ingest->defects;
+	for (size_t i = std::lower_bound(defects.begin(), defects.end(), a * cols) - defects.begin();
+		(i < defects.size()) && (defects[i] < b * cols); i++){
+		const int32_t *n = &ingest->neighbours[i * 4];
+		float sum = 0;
+		int used = 0;
+		for (int j = 0; j < 4; j++){
+			if (n[j] < 0) continue;
+			sum += buf.at<float>(n[j] / cols - c0, n[j] % cols);
+			used++;
+		}
+		if (used) buf.at<float>(defects[i] / cols - c0, defects[i] % cols) = sum / used;
+	}
+
+	if (kernel.empty()){
+		buf.rowRange(begin - c0, end - c0).copyTo(dst.rowRange(begin, end));
+		return;
+	}
+	// the rows beyond [a, b) are not corrected, inside the frame the halo is real
+	Mat filtered;
+	filter2D(buf.rowRange(a - c0, b - c0), filtered, -1, kernel, Point(-1, -1), 0, BORDER_REFLECT_101 | BORDER_ISOLATED);
+	filtered.rowRange(begin - a, end - a).copyTo(dst.rowRange(begin, end));
+}
+
+void MSIngestRun(MSContext *ctx, const MSIngest *ingest, const Mat &src, Mat &dst, const Mat &kernel, int grain)
+{
+	dst.create(src.size(), CV_32FC1);
+	ctx->pool.parallelFor(src.rows, grain, [&](int begin, int end){
+		MSIngestRows(ingest, src, dst, begin, end, kernel);
+	});
+}
+
+void MSContextSetIngest(MSContext *ctx, MSIngest *ingest)
+{
+	if (ingest) ctx->ingest.reset(ingest, MSIngestDestroy);
+	else ctx->ingest.reset();
+	if (ctx->plan) ctx->plan->cacheHash = 0; //the cached decomposition came from the old calibration
+}
@@ -0,0 +1,50 @@
+//==============================================================================
+//
+// Title:       Ingest
+// Purpose:     Fused ingest of raw U16 detector frames.
+//
+//              Dark subtraction, gain (flat-field) correction, defective
+//              pixel replacement, conversion to SGL and the preprocessing
+//              kernel run row chunk by row chunk, so the raw frame is read
+//              once and the first pyramid level written once.
+//
+//==============================================================================
+
+#ifndef __Ingest_H__
+#define __Ingest_H__
+
+#include <stdint.h>
+#include <vector>
+#include "opencv2/core.hpp"
+
+struct MSContext;
+
+struct MSIngest {
+	int width, height;
+	cv::Mat dark;                    //SGL, empty - no dark subtraction
+	cv::Mat gain;                    //SGL, empty - no gain correction
+	std::vector<int32_t> defects;    //pixel indices, ascending
+	std::vector<int32_t> neighbours; //4 per defect, healthy 4-neighbours, -1 - none
+};
+
+// dark U16 or SGL and gain SGL of width x height, either may be empty.
+// defects holds count (x, y) pairs, repeated and out of frame ones are
+// dropped. Returns NULL and sets status on failure
+MSIngest* MSIngestCreate(int width, int height, const cv::Mat &dark, const cv::Mat &gain,
+	const int32_t *defects, int count, int *status);
+void MSIngestDestroy(MSIngest *ingest);
+
+// Rows [begin, end) of dst (SGL, size of src) from the U16 src:
+// (src - dark) * gain, not clamped, defects replaced by the mean of their
+// healthy 4-neighbours, then filtered with kernel (may be empty) with
+// BORDER_REFLECT_101 at the frame edges. Reads only the rows it needs
+void MSIngestRows(const MSIngest *ingest, const cv::Mat &src, cv::Mat &dst, int begin, int end, const cv::Mat &kernel);
+
+// MSIngestRows of the whole frame, row chunks of grain rows on the context threads
+void MSIngestRun(MSContext *ctx, const MSIngest *ingest, const cv::Mat &src, cv::Mat &dst, const cv::Mat &kernel, int grain);
+
+// Attaches ingest to the context (owned from now on, NULL - detach). Every
+// U16 frame of its size is ingested with it instead of a plain conversion
+void MSContextSetIngest(MSContext *ctx, MSIngest *ingest);
+
+#endif  /* ndef __Ingest_H__ */
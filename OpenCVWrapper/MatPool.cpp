@@ -0,0 +1,331 @@
+//==============================================================================
+//
+// Title:       MatPool
+// Purpose:     Pooled cv::MatAllocator with size-class free lists.
+//
+//==============================================================================
+
+#include <string.h>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include "MatPool.h"
+
+using namespace cv;
+
+// Four size classes per power of two keep the waste below 25%
+#define MATPOOL_MIN_CLASS	64
+#define MATPOOL_NUM_CLASSES	240
+#define MATPOOL_MAX_EXPORTS	64
+
+static int SizeClass(size_t size, size_t *classSize)
+{
+	int p = 6;
+	size_t step, k;
+
+	if (size <= MATPOOL_MIN_CLASS){
+		*classSize = MATPOOL_MIN_CLASS;
+		return 0;
+	}
+	while (((size_t)2 << p) < size) p++; // 2^p < size <= 2^(p+1)
+	step = (size_t)1 << (p - 2);
+	k = (size - 1 - ((size_t)1 << p)) / step + 1;
+	*classSize = ((size_t)1 << p) + k * step;
+	return 1 + (p - 6) * 4 + (int)(k - 1);
+}
+
+struct MatPoolAllocator::Impl {
+	std::mutex lock;
+	std::vector<void*> lists[MATPOOL_NUM_CLASSES];
+	size_t reserved;
+	size_t maxReserved;
+};
+
+// allocations, system allocations, bytes of the calling thread
+static thread_local int64_t t_counters[3];
+
+// MATPOOL_SCOPE nesting of the calling thread, and a worker adopting a scope
+static thread_local int t_scopes;
+static thread_local bool t_adopted;
+
+static std::mutex g_installLock;
+static int g_installed;                       // threads inside a scope
+static std::atomic<MatAllocator*> g_previous(NULL); // default allocator before the first scope
+static std::atomic<bool> g_everywhere(false); // MatPoolInstall of the executables
+
+// Threads outside the scopes keep the allocator they had
+static const MatAllocator* Passed(const MatAllocator *pool)
+{
+	MatAllocator *previous;
+
+	if (t_scopes || t_adopted || g_everywhere.load(std::memory_order_relaxed)) return NULL;
+	previous = g_previous.load(std::memory_order_acquire);
+	return (previous && (previous != pool)) ? previous : Mat::getStdAllocator();
+}
+
+MatPoolAllocator::MatPoolAllocator() : impl(new Impl)
+{
+	impl->reserved = 0;
+	impl->maxReserved = (sizeof(void*) == 8) ? ((size_t)1 << 30) : ((size_t)256 << 20);
+}
+
+MatPoolAllocator::~MatPoolAllocator()
+{
+	freeAllReservedBuffers();
+	delete impl;
+}
+
+void* MatPoolAllocator::take(size_t size, bool *fromSystem) const
+{
+	size_t classSize;
+	int cls = SizeClass(size, &classSize);
+	{
+		std::lock_guard<std::mutex> guard(impl->lock);
+		std::vector<void*> &list = impl->lists[cls];
+		if (!list.empty()){
+			void *ptr = list.back();
+			list.pop_back();
+			impl->reserved -= classSize;
+			*fromSystem = false;
+			return ptr;
+		}
+	}
+	*fromSystem = true;
+	return fastMalloc(classSize);
+}
+
+void MatPoolAllocator::give(void *ptr, size_t size) const
+{
+	size_t classSize;
+	int cls = SizeClass(size, &classSize);
+	{
+		std::lock_guard<std::mutex> guard(impl->lock);
+		if (impl->reserved + classSize <= impl->maxReserved){
+			impl->lists[cls].push_back(ptr);
+			impl->reserved += classSize;
+			return;
+		}
+	}
+	fastFree(ptr);
+}
+
+UMatData* MatPoolAllocator::allocate(int dims, const int* sizes, int type,
+	void* data0, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const
+{
+	size_t total = CV_ELEM_SIZE(type);
+	const MatAllocator *passed = Passed(this);
+	bool fromSystem;
+
+	// the UMatData of the other allocator points to it, so it frees the Mat too
+	if (passed) return passed->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+
+	for (int i = dims - 1; i >= 0; i--){
+		if (step){
+			if (data0 && step[i] != Mat::AUTO_STEP){
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			}
+			else step[i] = total;
+		}
+		total *= sizes[i];
+	}
+
+	// the header itself comes from the pool too
+	UMatData* u = new (take(sizeof(UMatData), &fromSystem)) UMatData(this);
+	if (data0){
+		u->data = u->origdata = (uchar*)data0;
+		u->flags |= UMatData::USER_ALLOCATED;
+	}
+	else{
+		u->data = u->origdata = (uchar*)take(total, &fromSystem);
+		t_counters[0]++;
+		t_counters[1] += fromSystem;
+		t_counters[2] += (int64_t)total;
+	}
+	u->size = total;
+
+	return u;
+}
+
+bool MatPoolAllocator::allocate(UMatData* u, AccessFlag /*accessflags*/, UMatUsageFlags /*usageFlags*/) const
+{
+	return u != NULL;
+}
+
+void MatPoolAllocator::deallocate(UMatData* u) const
+{
+	if (!u) return;
+
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+	if (!(u->flags & UMatData::USER_ALLOCATED)){
+		give(u->origdata, u->size);
+		u->origdata = 0;
+	}
+	u->~UMatData();
+	give(u, sizeof(UMatData));
+}
+
+BufferPoolController* MatPoolAllocator::getBufferPoolController(const char* /*id*/) const
+{
+	return const_cast<MatPoolAllocator*>(this);
+}
+
+size_t MatPoolAllocator::getReservedSize() const
+{
+	std::lock_guard<std::mutex> guard(impl->lock);
+	return impl->reserved;
+}
+
+size_t MatPoolAllocator::getMaxReservedSize() const
+{
+	std::lock_guard<std::mutex> guard(impl->lock);
+	return impl->maxReserved;
+}
+
+void MatPoolAllocator::setMaxReservedSize(size_t size)
+{
+	{
+		std::lock_guard<std::mutex> guard(impl->lock);
+		impl->maxReserved = size;
+		if (impl->reserved <= size) return;
+	}
+	freeAllReservedBuffers();
+}
+
+void MatPoolAllocator::freeAllReservedBuffers()
+{
+	std::lock_guard<std::mutex> guard(impl->lock);
+	for (int i = 0; i < MATPOOL_NUM_CLASSES; i++){
+		for (size_t j = 0; j < impl->lists[i].size(); j++) fastFree(impl->lists[i][j]);
+		impl->lists[i].clear();
+	}
+	impl->reserved = 0;
+}
+
+MatPoolAllocator* MatPoolInstance()
+{
+	static MatPoolAllocator* pool = new MatPoolAllocator();
+	return pool;
+}
+
+void MatPoolInstall()
+{
+	g_everywhere = true;
+	Mat::setDefaultAllocator(MatPoolInstance());
+}
+
+void MatPoolUninstall()
+{
+	g_everywhere = false;
+	Mat::setDefaultAllocator(Mat::getStdAllocator());
+}
+
+void MatPoolEnter()
+{
+	if (t_scopes++) return;
+	std::lock_guard<std::mutex> guard(g_installLock);
+	if (g_installed++) return;
+	g_previous.store(Mat::getDefaultAllocator(), std::memory_order_release);
+	Mat::setDefaultAllocator(MatPoolInstance());
+}
+
+void MatPoolLeave()
+{
+	if (--t_scopes) return;
+	std::lock_guard<std::mutex> guard(g_installLock);
+	if (--g_installed) return;
+	// Mats of the pool still alive free themselves through their UMatData
+	Mat::setDefaultAllocator(g_previous.load(std::memory_order_relaxed));
+}
+
+bool MatPoolActive()
+{
+	return (t_scopes > 0) || t_adopted;
+}
+
+void MatPoolAdopt(bool active)
+{
+	t_adopted = active;
+}
+
+//==============================================================================
+// Per-export accounting
+
+typedef struct {
+	const char *name;
+	std::atomic<int64_t> calls, allocations, systemAllocations, bytes;
+	std::atomic<int64_t> lastAllocations, lastSystemAllocations, lastBytes;
+} MatPoolExport;
+
+static MatPoolExport g_exports[MATPOOL_MAX_EXPORTS];
+static std::atomic<int> g_exportCount(0);
+static std::mutex g_exportLock;
+
+int MatPoolRegister(const char *exportName)
+{
+	std::lock_guard<std::mutex> guard(g_exportLock);
+	int count = g_exportCount.load();
+
+	for (int i = 0; i < count; i++)
+		if (!strcmp(g_exports[i].name, exportName)) return i;
+	if (count == MATPOOL_MAX_EXPORTS) return -1;
+	g_exports[count].name = exportName;
+	g_exportCount.store(count + 1);
+	return count;
+}
+
+void MatPoolSnapshot(int64_t counters[3])
+{
+	counters[0] = t_counters[0];
+	counters[1] = t_counters[1];
+	counters[2] = t_counters[2];
+}
+
+void MatPoolRecord(int slot, const int64_t before[3])
+{
+	if (slot < 0) return;
+	MatPoolExport &e = g_exports[slot];
+	int64_t allocations = t_counters[0] - before[0];
+	int64_t systemAllocations = t_counters[1] - before[1];
+	int64_t bytes = t_counters[2] - before[2];
+
+	e.calls++;
+	e.allocations += allocations;
+	e.systemAllocations += systemAllocations;
+	e.bytes += bytes;
+	e.lastAllocations = allocations;
+	e.lastSystemAllocations = systemAllocations;
+	e.lastBytes = bytes;
+}
+
+bool MatPoolGetStats(const char *exportName, MatPoolStats *stats)
+{
+	int count = g_exportCount.load();
+
+	for (int i = 0; i < count; i++){
+		MatPoolExport &e = g_exports[i];
+		if (strcmp(e.name, exportName)) continue;
+		stats->calls = e.calls;
+		stats->allocations = e.allocations;
+		stats->systemAllocations = e.systemAllocations;
+		stats->bytes = e.bytes;
+		stats->lastAllocations = e.lastAllocations;
+		stats->lastSystemAllocations = e.lastSystemAllocations;
+		stats->lastBytes = e.lastBytes;
+		return true;
+	}
+	return false;
+}
+
+void MatPoolResetStats()
+{
+	int count = g_exportCount.load();
+
+	for (int i = 0; i < count; i++){
+		MatPoolExport &e = g_exports[i];
+		e.calls = 0; e.allocations = 0; e.systemAllocations = 0; e.bytes = 0;
+		e.lastAllocations = 0; e.lastSystemAllocations = 0; e.lastBytes = 0;
+	}
+}
@@ -0,0 +1,107 @@
+//==============================================================================
+//
+// Title:       MatPool
+// Purpose:     Pooled cv::MatAllocator with size-class free lists.
+//
+//              Every Mat created inside an export (convertTo, clone,
+//              GaussianBlur destinations, CLAHE buffers etc.) is served from
+//              recycled blocks, so steady-state processing of same-sized
+//              frames does not touch the system heap.
+//
+//              The DLL shares OpenCV with the rest of the LabVIEW process, so
+//              the pool is the default allocator only while a MATPOOL_SCOPE
+//              runs, and even then serves only the threads inside one and
+//              the context workers running their parallelFor. Every other
+//              thread is passed on to the allocator installed before.
+//
+//==============================================================================
+
+#ifndef __MatPool_H__
+#define __MatPool_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "opencv2/core.hpp"
+#include "opencv2/core/bufferpool.hpp"
+
+typedef struct {
+	int64_t calls;              // export calls recorded
+	int64_t allocations;        // Mat buffers requested
+	int64_t systemAllocations;  // requests which were not served from the free lists
+	int64_t bytes;              // bytes requested
+	int64_t lastAllocations;    // same counters for the most recent call
+	int64_t lastSystemAllocations;
+	int64_t lastBytes;
+} MatPoolStats;
+
+class MatPoolAllocator : public cv::MatAllocator, public cv::BufferPoolController
+{
+public:
+	MatPoolAllocator();
+	~MatPoolAllocator();
+
+	// cv::MatAllocator
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+		cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+	bool allocate(cv::UMatData* data, cv::AccessFlag accessflags, cv::UMatUsageFlags usageFlags) const override;
+	void deallocate(cv::UMatData* data) const override;
+	cv::BufferPoolController* getBufferPoolController(const char* id = NULL) const override;
+
+	// cv::BufferPoolController
+	size_t getReservedSize() const override;
+	size_t getMaxReservedSize() const override;
+	void setMaxReservedSize(size_t size) override;
+	void freeAllReservedBuffers() override;
+
+private:
+	void* take(size_t size, bool *fromSystem) const;
+	void give(void *ptr, size_t size) const;
+
+	struct Impl;
+	Impl *impl;
+};
+
+// Process-wide pool instance. Never destroyed, because Mats released during
+// DLL unload may still point back to it.
+MatPoolAllocator* MatPoolInstance();
+
+// Installs the pool as cv::Mat default allocator for every thread (and
+// restores the std one). For the executables only, the DLL uses the scopes
+void MatPoolInstall();
+void MatPoolUninstall();
+
+// The first scope of any thread installs the pool, the last one restores the
+// allocator before. Nested scopes of a thread only count
+void MatPoolEnter();
+void MatPoolLeave();
+
+// Whether the calling thread is served by the pool, and the same for a worker
+// thread running a part of the work of another one
+bool MatPoolActive();
+void MatPoolAdopt(bool active);
+
+// Per-export accounting. The counters are thread local, so the numbers
+// recorded for an export call are exact even when LabVIEW runs several
+// exports in parallel.
+int  MatPoolRegister(const char *exportName);
+void MatPoolSnapshot(int64_t counters[3]);
+void MatPoolRecord(int slot, const int64_t before[3]);
+bool MatPoolGetStats(const char *exportName, MatPoolStats *stats);
+void MatPoolResetStats();
+
+class MatPoolScope
+{
+public:
+	explicit MatPoolScope(int slot) : slot(slot) { MatPoolEnter(); MatPoolSnapshot(before); }
+	~MatPoolScope() { MatPoolRecord(slot, before); MatPoolLeave(); }
+private:
+	int slot;
+	int64_t before[3];
+};
+
+// Put at the top of every export to pool and account its temporaries
+#define MATPOOL_SCOPE() \
+	static const int matPoolSlot = MatPoolRegister(__func__); \
+	MatPoolScope matPoolScope(matPoolSlot)
+
+#endif  /* ndef __MatPool_H__ */
@@ -0,0 +1,348 @@
+//==============================================================================
+//
+// Title:       Multiscale
+// Purpose:     Processing kernels of the multiscale transform on cv::Mat.
+//
+//==============================================================================
+
+#include <math.h>
+#include <string.h>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include "Multiscale.h"
+#include "Profile.h"
+
+using namespace cv;
+
+//Defaults of the presets, keep in sync with Convolution with PreSets.vi
+static const float SeifertKernel[25] = {
+	1,  4,  6,  4, 1,
+	4, 16, 24, 16, 4,
+	6, 24, 36, 24, 6,
+	4, 16, 24, 16, 4,
+	1,  4,  6,  4, 1 };
+
+static const float HighlightDetailsKernel[9] = {
+	-1, -1, -1,
+	-1, 10, -1,
+	-1, -1, -1 };
+
+static const char *ConvPresetNames[MS_CONV_PRESET_COUNT] = {
+	"None", "Seifert 5x5", "Highlight Details 3x3" };
+
+static Mat ConvKernels[MS_CONV_PRESET_COUNT];
+static std::mutex ConvKernelsLock;
+static std::atomic<uint64_t> ConvKernelsGeneration(0);
+
+static void NormalizeKernel(Mat &kernel)
+{
+	double sum = cv::sum(kernel)[0];
+	if (sum != 0) kernel /= sum;
+}
+
+Mat MSGetConvKernel(int preset)
+{
+	std::lock_guard<std::mutex> guard(ConvKernelsLock);
+
+	if ((preset <= MS_CONV_NONE) || (preset >= MS_CONV_PRESET_COUNT)) return Mat();
+	if (ConvKernels[MS_CONV_SEIFERT_5X5].empty()){
+		ConvKernels[MS_CONV_SEIFERT_5X5] = Mat(5, 5, CV_32FC1, (void*)SeifertKernel).clone();
+		ConvKernels[MS_CONV_HIGHLIGHT_DETAILS_3X3] = Mat(3, 3, CV_32FC1, (void*)HighlightDetailsKernel).clone();
+		NormalizeKernel(ConvKernels[MS_CONV_SEIFERT_5X5]);
+		NormalizeKernel(ConvKernels[MS_CONV_HIGHLIGHT_DETAILS_3X3]);
+	}
+	return ConvKernels[preset];
+}
+
+bool MSSetConvKernel(int preset, const float *kernel, int size)
+{
+	if ((preset <= MS_CONV_NONE) || (preset >= MS_CONV_PRESET_COUNT)) return false;
+	if (!kernel || (size <= 0) || !(size & 1)) return false;
+
+	MSGetConvKernel(preset); //defaults first, so they do not overwrite this one later
+	Mat k = Mat(size, size, CV_32FC1, (void*)kernel).clone();
+	NormalizeKernel(k);
+
+	std::lock_guard<std::mutex> guard(ConvKernelsLock);
+	ConvKernels[preset] = k;
+	ConvKernelsGeneration++;
+	return true;
+}
+
+uint64_t MSConvKernelGeneration()
+{
+	return ConvKernelsGeneration;
+}
+
+const char* MSConvPresetName(int preset)
+{
+	if ((preset < 0) || (preset >= MS_CONV_PRESET_COUNT)) return "";
+	return ConvPresetNames[preset];
+}
+
+int MSConvPresetFromName(const char *name)
+{
+	for (int i = 0; i < MS_CONV_PRESET_COUNT; i++)
+		if (!strcmp(name, ConvPresetNames[i])) return i;
+	return -1;
+}
+
+void MSConvolve(const Mat &src, Mat &dst, int preset)
+{
+	if ((preset <= MS_CONV_NONE) || (preset >= MS_CONV_PRESET_COUNT)){
+		if (src.data != dst.data) src.copyTo(dst);
+		return;
+	}
+	filter2D(src, dst, -1, MSGetConvKernel(preset), Point(-1, -1), 0, BORDER_REFLECT_101);
+}
+
+void MSPyrDown(const Mat &src, Mat &dst)
+{
+	pyrDown(src, dst, Size(src.cols / 2, src.rows / 2));
+}
+
+void MSPyrUp(const Mat &src, Mat &dst, Size size)
+{
+	pyrUp(src, dst, size.empty() ? Size(src.cols * 2, src.rows * 2) : size);
+}
+
+void MSClahe(const Mat &src, Mat &dst, MSClaheParams *params, Ptr<CLAHE> &clahe)
+{
+	MS_PROFILE(MS_PROF_CLAHE);
+	Size tileGridSize;
+
+	if (clahe.empty()) clahe = createCLAHE();
+
+	params->clipLimit = params->clipLimit == 0 ? 40 : params->clipLimit;
+	params->tileWidth = params->tileWidth == 0 ? 8 : params->tileWidth;
+	params->tileHeight = params->tileHeight == 0 ? 8 : params->tileHeight;
+
+	clahe->setClipLimit(params->clipLimit);
+	clahe->setTilesGridSize(Size(params->tileWidth, params->tileHeight));
+
+	params->clipLimit = clahe->getClipLimit();
+	tileGridSize = clahe->getTilesGridSize();
+	params->tileWidth = tileGridSize.width;
+	params->tileHeight = tileGridSize.height;
+
+	clahe->apply(src, dst);
+}
+
+//based on https://stackoverflow.com/questions/68703443/unsharp-mask-implementation-with-opencv
+void MSUnsharpMask(const Mat &src, Mat &dst, const MSUnsharpParams &params, Mat scratch[3])
+{
+	MS_PROFILE(MS_PROF_UNSHARP);
+	Mat &input = scratch[0], &blurred = scratch[1], &unsharpMask = scratch[2];
+
+	// work using floating point images to avoid overflows
+	src.convertTo(input, CV_32FC1);
+
+	// create the blurred copy
+	GaussianBlur(input, blurred, Size(3, 3), params.radius);
+
+	// subtract blurred from original, pixel-by-pixel to make unsharp mask
+	subtract(input, blurred, unsharpMask);
+
+	// --- filter on the mask ---
+	blur(unsharpMask, unsharpMask, {3,3});
+
+	// apply mask to image, in place on the float copy
+	for (int row = 0; row < input.rows; row++){
+		float *in = input.ptr<float>(row);
+		const float *difference = unsharpMask.ptr<float>(row);
+		for (int col = 0; col < input.cols; col++){
+			if (fabsf(difference[col]) >= params.threshold) in[col] += params.amount * difference[col];
+		}
+	}
+
+	// convert back to destination type
+	input.convertTo(dst, dst.empty() ? src.type() : dst.type());
+}
+
+void MSApplyTransform(Mat &img, int startLine, int endLine, double divider, double power, double multiplier)
+{
+	double temp0, temp1;
+
+	for (int y = startLine; y < endLine; y++){
+		float *ptr = img.ptr<float>(y);
+		for (int x = 0; x < img.cols; x++){
+			temp0 = ptr[x];
+			temp1 = fabs(temp0) / divider;
+			temp1 = temp1 ? MSFastPow(temp1, power) * multiplier : 0.0;
+			ptr[x] = (float)(temp0 < 0 ? -temp1 : temp1);
+		}
+	}
+}
+
+void MSApplyPower(Mat &img, int startLine, int endLine, double power)
+{
+	for (int y = startLine; y < endLine; y++){
+		float *ptr = img.ptr<float>(y);
+		for (int x = 0; x < img.cols; x++) ptr[x] = (float)MSFastPow(ptr[x], power);
+	}
+}
+
+void MSPowTableInit(MSPowTable &table, double power, double scale)
+{
+	const int size = (MS_POW_TABLE_MAX_EXP - MS_POW_TABLE_MIN_EXP) << MS_POW_TABLE_BITS;
+	const int segments = 1 << MS_POW_TABLE_BITS;
+
+	table.power = power;
+	table.scale = scale;
+	table.values.resize(size + 1);
+	for (int i = 0; i <= size; i++){
+		double x = ldexp(1.0 + (double)(i & (segments - 1)) / segments, MS_POW_TABLE_MIN_EXP + (i >> MS_POW_TABLE_BITS));
+		table.values[i] = (float)(scale * pow(x, power));
+	}
+}
+
+void MSApplyTransformTable(Mat &img, int startLine, int endLine, double divider, const MSPowTable &tone)
+{
+	const float scale = (float)(1.0 / divider);
+
+	for (int y = startLine; y < endLine; y++){
+		float *ptr = img.ptr<float>(y);
+		for (int x = 0; x < img.cols; x++){
+			float v = MSPowTableLookup(tone, fabsf(ptr[x]) * scale);
+			ptr[x] = ptr[x] < 0 ? -v : v;
+		}
+	}
+}
+
+float MSSubtractSegmentMax(const Mat &a, const Mat &b, Mat &dst, Mat &segMax)
+{
+	float total = 0;
+
+	for (int y = 0; y < a.rows; y++){
+		const float *pa = a.ptr<float>(y), *pb = b.ptr<float>(y);
+		float *pd = dst.ptr<float>(y), *seg = segMax.ptr<float>(y);
+		for (int s = 0, x0 = 0; x0 < a.cols; s++, x0 += MS_FLAT_SEGMENT){
+			int x1 = std::min(x0 + MS_FLAT_SEGMENT, a.cols);
+			float m = 0;
+			for (int x = x0; x < x1; x++){
+				pd[x] = pa[x] - pb[x];
+				m = std::max(m, fabsf(pd[x]));
+			}
+			seg[s] = m;
+			total = std::max(total, m);
+		}
+	}
+	return total;
+}
+
+void MSApplyTransformTableFlat(Mat &img, int startLine, int endLine, double divider, const MSPowTable &tone,
+	const Mat &segMax, float limit)
+{
+	const float scale = (float)(1.0 / divider);
+
+	for (int y = startLine; y < endLine; y++){
+		float *ptr = img.ptr<float>(y);
+		const float *seg = segMax.ptr<float>(y);
+		for (int s = 0, x0 = 0; x0 < img.cols; s++, x0 += MS_FLAT_SEGMENT){
+			int x1 = std::min(x0 + MS_FLAT_SEGMENT, img.cols);
+			if (seg[s] <= limit){
+				memset(ptr + x0, 0, (x1 - x0) * sizeof(float));
+				continue;
+			}
+			for (int x = x0; x < x1; x++){
+				float v = MSPowTableLookup(tone, fabsf(ptr[x]) * scale);
+				ptr[x] = ptr[x] < 0 ? -v : v;
+			}
+		}
+	}
+}
+
+void MSApplyTransformTableMulti(const Mat &src, Mat *dst, int count, int startLine, int endLine,
+	const double *divider, const MSPowTable *const *tone)
+{
+	for (int y = startLine; y < endLine; y++){
+		const float *in = src.ptr<float>(y);
+		for (int i = 0; i < count; i++){
+			const float scale = (float)(1.0 / divider[i]);
+			float *ptr = dst[i].ptr<float>(y);
+			for (int x = 0; x < src.cols; x++){
+				float v = MSPowTableLookup(*tone[i], fabsf(in[x]) * scale);
+				ptr[x] = in[x] < 0 ? -v : v;
+			}
+		}
+	}
+}
+
+void MSApplyPowerTable(Mat &img, int startLine, int endLine, const MSPowTable &post)
+{
+	for (int y = startLine; y < endLine; y++){
+		float *ptr = img.ptr<float>(y);
+		for (int x = 0; x < img.cols; x++) ptr[x] = MSPowTableLookup(post, ptr[x]);
+	}
+}
+
+void MSDisplayTableInit(MSDisplayTable &table, const MSDisplayParams &display, double post, double maxOut)
+{
+	double low = display.center - display.width / 2, high = display.center + display.width / 2;
+	double gamma = display.gamma > 0 ? display.gamma : 1.0, x0 = low, x1 = high;
+	bool power = (post > 0) && (post != 1.0);
+
+	// inputs below x0 or above x1 end up clamped, the table spans only the window
+	if (power){
+		x0 = low > 0 ? pow(low, 1.0 / post) : 0;
+		x1 = high > 0 ? pow(high, 1.0 / post) : 0;
+	}
+	if (!(x1 > x0)) x1 = x0 + 1;
+	table.offset = (float)x0;
+	table.scale = (float)((MS_DISPLAY_TABLE_SIZE - 1) / (x1 - x0));
+	table.values.resize(MS_DISPLAY_TABLE_SIZE + 1);
+	for (int i = 0; i < MS_DISPLAY_TABLE_SIZE; i++){
+		double x = x0 + i * (x1 - x0) / (MS_DISPLAY_TABLE_SIZE - 1), y = x;
+		if (power) y = x > 0 ? pow(x, post) : 0;
+		double t = display.width > 0 ? (y - low) / display.width : 0;
+		t = t < 0 ? 0 : (t > 1 ? 1 : t);
+		table.values[i] = (float)(maxOut * (gamma == 1.0 ? t : pow(t, 1.0 / gamma)));
+	}
+	table.values[MS_DISPLAY_TABLE_SIZE] = table.values[MS_DISPLAY_TABLE_SIZE - 1];
+}
+
+template <typename T> static void MSApplyDisplayRows(const Mat &a, const Mat *b, Mat &dst, const MSDisplayTable &table)
+{
+	const float *values = table.values.data(), last = (float)(MS_DISPLAY_TABLE_SIZE - 1);
+
+	for (int y = 0; y < a.rows; y++){
+		const float *pa = a.ptr<float>(y), *pb = b ? b->ptr<float>(y) : NULL;
+		T *out = dst.ptr<T>(y);
+		for (int x = 0; x < a.cols; x++){
+			float f = ((pb ? pa[x] + pb[x] : pa[x]) - table.offset) * table.scale;
+			f = f > 0 ? (f < last ? f : last) : 0;
+			int i = (int)f;
+			out[x] = (T)(values[i] + (f - i) * (values[i + 1] - values[i]) + 0.5f);
+		}
+	}
+}
+
+void MSApplyDisplay(const Mat &a, const Mat *b, Mat &dst, const MSDisplayTable &table)
+{
+	if (dst.type() == CV_8UC1) MSApplyDisplayRows<uint8_t>(a, b, dst, table);
+	else MSApplyDisplayRows<uint16_t>(a, b, dst, table);
+}
+
+void MSCoarseTableInit(std::vector<float> &table, double power, double multiplier)
+{
+	table.resize(MS_COARSE_TABLE_SIZE + 1);
+	for (int i = 0; i <= MS_COARSE_TABLE_SIZE; i++)
+		table[i] = (float)(multiplier * pow((double)i / MS_COARSE_TABLE_SIZE, power));
+}
+
+void MSApplyTransformCoarse(Mat &img, int startLine, int endLine, double divider,
+	const std::vector<float> &table, double power, double multiplier)
+{
+	const float scale = (float)(MS_COARSE_TABLE_SIZE / divider);
+
+	for (int y = startLine; y < endLine; y++){
+		float *ptr = img.ptr<float>(y);
+		for (int x = 0; x < img.cols; x++){
+			float t = fabsf(ptr[x]) * scale, v;
+			if (t <= MS_COARSE_TABLE_SIZE) v = table[(int)(t + 0.5f)];
+			else v = (float)(MSFastPow(t / MS_COARSE_TABLE_SIZE, power) * multiplier);
+			ptr[x] = ptr[x] < 0 ? -v : v;
+		}
+	}
+}
@@ -0,0 +1,161 @@
+//==============================================================================
+//
+// Title:       Multiscale
+// Purpose:     Processing kernels of the multiscale transform on cv::Mat.
+//
+//              Nothing in here knows about LabVIEW or IMAQ images, the
+//              exports wrap the image memory into Mats and call these.
+//
+//==============================================================================
+
+#ifndef __Multiscale_H__
+#define __Multiscale_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+
+typedef struct {
+	float amount;
+	float radius;
+	float threshold;
+} MSUnsharpParams;
+
+// Same order as Conv Flt Presets.ctl
+enum MSConvPreset {
+	MS_CONV_NONE = 0,
+	MS_CONV_SEIFERT_5X5,
+	MS_CONV_HIGHLIGHT_DETAILS_3X3,
+	MS_CONV_PRESET_COUNT
+};
+
+typedef struct {
+	double clipLimit;   //0 - default 40
+	int32_t tileWidth;  //0 - default 8
+	int32_t tileHeight; //0 - default 8
+} MSClaheParams;
+
+// Window/level of the display output, in the units of the result after the post power
+typedef struct {
+	double center;
+	double width;       // > 0
+	double gamma;       // output = t^(1 / gamma) for t in [0, 1] across the window, 0 or 1 - linear
+} MSDisplayParams;
+
+// Schraudolph approximation, same as in MP Helper
+inline double MSFastPow(double a, double b)
+{
+	union {
+		double d;
+		int x[2];
+	} u = { a };
+	u.x[1] = (int)(b * (u.x[1] - 1072632447) + 1072632447);
+	u.x[0] = 0;
+	return u.d;
+}
+
+// scale * x^power, piecewise linear over 64 segments per octave of x,
+// exact to ~1e-5 relative for 2^-24 <= x < 2^40, outside computed with pow()
+#define MS_POW_TABLE_MIN_EXP	-24
+#define MS_POW_TABLE_MAX_EXP	40
+#define MS_POW_TABLE_BITS		6
+
+typedef struct {
+	double power;
+	double scale;
+	std::vector<float> values;
+} MSPowTable;
+
+void MSPowTableInit(MSPowTable &table, double power, double scale);
+
+inline float MSPowTableLookup(const MSPowTable &table, float x) //x >= 0
+{
+	const int size = (MS_POW_TABLE_MAX_EXP - MS_POW_TABLE_MIN_EXP) << MS_POW_TABLE_BITS;
+	uint32_t bits;
+	int32_t idx;
+	float frac;
+
+	memcpy(&bits, &x, sizeof(bits));
+	idx = (int32_t)(bits >> (23 - MS_POW_TABLE_BITS)) - ((127 + MS_POW_TABLE_MIN_EXP) << MS_POW_TABLE_BITS);
+	if ((uint32_t)idx >= (uint32_t)size) return x > 0 ? (float)(table.scale * pow(x, table.power)) : 0.0f;
+	frac = (bits & ((1u << (23 - MS_POW_TABLE_BITS)) - 1)) * (1.0f / (1u << (23 - MS_POW_TABLE_BITS)));
+	return table.values[idx] + frac * (table.values[idx + 1] - table.values[idx]);
+}
+
+// U16 or SGL, dst is created (or must already be) half / double size,
+// pyrUp may target an odd size to match the level it came from
+void MSPyrDown(const cv::Mat &src, cv::Mat &dst);
+void MSPyrUp(const cv::Mat &src, cv::Mat &dst, cv::Size size = cv::Size());
+
+// U16 only, params are replaced by the values actually used
+void MSClahe(const cv::Mat &src, cv::Mat &dst, MSClaheParams *params, cv::Ptr<cv::CLAHE> &clahe);
+
+// U16 or SGL, dst keeps its own type, scratch holds three SGL work images
+void MSUnsharpMask(const cv::Mat &src, cv::Mat &dst, const MSUnsharpParams &params, cv::Mat scratch[3]);
+
+// Convolution with one of the presets, normalized by the kernel sum like IMAQ Convolute.
+// MS_CONV_NONE copies (or does nothing when src and dst are the same Mat)
+void MSConvolve(const cv::Mat &src, cv::Mat &dst, int preset);
+
+// Normalized kernel of a preset, empty for MS_CONV_NONE
+cv::Mat MSGetConvKernel(int preset);
+
+// Replaces the kernel of a preset, e.g. with the one from Convolution with PreSets.vi
+bool MSSetConvKernel(int preset, const float *kernel, int size);
+uint64_t MSConvKernelGeneration(); //changes with every MSSetConvKernel, plans holding older kernels are stale
+const char* MSConvPresetName(int preset);
+int MSConvPresetFromName(const char *name); //-1 if unknown
+
+// In place on SGL rows [startLine, endLine): sign(x) * Multiplier * (|x| / Divider)^Power
+void MSApplyTransform(cv::Mat &img, int startLine, int endLine, double divider, double power, double multiplier);
+
+// In place on SGL rows [startLine, endLine): x^Power
+void MSApplyPower(cv::Mat &img, int startLine, int endLine, double power);
+
+// Table driven variants, tone holds Multiplier * t^Power, post holds x^Power (x < 0 gives 0)
+void MSApplyTransformTable(cv::Mat &img, int startLine, int endLine, double divider, const MSPowTable &tone);
+void MSApplyPowerTable(cv::Mat &img, int startLine, int endLine, const MSPowTable &post);
+
+// Flat segment statistics: max |x| of every MS_FLAT_SEGMENT pixels of a row
+#define MS_FLAT_SEGMENT	32
+
+// dst = a - b for SGL images of the same size, segMax (rows x segments, SGL)
+// receives the max |dst| of every segment. Returns the max of all of them
+float MSSubtractSegmentMax(const cv::Mat &a, const cv::Mat &b, cv::Mat &dst, cv::Mat &segMax);
+
+// MSApplyTransformTable that writes 0 to segments whose max is <= limit,
+// segMax rows are those of img
+void MSApplyTransformTableFlat(cv::Mat &img, int startLine, int endLine, double divider, const MSPowTable &tone,
+	const cv::Mat &segMax, float limit);
+
+// MSApplyTransformTable of src into count images at once, every source row is
+// read once for all of them. dst[i] same size as src, divider[i] > 0
+void MSApplyTransformTableMulti(const cv::Mat &src, cv::Mat *dst, int count, int startLine, int endLine,
+	const double *divider, const MSPowTable *const *tone);
+
+// Post power, window/level, clamp and gamma in one table of MS_DISPLAY_TABLE_SIZE
+// entries over the inputs that map into the window, linear in between
+#define MS_DISPLAY_TABLE_SIZE	65536
+
+typedef struct {
+	float offset, scale;     // table index = (x - offset) * scale
+	std::vector<float> values;
+} MSDisplayTable;
+
+// post 0 or 1 - no post power (x^post, x < 0 gives 0), maxOut 255 or 65535
+void MSDisplayTableInit(MSDisplayTable &table, const MSDisplayParams &display, double post, double maxOut);
+
+// dst (U8 or U16) = table(a + b), b may be NULL, all with the same number of rows
+void MSApplyDisplay(const cv::Mat &a, const cv::Mat *b, cv::Mat &dst, const MSDisplayTable &table);
+
+// Reduced precision tone curve: nearest of MS_COARSE_TABLE_SIZE samples of
+// Multiplier * t^Power for t = |x| / Divider in [0, 1], MSFastPow above
+#define MS_COARSE_TABLE_SIZE	1024
+void MSCoarseTableInit(std::vector<float> &table, double power, double multiplier);
+void MSApplyTransformCoarse(cv::Mat &img, int startLine, int endLine, double divider,
+	const std::vector<float> &table, double power, double multiplier);
+
+#endif  /* ndef __Multiscale_H__ */
@@ -0,0 +1,849 @@
+//==============================================================================
+//
+// Title:       MultiscaleBench
+// Purpose:     Reproducible benchmark of the native functions behind every
+//              export and of the full pipeline.
+//
+//              multiscale_bench [-s Settings.ini] [-i Images] [-t threads]
+//                               [-o results.json] [--sizes 512,1024,2048]
+//                               [--synthetic 4096,8192,16384] [--min-ms 300]
+//                               [--golden dir [--record]]
+//                               [--roofline 2048x2048 [--bandwidth GB/s] [--peak GFLOP/s]]
+//
+//              Connector1, Balls2 and Part6-8 are scaled to every size, the
+//              synthetic frames are generated. Each case is repeated until
+//              min-ms have passed (at least 3, at most 200 runs) and the
+//              median is reported with Mpix/s and effective GB/s, i.e. the
+//              bytes the operation must read and write at least, as JSON.
+//              LabVIEW marshalling is not included, see the marshal stage
+//              of opencv2ProfileStats for that.
+//
+//              With --golden every processing mode runs on all Images/*.png at
+//              full size and its output is compared with the golden output
+//              of the reference mode (levels, table pow) by max abs error,
+//              PSNR and SSIM. --record writes the golden outputs instead,
+//              with their hashes and the worst error of every mode plus a
+//              margin as its tolerance into golden.txt; commit both.
+//              The quality results next to the speedup over the reference
+//              are added to the JSON, a mode out of tolerance fails the run.
+//
+//              --roofline models bytes and flops of every stage of a frame of
+//              that geometry and compares the measured stage times with the
+//              roofline of the machine. Bandwidth and peak are measured unless
+//              given; the measured peak is what scalar code reaches, pass the
+//              datasheet value for the vector units.
+//
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "MatPool.h"
+#include "Multiscale.h"
+#include "Context.h"
+#include "Pipeline.h"
+#include "Settings.h"
+#include "Plan.h"
+#include "Quality.h"
+#include "Roofline.h"
+#include "Ingest.h"
+
+using namespace cv;
+
+#define BENCH_MIN_RUNS	3
+#define BENCH_MAX_RUNS	200
+
+static const char *BenchImages[] = { "Connector1", "Balls2", "Part6", "Part7", "Part8" };
+
+typedef struct {
+	std::string op, image;
+	int width, height;
+	const char *type;
+	int runs;
+	double ms, minMs, mpixPerSec, gbPerSec;
+} BenchResult;
+
+typedef struct {
+	const char *name;
+	int schedule;            // MSSchedule
+	int shed;                // MSShed fast paths
+	bool incremental;        // MSProcessIncremental, decomposition reused
+	bool viewport;           // MSProcessROI of the centre quarter
+	bool fixed;              // with viewport: viewports tiling the frame with GOLDEN_DIVIDER
+	bool progressive;        // MSProcessProgressive from 1/4 resolution
+	bool sweep;              // MSProcessSweep, last of several parameter sets
+	bool masked;             // MSProcessMasked, flat tiles left out
+	bool display;            // MSProcessDisplay into U8 with GoldenDisplay
+	MSQualityTolerance tolerance;
+} GoldenMode;
+
+// The first mode is the reference the golden outputs are recorded with. The
+// tolerances are upper limits only: --record fails if the measured worst of a
+// mode is beyond its limit, and --golden checks only the recorded tolerance
+static const GoldenMode GoldenModes[] = {
+	{ "levels",        MS_SCHEDULE_LEVELS, 0,                                  false, false, false, false, false, false, false, { 1,    90, 0.9999 } },
+	{ "graph",         MS_SCHEDULE_GRAPH,  0,                                  false, false, false, false, false, false, false, { 1,    90, 0.9999 } },
+	{ "incremental",   MS_SCHEDULE_LEVELS, 0,                                  true,  false, false, false, false, false, false, { 1,    90, 0.9999 } },
+	{ "viewport",      MS_SCHEDULE_LEVELS, 0,                                  false, true,  false, false, false, false, false, { 1,    90, 0.9999 } },
+	// windowed decomposition, compared with MSProcess of the same fixed divider
+	{ "roi_fixed",     MS_SCHEDULE_LEVELS, 0,                                  false, true,  true,  false, false, false, false, { 1,    90, 0.9999 } },
+	{ "progressive",   MS_SCHEDULE_LEVELS, 0,                                  false, false, false, true,  false, false, false, { 1,    90, 0.9999 } },
+	{ "sweep",         MS_SCHEDULE_LEVELS, 0,                                  false, false, false, false, true,  false, false, { 1,    90, 0.9999 } },
+	// flat tiles vary by MS_MASK_FLATNESS of the range at most, their detail
+	// is dropped and the tone curves lift it, so a few hundred counts there.
+	// Estimated, not measured, the recording replaces it
+	{ "masked",        MS_SCHEDULE_LEVELS, 0,                                  false, false, false, false, false, true,  false, { 1024, 45, 0.995 } },
+	// the reference goes through window/level and gamma separately, from its
+	// U16 rounding, which the steep start of the gamma curve turns into 1-2 levels.
+	// Estimated, not measured, the recording replaces it
+	{ "display",       MS_SCHEDULE_LEVELS, 0,                                  false, false, false, false, false, false, true,  { 2,    45, 0.999 } },
+	// tone curves map the skipped segments to at most 1/256, the reconstruction sums the levels
+	{ "flat",          MS_SCHEDULE_LEVELS, MS_SHED_FLAT,                       false, false, false, false, false, false, false, { 256,  50, 0.999 } },
+	{ "fast_pow",      MS_SCHEDULE_LEVELS, MS_SHED_FAST_POW,                   false, false, false, false, false, false, false, { 2048, 40, 0.99 } },
+	{ "coarse_level0", MS_SCHEDULE_LEVELS, MS_SHED_FAST_POW | MS_SHED_LEVEL0,  false, false, false, false, false, false, false, { 4096, 35, 0.98 } }
+};
+
+typedef struct {
+	const char *mode;
+	std::string image;
+	int width, height;
+	double ms, speedup;
+	MSQuality quality;
+	bool pass;
+} GoldenResult;
+
+static const char *RooflineStageNames[MS_STAGE_COUNT] = {
+	"input", "decompose", "tone", "filters", "reconstruct", "unsharp", "output" };
+
+typedef struct {
+	int width, height;
+	double bandwidth, peak;  // GB/s, GFLOP/s
+	MSRooflineStage stages[MS_STAGE_COUNT];
+} RooflineResult;
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: multiscale_bench [-s Settings.ini] [-i Images] [-t threads] [-o results.json]\n"
+		"                        [--sizes 512,1024,2048] [--synthetic 4096,8192,16384] [--min-ms 300]\n"
+		"  -s  pipeline parameters, default ../Settings.ini\n"
+		"  -i  directory with the test images, default ../Images\n"
+		"  -t  threads of the context, default all cores\n"
+		"  -o  JSON output, default stdout\n"
+		"  --sizes      sizes the test images are scaled to\n"
+		"  --synthetic  sizes of the generated frames, empty list for none\n"
+		"  --min-ms     time spent on every case\n"
+		"  --golden     directory with the golden outputs, compares every mode against them\n"
+		"  --record     writes the golden outputs of the reference mode instead\n"
+		"  --roofline   bytes, flops and roofline efficiency of every stage for a WxH frame\n"
+		"  --bandwidth  memory bandwidth for the roofline, default measured (STREAM triad)\n"
+		"  --peak       peak GFLOP/s for the roofline, default measured\n");
+}
+
+static double NowMs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1e6;
+}
+
+static std::vector<int> ParseSizes(const char *list)
+{
+	std::vector<int> sizes;
+
+	for (const char *p = list; *p; ){
+		int size = atoi(p);
+		if (size > 0) sizes.push_back(size);
+		while (*p && (*p != ',')) p++;
+		if (*p) p++;
+	}
+	return sizes;
+}
+
+// Smooth structure plus noise, compresses like a real radiograph
+static Mat SyntheticFrame(int size)
+{
+	Mat frame(size, size, CV_16UC1), noise(size, size, CV_16UC1);
+
+	for (int y = 0; y < size; y++){
+		uint16_t *row = frame.ptr<uint16_t>(y);
+		for (int x = 0; x < size; x++)
+			row[x] = (uint16_t)(2048 + 1024 * sin(x * 0.013) * cos(y * 0.007) + 512.0 * x / size);
+	}
+	randu(noise, 0, 64);
+	frame += noise;
+	return frame;
+}
+
+// Runs prepare (untimed) and op until minMs are used, median and fastest run in ms
+static void Measure(const std::function<void()> &prepare, const std::function<void()> &op,
+	double minMs, int *runs, double *medianMs, double *fastestMs)
+{
+	std::vector<double> times;
+	double start = NowMs(), t0;
+
+	prepare();
+	op(); //warm up, allocates the pools
+	while (((int)times.size() < BENCH_MIN_RUNS) || (((NowMs() - start) < minMs) && ((int)times.size() < BENCH_MAX_RUNS))){
+		prepare();
+		t0 = NowMs();
+		op();
+		times.push_back(NowMs() - t0);
+	}
+	std::sort(times.begin(), times.end());
+	*runs = (int)times.size();
+	*medianMs = times[times.size() / 2];
+	*fastestMs = times[0];
+}
+
+// body returns an MSStatus, a failed op is reported and left out of the results
+static bool Run(std::vector<BenchResult> &results, const char *op, const std::string &image, const Mat &frame,
+	const char *type, double bytes, double minMs, const std::function<void()> &prepare, const std::function<int()> &body)
+{
+	BenchResult r;
+	int status = MS_OK;
+
+	Measure(prepare, [&]{ if (status == MS_OK) status = body(); }, minMs, &r.runs, &r.ms, &r.minMs);
+	if (status != MS_OK){
+		fprintf(stderr, "%-10s %-12s %5dx%-5d %s, skipped\n", op, image.c_str(), frame.cols, frame.rows, MSStatusText(status));
+		return false;
+	}
+
+	r.op = op;
+	r.image = image;
+	r.width = frame.cols;
+	r.height = frame.rows;
+	r.type = type;
+	r.mpixPerSec = (double)frame.total() / (r.ms * 1e3);
+	r.gbPerSec = bytes / (r.ms * 1e6);
+	results.push_back(r);
+
+	fprintf(stderr, "%-10s %-12s %5dx%-5d %8.3f ms %9.1f Mpix/s %7.2f GB/s\n",
+		op, image.c_str(), r.width, r.height, r.ms, r.mpixPerSec, r.gbPerSec);
+	return true;
+}
+
+static void FirstPreview(const MSPreviewInfo *info, const Mat &, void *user)
+{
+	std::vector<double> *firstUs = (std::vector<double> *)user;
+
+	if (info->level == 2) firstUs->push_back(info->elapsedUs);
+}
+
+// Every export on one U16 frame
+static void BenchFrame(std::vector<BenchResult> &results, MSContext *ctx, const MSParameters &params,
+	const std::string &image, const Mat &u16, double minMs)
+{
+	double px = (double)u16.total();
+	MSClaheParams clahe = { 0, 0, 0 };
+	Mat sgl, work, dst;
+	double divider;
+
+	u16.convertTo(sgl, CV_32FC1);
+	divider = norm(sgl, NORM_INF);
+
+	// compulsory traffic: source read once, result written once
+	Run(results, "pyrdown", image, u16, "U16", px * 2 * 1.25, minMs, []{},
+		[&]{ MSPyrDown(u16, dst); return MS_OK; });
+	Run(results, "pyrup", image, u16, "U16", px * 2 * 5, minMs, []{},
+		[&]{ MSPyrUp(u16, dst); return MS_OK; });
+	Run(results, "clahe", image, u16, "U16", px * 2 * 2, minMs, []{},
+		[&]{ MSClahe(u16, dst, &clahe, ctx->clahe); return MS_OK; });
+	Run(results, "unsharp", image, u16, "U16", px * 2 * 2, minMs, []{},
+		[&]{ MSUnsharpMask(u16, dst, params.unsharp, ctx->scratch); return MS_OK; });
+
+	// ApplyTransform and ApplyPower of MP Helper: one call over all lines on the
+	// calling thread, the same fastPow loop (MP Helper needs LabVIEW, it is not linked here)
+	Run(results, "transform", image, u16, "SGL", px * 4 * 2, minMs, [&]{ sgl.copyTo(work); },
+		[&]{ MSApplyTransform(work, 0, work.rows, divider, params.lutPower[0], params.lutMultiplier[0]); return MS_OK; });
+	Run(results, "power", image, u16, "SGL", px * 4 * 2, minMs, [&]{ sgl.copyTo(work); },
+		[&]{ MSApplyPower(work, 0, work.rows, params.xValuePostProc); return MS_OK; });
+	// ApplyTransformCtx and ApplyPowerCtx, rows on the context threads
+	Run(results, "transform_ctx", image, u16, "SGL", px * 4 * 2, minMs, [&]{ sgl.copyTo(work); },
+		[&]{ MSContextApplyTransform(ctx, work, divider, params.lutPower[0], params.lutMultiplier[0]); return MS_OK; });
+	Run(results, "power_ctx", image, u16, "SGL", px * 4 * 2, minMs, [&]{ sgl.copyTo(work); },
+		[&]{ MSContextApplyPower(ctx, work, params.xValuePostProc); return MS_OK; });
+
+	// raw frame with dark, gain and 0.1% defective pixels into the first pyramid
+	// level, up to 4096x4096 since the maps take three times the frame
+	std::vector<int32_t> defects;
+	MSIngest *ingest = NULL;
+	int status;
+	if (px <= 4096.0 * 4096){
+		for (int i = 0; i < (int)(px / 1000); i++){
+			defects.push_back((int)((i * 7919LL) % u16.cols));
+			defects.push_back((int)((i * 104729LL) % u16.rows));
+		}
+		ingest = MSIngestCreate(u16.cols, u16.rows, Mat(u16.size(), CV_16UC1, Scalar(100)),
+			Mat(u16.size(), CV_32FC1, Scalar(1.02)), defects.data(), (int)defects.size() / 2, &status);
+	}
+	Mat kernel = MSGetConvKernel(params.convolution);
+	if (ingest){
+		Run(results, "ingest", image, u16, "U16", px * (2 + 4 + 4 + 4), minMs, []{},
+			[&]{ MSIngestRun(ctx, ingest, u16, work, kernel, std::max(1, u16.rows / (ctx->pool.size() * 4))); return MS_OK; });
+		MSIngestDestroy(ingest);
+	}
+
+	// the remaining ops run the same pipeline, it fails for all of them or none
+	dst.release();
+	if (!Run(results, "multiscale", image, u16, "U16", px * 2 * 2, minMs, []{},
+		[&]{ return MSProcess(ctx, u16, dst, params); })) return;
+
+	// tile graph against the level schedule on a random frame of the same size,
+	// the graph can be at most work / critical path faster than one thread
+	double levelsUs, graphUs, criticalUs, workUs;
+	if ((MSPlanScheduleBenchmark(ctx, u16.cols, u16.rows, CV_16UC1, params, 10, &levelsUs, &graphUs, &criticalUs, &workUs) == MS_OK) &&
+		(graphUs > 0)){
+		BenchResult r = results.back();
+		r.op = "graph";
+		r.runs = 10;
+		r.ms = r.minMs = graphUs / 1000;
+		r.mpixPerSec = px / graphUs;
+		r.gbPerSec = px * 2 * 2 / (graphUs * 1e3);
+		results.push_back(r);
+		fprintf(stderr, "%-10s %-12s %5dx%-5d %8.3f ms %5.2fx over levels  critical path %.3f ms  work %.3f ms  parallelism %.1f\n",
+			"graph", image.c_str(), r.width, r.height, r.ms, levelsUs / graphUs, criticalUs / 1000, workUs / 1000,
+			criticalUs > 0 ? workUs / criticalUs : 0);
+	}
+
+	// straight into an 8-bit display buffer, window over the input range
+	MSDisplayParams display = { 32768, 65536, 2.2 };
+	Mat display8(u16.size(), CV_8UC1);
+	Run(results, "display", image, u16, "U8", px * (2 + 1), minMs, []{},
+		[&]{ return MSProcessDisplay(ctx, u16, display8, params, display); });
+
+	// slider on the level 1 tone curve of an unchanged frame
+	MSParameters tuned = params;
+	Run(results, "retune", image, u16, "U16", px * 2 * 2, minMs,
+		[&]{ tuned.lutPower[1] = tuned.lutPower[1] == params.lutPower[1] ? params.lutPower[1] * 1.01f : params.lutPower[1]; },
+		[&]{ return MSProcessIncremental(ctx, u16, dst, tuned); });
+
+	// coarse to fine, first_preview is the median time until the 1/4 resolution preview
+	std::vector<double> firstUs;
+	bool progressive = Run(results, "progressive", image, u16, "U16", px * 2 * 2, minMs, []{},
+		[&]{ return MSProcessProgressive(ctx, u16, dst, params, 2, FirstPreview, &firstUs); });
+	std::sort(firstUs.begin(), firstUs.end());
+	if (progressive && !firstUs.empty()){
+		BenchResult r = results.back();
+		r.op = "first_preview";
+		r.ms = firstUs[firstUs.size() / 2] / 1000;
+		r.minMs = firstUs[0] / 1000;
+		r.mpixPerSec = px / (r.ms * 1e3);
+		r.gbPerSec = 0;
+		results.push_back(r);
+		fprintf(stderr, "%-10s %-12s %5dx%-5d %8.3f ms\n", "first", image.c_str(), r.width, r.height, r.ms);
+	}
+
+	// flat and saturated tiles left out, the share skipped depends on the image
+	MSMaskStats maskStats;
+	if (Run(results, "masked", image, u16, "U16", px * 2 * 2, minMs, []{},
+		[&]{ return MSProcessMasked(ctx, u16, dst, params, 0, &maskStats); }))
+		fprintf(stderr, "%-10s %-12s %5dx%-5d %8d of %d tiles, %.1f%% skipped\n", "mask", image.c_str(), u16.cols, u16.rows,
+			maskStats.deadTiles, maskStats.tiles, maskStats.skipped * 100);
+
+	// eight tone curve presets from one decomposition, per sweep
+	std::vector<MSParameters> presets(8, params);
+	std::vector<Mat> presetDst(presets.size());
+	for (size_t i = 0; i < presets.size(); i++)
+		for (int k = 0; k < MS_MAX_LEVELS; k++) presets[i].lutMultiplier[k] *= 0.8f + 0.05f * i;
+	Run(results, "sweep8", image, u16, "U16", px * 2 * (1 + presets.size()), minMs, []{},
+		[&]{ return MSProcessSweep(ctx, u16, presetDst.data(), presets.data(), (int)presets.size(), NULL); });
+
+	// panning a 512x512 viewport over an unchanged frame
+	Rect view(0, 0, std::min(512, u16.cols), std::min(512, u16.rows));
+	Mat viewDst;
+	Run(results, "viewport", image, u16, "U16", (double)view.area() * 2 * 2, minMs,
+		[&]{ view.x = (view.x + 64) % (u16.cols - view.width + 1); },
+		[&]{ return MSProcessROI(ctx, u16, viewDst, params, view); });
+}
+
+static std::vector<std::string> ImageNames(const char *images)
+{
+	std::vector<String> paths;
+	std::vector<std::string> names;
+
+	glob(std::string(images) + "/*.png", paths, false);
+	for (size_t i = 0; i < paths.size(); i++){
+		std::string path = paths[i];
+		size_t slash = path.find_last_of("/\\");
+		names.push_back(path.substr(slash + 1, path.size() - slash - 5));
+	}
+	return names;
+}
+
+static Rect Viewport(const Mat &frame)
+{
+	return Rect(frame.cols / 4, frame.rows / 4, frame.cols / 2, frame.rows / 2);
+}
+
+// Fixed divider of the roi_fixed mode, the U16 range bounds every band
+#define GOLDEN_DIVIDER	65535.0
+
+// 3 x 3 viewports that tile the frame, the outer ones on its edges, the
+// first two columns and rows of odd size
+static std::vector<Rect> TiledViewports(const Mat &frame)
+{
+	int x[4] = { 0, frame.cols / 3 | 1, 2 * (frame.cols / 3 | 1), frame.cols };
+	int y[4] = { 0, frame.rows / 3 | 1, 2 * (frame.rows / 3 | 1), frame.rows };
+	std::vector<Rect> rois;
+
+	for (int j = 0; j < 3; j++)
+		for (int i = 0; i < 3; i++) rois.push_back(Rect(x[i], y[j], x[i + 1] - x[i], y[j + 1] - y[j]));
+	return rois;
+}
+
+// The viewport windows of every level stay O(viewport) on a frame deep
+// enough for 9 levels and more, for a centre, an edge and an odd viewport
+#define VIEWPORT_CHECK_SIZE	4096
+
+static bool ViewportScales(MSContext *ctx, const MSParameters &params)
+{
+	const Rect rois[] = { Rect(1792, 1792, 512, 512), Rect(0, 3584, 512, 512), Rect(1001, 2047, 37, 19) };
+	MSParameters deep = params;
+	std::vector<Rect> windows;
+	bool pass = true;
+	MSPlan *plan;
+	int status;
+
+	deep.levels = MS_MAX_LEVELS; //as many as the frame allows
+	if (!(plan = MSPlanCreate(ctx, VIEWPORT_CHECK_SIZE, VIEWPORT_CHECK_SIZE, CV_16UC1, deep, &status))){
+		fprintf(stderr, "viewport windows: %s\n", MSStatusText(status));
+		return false;
+	}
+	for (size_t r = 0; r < sizeof(rois) / sizeof(rois[0]); r++){
+		const Rect &roi = rois[r];
+		int64_t area = 0, limit = 2 * (int64_t)(roi.width + 8) * (roi.height + 8) + 64 * plan->levels;
+		MSPlanROIWindows(plan, roi, windows);
+		for (size_t k = 0; k < windows.size(); k++) area += windows[k].area();
+		bool ok = (plan->levels >= 9) && (windows[0].area() <= (roi.width + 4) * (roi.height + 4)) && (area <= limit);
+		fprintf(stderr, "viewport windows %dx%d at (%d, %d), %d levels: level 0 %dx%d, %lld pixels in all  %s\n",
+			roi.width, roi.height, roi.x, roi.y, plan->levels, windows[0].width, windows[0].height,
+			(long long)area, ok ? "ok" : "FAILED");
+		pass &= ok;
+	}
+	MSPlanDestroy(plan);
+	return pass;
+}
+
+// Window/level of the display mode, over the input range as in the "display" op
+static const MSDisplayParams GoldenDisplay = { 32768, 65536, 2.2 };
+
+// What the output of mode is compared with: MSProcess with GOLDEN_DIVIDER,
+// the viewport of the reference, the reference through GoldenDisplay
+// computed directly, or the reference. Empty if MSProcess fails
+static Mat GoldenExpected(MSContext *ctx, const GoldenMode &mode, const Mat &src, const Mat &reference,
+	const MSParameters &params)
+{
+	if (mode.fixed){
+		MSParameters fixed = params;
+		Mat expected;
+		fixed.divider = GOLDEN_DIVIDER;
+		if (MSProcess(ctx, src, expected, fixed) != MS_OK) expected.release();
+		return expected;
+	}
+	if (mode.viewport) return reference(Viewport(src));
+	if (!mode.display) return reference;
+
+	Mat expected(reference.size(), CV_8UC1);
+	double low = GoldenDisplay.center - GoldenDisplay.width / 2;
+	for (int y = 0; y < reference.rows; y++){
+		uint8_t *out = expected.ptr<uint8_t>(y);
+		for (int x = 0; x < reference.cols; x++){
+			double t = (reference.depth() == CV_16U ? reference.at<uint16_t>(y, x) : reference.at<float>(y, x)) - low;
+			t = std::min(1.0, std::max(0.0, t / GoldenDisplay.width));
+			out[x] = (uint8_t)(255 * pow(t, 1.0 / GoldenDisplay.gamma) + 0.5);
+		}
+	}
+	return expected;
+}
+
+static int RunMode(MSContext *ctx, const GoldenMode &mode, const Mat &src, Mat &dst, const MSParameters &params)
+{
+	int status, schedule;
+	MSPlan *plan;
+
+	if (mode.fixed){
+		MSParameters fixed = params;
+		std::vector<Rect> rois = TiledViewports(src);
+		fixed.divider = GOLDEN_DIVIDER;
+		dst.create(src.size(), src.type());
+		for (size_t r = 0; r < rois.size(); r++){
+			Mat tile = dst(rois[r]);
+			if ((status = MSProcessROI(ctx, src, tile, fixed, rois[r])) != MS_OK) return status;
+		}
+		return MS_OK;
+	}
+	if (mode.viewport) return MSProcessROI(ctx, src, dst, params, Viewport(src));
+	if (mode.progressive) return MSProcessProgressive(ctx, src, dst, params, 2, NULL, NULL);
+	if (mode.incremental) return MSProcessIncremental(ctx, src, dst, params);
+	if (mode.masked) return MSProcessMasked(ctx, src, dst, params, 0, NULL);
+	if (mode.display){
+		dst.create(src.size(), CV_8UC1); //not the U16 buffer of the other modes
+		return MSProcessDisplay(ctx, src, dst, params, GoldenDisplay);
+	}
+	if (mode.sweep){
+		MSParameters sets[3] = { params, params, params };
+		Mat out[3];
+		for (int k = 0; k < MS_MAX_LEVELS; k++) sets[0].lutPower[k] *= 0.9f;
+		sets[1].unsharp.amount = 0;
+		out[2] = dst;
+		if ((status = MSProcessSweep(ctx, src, out, sets, 3, NULL)) == MS_OK) dst = out[2];
+		return status;
+	}
+	if (!(plan = MSContextPlan(ctx, src, params, &status))) return status;
+	if (mode.shed) return MSPlanExecuteShed(plan, src, dst, mode.shed, NULL);
+
+	schedule = plan->schedule;
+	plan->schedule = plan->graph.size() ? mode.schedule : MS_SCHEDULE_LEVELS; //no graph on one thread
+	status = MSPlanExecute(plan, src, dst);
+	plan->schedule = schedule;
+	return status;
+}
+
+// Golden outputs are checked against their hashes and every mode against the
+// tolerance recorded with them, both from GOLDEN_MANIFEST next to the outputs
+#define GOLDEN_MANIFEST	"golden.txt"
+#define GOLDEN_MARGIN	0.25 //recorded max abs and 1 - SSIM are the measured worst plus this share
+#define GOLDEN_PSNR_MARGIN	1.0 //dB below the measured worst
+#define GOLDEN_PSNR_CAP	90.0 //limits of the exact modes, a tighter recording would only mean identical
+#define GOLDEN_SSIM_CAP	0.9999
+
+typedef struct {
+	std::map<std::string, uint64_t> hashes;                // golden output of every image
+	std::map<std::string, MSQualityTolerance> tolerances;  // per mode, never looser than GoldenModes
+} GoldenManifest;
+
+static bool ReadManifest(const std::string &path, GoldenManifest &manifest)
+{
+	FILE *file = fopen(path.c_str(), "r");
+	char line[512], name[256];
+	unsigned long long hash;
+	MSQualityTolerance t;
+
+	if (!file) return false;
+	while (fgets(line, sizeof(line), file)){
+		if (sscanf(line, "image %255s %llx", name, &hash) == 2) manifest.hashes[name] = hash;
+		else if (sscanf(line, "tolerance %255s %lf %lf %lf", name, &t.maxAbs, &t.minPsnr, &t.minSsim) == 4) manifest.tolerances[name] = t;
+	}
+	fclose(file);
+	return true;
+}
+
+static bool WriteManifest(const std::string &path, const GoldenManifest &manifest)
+{
+	FILE *file = fopen(path.c_str(), "w");
+
+	if (!file) return false;
+	fprintf(file, "# multiscale_bench golden outputs, OpenCV %s\n", CV_VERSION);
+	for (std::map<std::string, uint64_t>::const_iterator i = manifest.hashes.begin(); i != manifest.hashes.end(); ++i)
+		fprintf(file, "image %s %016llx\n", i->first.c_str(), (unsigned long long)i->second);
+	for (std::map<std::string, MSQualityTolerance>::const_iterator i = manifest.tolerances.begin(); i != manifest.tolerances.end(); ++i)
+		fprintf(file, "tolerance %s %.0f %.2f %.6f\n", i->first.c_str(), i->second.maxAbs, i->second.minPsnr, i->second.minSsim);
+	return fclose(file) == 0;
+}
+
+// Worst quality of a mode over all images plus the margin, within the limit of the mode.
+// False if the worst is beyond the limit, the limit of the mode is wrong then
+static bool RecordedTolerance(const MSQuality &worst, const MSQualityTolerance &limit, MSQualityTolerance &t)
+{
+	if (!MSQualityPasses(worst, limit)) return false;
+
+	t.maxAbs = std::min(limit.maxAbs, std::max(1.0, ceil(worst.maxAbs * (1 + GOLDEN_MARGIN))));
+	t.minPsnr = std::max(limit.minPsnr, std::min(worst.psnr, GOLDEN_PSNR_CAP) - GOLDEN_PSNR_MARGIN);
+	t.minSsim = std::max(limit.minSsim, std::min(GOLDEN_SSIM_CAP, 1 - (1 - worst.ssim) * (1 + GOLDEN_MARGIN)));
+	return true;
+}
+
+// Runs every mode on every image, false if a mode is out of tolerance or a golden
+// output is missing or changed. With record the outputs of the reference mode are
+// written instead, with their hashes and the tolerances of the other modes
+static bool Golden(std::vector<GoldenResult> &results, MSContext *ctx, const MSParameters &params,
+	const char *images, const char *golden, bool record, double minMs)
+{
+	const size_t modes = sizeof(GoldenModes) / sizeof(GoldenModes[0]);
+	std::vector<std::string> names = ImageNames(images);
+	std::string manifestPath = std::string(golden) + "/" + GOLDEN_MANIFEST;
+	std::vector<MSQuality> worst(modes);
+	GoldenManifest manifest;
+	bool pass = true;
+
+	for (size_t m = 0; m < modes; m++){
+		worst[m].maxAbs = 0;
+		worst[m].psnr = MS_QUALITY_PSNR_EQUAL;
+		worst[m].ssim = 1;
+	}
+	if (!record && !ReadManifest(manifestPath, manifest)){
+		fprintf(stderr, "%s: cannot read, record it with --record\n", manifestPath.c_str());
+		return false;
+	}
+
+	for (size_t n = 0; n < names.size(); n++){
+		std::string goldenPath = std::string(golden) + "/" + names[n] + ".png";
+		Mat src = imread(std::string(images) + "/" + names[n] + ".png", IMREAD_ANYDEPTH | IMREAD_GRAYSCALE);
+		Mat reference, dst;
+		double referenceMs = 0, fastestMs;
+		int runs, status;
+
+		if (src.empty()) continue;
+		if (src.depth() == CV_8U) src.convertTo(src, CV_16UC1, 257);
+
+		if (record){
+			if (((status = RunMode(ctx, GoldenModes[0], src, reference, params)) != MS_OK) || !imwrite(goldenPath, reference)){
+				fprintf(stderr, "%s: %s\n", goldenPath.c_str(), status == MS_OK ? "cannot write" : MSStatusText(status));
+				pass = false;
+				continue;
+			}
+			manifest.hashes[names[n]] = MSImageHash(reference);
+
+			// the error of every other mode on this image, the tolerance covers the worst image
+			for (size_t m = 1; m < modes; m++){
+				const GoldenMode &mode = GoldenModes[m];
+				MSQuality q;
+				if (((status = RunMode(ctx, mode, src, dst, params)) != MS_OK) ||
+					!MSQualityCompare(dst, GoldenExpected(ctx, mode, src, reference, params), &q)){
+					fprintf(stderr, "%s %s: %s\n", mode.name, names[n].c_str(), status == MS_OK ? "size or type differs" : MSStatusText(status));
+					pass = false;
+					continue;
+				}
+				worst[m].maxAbs = std::max(worst[m].maxAbs, q.maxAbs);
+				worst[m].psnr = std::min(worst[m].psnr, q.psnr);
+				worst[m].ssim = std::min(worst[m].ssim, q.ssim);
+			}
+			continue;
+		}
+
+		reference = imread(goldenPath, IMREAD_ANYDEPTH | IMREAD_GRAYSCALE);
+		if (reference.empty()){
+			fprintf(stderr, "%s: cannot read, record it with --record\n", goldenPath.c_str());
+			pass = false;
+			continue;
+		}
+		if (!manifest.hashes.count(names[n]) || (manifest.hashes[names[n]] != MSImageHash(reference))){
+			fprintf(stderr, "%s: does not match %s, record it again\n", goldenPath.c_str(), GOLDEN_MANIFEST);
+			pass = false;
+			continue;
+		}
+
+		for (size_t m = 0; m < modes; m++){
+			const GoldenMode &mode = GoldenModes[m];
+			MSQualityTolerance tolerance = mode.tolerance;
+			GoldenResult r;
+
+			// the reference is the golden output, every other mode needs its measured tolerance
+			if (m && !manifest.tolerances.count(mode.name)){
+				fprintf(stderr, "%s: no tolerance in %s, record it again\n", mode.name, GOLDEN_MANIFEST);
+				pass = false;
+				continue;
+			}
+			if (m) tolerance = manifest.tolerances[mode.name];
+
+			status = MS_OK;
+			Measure([]{}, [&]{ status = RunMode(ctx, mode, src, dst, params); }, minMs, &runs, &r.ms, &fastestMs);
+			if (status != MS_OK){
+				fprintf(stderr, "%s %s: %s\n", mode.name, names[n].c_str(), MSStatusText(status));
+				pass = false;
+				continue;
+			}
+			if (!m) referenceMs = r.ms;
+
+			r.mode = mode.name;
+			r.image = names[n];
+			r.width = src.cols;
+			r.height = src.rows;
+			r.speedup = referenceMs / r.ms;
+			if (!MSQualityCompare(dst, GoldenExpected(ctx, mode, src, reference, params), &r.quality)){
+				fprintf(stderr, "%s: size or type differs from the output, record it again\n", goldenPath.c_str());
+				pass = false;
+				break;
+			}
+			r.pass = MSQualityPasses(r.quality, tolerance);
+			pass &= r.pass;
+			results.push_back(r);
+
+			fprintf(stderr, "%-14s %-16s %8.3f ms %5.2fx  max %7.0f  PSNR %6.1f dB  SSIM %.5f  %s\n",
+				mode.name, names[n].c_str(), r.ms, r.speedup, r.quality.maxAbs, r.quality.psnr,
+				r.quality.ssim, r.pass ? "ok" : "FAILED");
+		}
+	}
+
+	if (record){
+		for (size_t m = 1; m < modes; m++){
+			MSQualityTolerance t;
+			if (!RecordedTolerance(worst[m], GoldenModes[m].tolerance, t)){
+				t = GoldenModes[m].tolerance;
+				fprintf(stderr, "%-14s worst max %7.0f  PSNR %6.1f dB  SSIM %.5f  beyond the limit %7.0f  %6.1f dB  %.5f of GoldenModes\n",
+					GoldenModes[m].name, worst[m].maxAbs, worst[m].psnr, worst[m].ssim, t.maxAbs, t.minPsnr, t.minSsim);
+				pass = false;
+				continue;
+			}
+			manifest.tolerances[GoldenModes[m].name] = t;
+			fprintf(stderr, "%-14s worst max %7.0f  PSNR %6.1f dB  SSIM %.5f  tolerance %7.0f  %6.1f dB  %.5f\n",
+				GoldenModes[m].name, worst[m].maxAbs, worst[m].psnr, worst[m].ssim, t.maxAbs, t.minPsnr, t.minSsim);
+		}
+		if (pass && !WriteManifest(manifestPath, manifest)){
+			fprintf(stderr, "%s: cannot write\n", manifestPath.c_str());
+			pass = false;
+		}
+	}
+	return pass;
+}
+
+static void PrintRoofline(const RooflineResult &roof)
+{
+	fprintf(stderr, "roofline %dx%d, %.1f GB/s, %.1f GFLOP/s, ridge %.2f flop/byte\n",
+		roof.width, roof.height, roof.bandwidth, roof.peak, roof.peak / roof.bandwidth);
+	fprintf(stderr, "%-12s %10s %10s %7s %10s %10s %8s %8s %6s %s\n",
+		"stage", "MB", "MFLOP", "flop/B", "us", "bound us", "GB/s", "GFLOP/s", "eff", "bound");
+	for (int s = 0; s < MS_STAGE_COUNT; s++){
+		const MSRooflineStage &stage = roof.stages[s];
+		if (stage.bytes <= 0) continue;
+		fprintf(stderr, "%-12s %10.1f %10.1f %7.2f %10.0f %10.0f %8.2f %8.2f %5.0f%% %s\n", RooflineStageNames[s],
+			stage.bytes / 1e6, stage.flops / 1e6, stage.intensity, stage.us, stage.boundUs, stage.gbPerSec,
+			stage.gflopsPerSec, stage.efficiency * 100, stage.memoryBound ? "memory" : "compute");
+	}
+}
+
+static bool WriteJson(FILE *file, const std::vector<BenchResult> &results, const std::vector<GoldenResult> &quality,
+	const RooflineResult *roof, int threads)
+{
+	fprintf(file, "{\n  \"benchmark\": \"multiscale\",\n  \"opencv\": \"%s\",\n  \"threads\": %d,\n  \"results\": [\n",
+		CV_VERSION, threads);
+	for (size_t i = 0; i < results.size(); i++){
+		const BenchResult &r = results[i];
+		fprintf(file, "    {\"op\": \"%s\", \"image\": \"%s\", \"width\": %d, \"height\": %d, \"type\": \"%s\", "
+			"\"runs\": %d, \"ms\": %.4f, \"min_ms\": %.4f, \"mpix_per_s\": %.2f, \"gb_per_s\": %.3f}%s\n",
+			r.op.c_str(), r.image.c_str(), r.width, r.height, r.type, r.runs, r.ms, r.minMs,
+			r.mpixPerSec, r.gbPerSec, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ],\n  \"quality\": [\n");
+	for (size_t i = 0; i < quality.size(); i++){
+		const GoldenResult &r = quality[i];
+		fprintf(file, "    {\"mode\": \"%s\", \"image\": \"%s\", \"width\": %d, \"height\": %d, \"ms\": %.4f, "
+			"\"speedup\": %.3f, \"max_abs\": %.1f, \"psnr\": %.2f, \"ssim\": %.6f, \"pass\": %s}%s\n",
+			r.mode, r.image.c_str(), r.width, r.height, r.ms, r.speedup, r.quality.maxAbs, r.quality.psnr,
+			r.quality.ssim, r.pass ? "true" : "false", i + 1 < quality.size() ? "," : "");
+	}
+	fprintf(file, "  ]");
+	if (roof){
+		fprintf(file, ",\n  \"roofline\": {\"width\": %d, \"height\": %d, \"bandwidth_gb_per_s\": %.2f, "
+			"\"peak_gflop_per_s\": %.2f, \"stages\": [\n", roof->width, roof->height, roof->bandwidth, roof->peak);
+		for (int s = 0; s < MS_STAGE_COUNT; s++){
+			const MSRooflineStage &stage = roof->stages[s];
+			fprintf(file, "    {\"stage\": \"%s\", \"bytes\": %.0f, \"flops\": %.0f, \"intensity\": %.3f, \"us\": %.1f, "
+				"\"bound_us\": %.1f, \"gb_per_s\": %.3f, \"gflop_per_s\": %.3f, \"efficiency\": %.4f, \"bound\": \"%s\"}%s\n",
+				RooflineStageNames[s], stage.bytes, stage.flops, stage.intensity, stage.us, stage.boundUs, stage.gbPerSec,
+				stage.gflopsPerSec, stage.efficiency, stage.memoryBound ? "memory" : "compute",
+				s + 1 < MS_STAGE_COUNT ? "," : "");
+		}
+		fprintf(file, "  ]}");
+	}
+	fprintf(file, "\n}\n");
+	return !ferror(file);
+}
+
+int main(int argc, char **argv)
+{
+	const char *settings = "../Settings.ini", *images = "../Images", *output = NULL, *golden = NULL;
+	std::vector<int> sizes = ParseSizes("512,1024,2048"), synthetic = ParseSizes("4096,8192,16384");
+	int threads = (int)std::thread::hardware_concurrency();
+	double minMs = 300;
+	bool record = false, pass = true;
+	RooflineResult roof;
+	bool roofline = false;
+	std::vector<BenchResult> results;
+	std::vector<GoldenResult> quality;
+	MSParameters params;
+	std::string error;
+	MSContext *ctx;
+
+	memset(&roof, 0, sizeof(roof));
+	for (int i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "-s") && (i + 1 < argc)) settings = argv[++i];
+		else if (!strcmp(argv[i], "-i") && (i + 1 < argc)) images = argv[++i];
+		else if (!strcmp(argv[i], "-t") && (i + 1 < argc)) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-o") && (i + 1 < argc)) output = argv[++i];
+		else if (!strcmp(argv[i], "--sizes") && (i + 1 < argc)) sizes = ParseSizes(argv[++i]);
+		else if (!strcmp(argv[i], "--synthetic") && (i + 1 < argc)) synthetic = ParseSizes(argv[++i]);
+		else if (!strcmp(argv[i], "--min-ms") && (i + 1 < argc)) minMs = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--golden") && (i + 1 < argc)) golden = argv[++i];
+		else if (!strcmp(argv[i], "--record")) record = true;
+		else if (!strcmp(argv[i], "--roofline") && (i + 1 < argc)){
+			if (sscanf(argv[++i], "%dx%d", &roof.width, &roof.height) != 2){ Usage(); return 2; }
+			roofline = true;
+		}
+		else if (!strcmp(argv[i], "--bandwidth") && (i + 1 < argc)) roof.bandwidth = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--peak") && (i + 1 < argc)) roof.peak = atof(argv[++i]);
+		else { Usage(); return 2; }
+	}
+	if (record && !golden){ Usage(); return 2; }
+	if (record){ sizes.clear(); synthetic.clear(); }
+	if (threads <= 0) threads = 1;
+
+	if (!MSLoadSettings(settings, &params, &error)){
+		fprintf(stderr, "%s: %s, using the defaults\n", settings, error.c_str());
+		MSDefaultParameters(&params);
+	}
+
+	MatPoolInstall();
+	setNumThreads(threads);
+	if (!(ctx = MSContextCreate(threads))){
+		fprintf(stderr, "cannot create the context\n");
+		return 1;
+	}
+
+	for (size_t n = 0; n < sizeof(BenchImages) / sizeof(BenchImages[0]); n++){
+		std::string path = std::string(images) + "/" + BenchImages[n] + ".png";
+		Mat source = imread(path, IMREAD_ANYDEPTH | IMREAD_GRAYSCALE), u16;
+
+		if (source.empty()){
+			fprintf(stderr, "%s: cannot read, skipped\n", path.c_str());
+			continue;
+		}
+		if (source.depth() == CV_8U) source.convertTo(source, CV_16UC1, 257);
+		for (size_t s = 0; s < sizes.size(); s++){
+			resize(source, u16, Size(sizes[s], sizes[s]), 0, 0, sizes[s] < source.cols ? INTER_AREA : INTER_LINEAR);
+			BenchFrame(results, ctx, params, BenchImages[n], u16, minMs);
+		}
+	}
+
+	for (size_t s = 0; s < synthetic.size(); s++){
+		Mat u16;
+		try {
+			u16 = SyntheticFrame(synthetic[s]);
+			BenchFrame(results, ctx, params, "synthetic", u16, minMs);
+		}
+		catch (const cv::Exception &){
+			fprintf(stderr, "synthetic %d: out of memory, skipped\n", synthetic[s]);
+		}
+	}
+
+	if (golden) pass = Golden(quality, ctx, params, images, golden, record, minMs) & ViewportScales(ctx, params);
+	if (roofline){
+		int status = MSRoofline(ctx, roof.width, roof.height, CV_16UC1, params, 20, &roof.bandwidth, &roof.peak, roof.stages);
+		if (status == MS_OK) PrintRoofline(roof);
+		else{
+			fprintf(stderr, "roofline: %s\n", MSStatusText(status));
+			roofline = false;
+		}
+	}
+	MSContextDestroy(ctx);
+	if (record) return pass ? 0 : 1;
+
+	FILE *file = output ? fopen(output, "w") : stdout;
+	if (!file || !WriteJson(file, results, quality, roofline ? &roof : NULL, threads)){
+		fprintf(stderr, "%s: cannot write\n", output ? output : "stdout");
+		return 1;
+	}
+	if (output) fclose(file);
+	return pass ? 0 : 1;
+}
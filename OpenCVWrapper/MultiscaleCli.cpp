@@ -0,0 +1,280 @@
+//==============================================================================
+//
+// Title:       MultiscaleCli
+// Purpose:     Headless batch processor for the multiscale pipeline.
+//
+//              multiscale [-s Settings.ini] [-o outdir] [-j jobs] [-t threads]
+//                         [--float] [--profile] [--counters] [--trace trace.json]
+//                         [--dark dark.png] [--gain gain.tiff] [--defects defects.txt] image.png ...
+//              multiscale [-s Settings.ini] [-t threads] [--profile] --ring fps
+//
+//              Reads 16-bit grayscale images, runs the full pipeline with the
+//              parameters from Settings.ini and writes the results as 16-bit
+//              PNG (or 32-bit float TIFF with --float) to outdir. Files are
+//              processed concurrently, each job with its own context. Raw
+//              frames can be dark, gain and defect corrected on the way in.
+//
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "opencv2/core.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "MatPool.h"
+#include "Context.h"
+#include "Pipeline.h"
+#include "Settings.h"
+#include "FrameRing.h"
+#include "Profile.h"
+#include "Ingest.h"
+
+using namespace cv;
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: multiscale [-s Settings.ini] [-o outdir] [-j jobs] [-t threads] [--float] [--profile]\n"
+		"                  [--counters] [--trace trace.json] [--dark dark.png] [--gain gain.tiff]\n"
+		"                  [--defects defects.txt] image.png ...\n"
+		"       multiscale [-s Settings.ini] [-t threads] [--profile] --ring fps\n"
+		"  -s  parameters, default Settings.ini\n"
+		"  -o  output directory, default current\n"
+		"  -j  files processed concurrently, default all cores\n"
+		"  -t  threads per file, default 1\n"
+		"  --float  write 32-bit float TIFF instead of 16-bit PNG\n"
+		"  --ring   latency of 2048x2048 U16 frames at fps through the frame ring\n"
+		"  --profile  per-stage latency histogram summary\n"
+		"  --counters  per-stage hardware counters, IPC and memory traffic (Linux perf)\n"
+		"  --trace  Chrome trace JSON of all stages, tiles and threads\n"
+		"  --dark  dark frame (16-bit or float) subtracted from every image\n"
+		"  --gain  float gain map every image is multiplied with after the dark frame\n"
+		"  --defects  defective pixels, one \"x y\" per line, replaced by their neighbours\n");
+}
+
+static double NowMs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static std::string OutputPath(const std::string &dir, const std::string &input, bool sgl)
+{
+	size_t slash = input.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+
+	if (dot != std::string::npos) name = name.substr(0, dot);
+	return dir + "/" + name + (sgl ? ".tiff" : ".png");
+}
+
+static void PrintProfile()
+{
+	MSProfileStats stats;
+
+	printf("%-14s %8s %10s %10s %10s\n", "stage", "count", "p50 us", "p99 us", "max us");
+	for (int i = 0; i < MS_PROF_COUNT; i++){
+		MSProfileQuery(i, &stats);
+		if (stats.count) printf("%-14s %8lld %10.0f %10.0f %10.0f\n", MSProfileStageName(i),
+			(long long)stats.count, stats.p50Us, stats.p99Us, stats.maxUs);
+	}
+}
+
+static void PrintCounters()
+{
+	MSCounterStats stats;
+
+	printf("%-14s %14s %14s %6s %12s %12s %8s\n", "stage", "cycles", "instructions", "IPC", "LLC misses", "dTLB misses", "B/pixel");
+	for (int i = 0; i < MS_PROF_COUNT; i++){
+		MSCountersQuery(i, &stats);
+		if (stats.counts[MS_CNT_CYCLES] > 0) printf("%-14s %14lld %14lld %6.2f %12lld %12lld %8.2f\n", MSProfileStageName(i),
+			(long long)stats.counts[MS_CNT_CYCLES], (long long)stats.counts[MS_CNT_INSTRUCTIONS], stats.ipc,
+			(long long)stats.counts[MS_CNT_LLC_MISSES], (long long)stats.counts[MS_CNT_DTLB_MISSES], stats.bytesPerPixel);
+	}
+}
+
+// Calibration of the raw frames from the --dark, --gain and --defects files, NULL on failure
+static MSIngest* LoadIngest(const char *darkPath, const char *gainPath, const char *defectsPath)
+{
+	Mat dark, gain;
+	std::vector<int32_t> defects;
+	MSIngest *ingest;
+	int status, x, y;
+
+	if (darkPath && (dark = imread(darkPath, IMREAD_ANYDEPTH | IMREAD_GRAYSCALE)).empty()){
+		fprintf(stderr, "%s: cannot read\n", darkPath);
+		return NULL;
+	}
+	if (gainPath && (gain = imread(gainPath, IMREAD_ANYDEPTH | IMREAD_GRAYSCALE)).empty()){
+		fprintf(stderr, "%s: cannot read\n", gainPath);
+		return NULL;
+	}
+	if (!gain.empty()) gain.convertTo(gain, CV_32FC1);
+	if (defectsPath){
+		FILE *f = fopen(defectsPath, "r");
+		if (!f){
+			fprintf(stderr, "%s: cannot read\n", defectsPath);
+			return NULL;
+		}
+		while (fscanf(f, "%d %d", &x, &y) == 2){
+			defects.push_back(x);
+			defects.push_back(y);
+		}
+		fclose(f);
+	}
+	if (dark.empty() && gain.empty()){
+		fprintf(stderr, "--defects needs --dark or --gain for the frame size\n");
+		return NULL;
+	}
+
+	Size size = dark.empty() ? gain.size() : dark.size();
+	ingest = MSIngestCreate(size.width, size.height, dark, gain, defects.data(), (int)defects.size() / 2, &status);
+	if (!ingest) fprintf(stderr, "calibration: %s\n", MSStatusText(status));
+	return ingest;
+}
+
+static void WriteTrace(const char *path)
+{
+	int events, dropped;
+
+	MSTraceStop();
+	if (!MSTraceWrite(path, &events, &dropped)) fprintf(stderr, "%s: cannot write\n", path);
+	else printf("%s: %d events, %d dropped\n", path, events, dropped);
+}
+
+int main(int argc, char **argv)
+{
+	const char *settings = "Settings.ini", *trace = NULL, *dark = NULL, *gain = NULL, *defects = NULL;
+	std::shared_ptr<MSIngest> ingest;
+	std::string outdir = ".";
+	std::vector<std::string> files;
+	int jobs = (int)std::thread::hardware_concurrency(), threads = 1;
+	bool sgl = false, profile = false, counters = false;
+	double ringFps = 0;
+	MSParameters params;
+	std::string error;
+
+	for (int i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "-s") && (i + 1 < argc)) settings = argv[++i];
+		else if (!strcmp(argv[i], "-o") && (i + 1 < argc)) outdir = argv[++i];
+		else if (!strcmp(argv[i], "-j") && (i + 1 < argc)) jobs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-t") && (i + 1 < argc)) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--float")) sgl = true;
+		else if (!strcmp(argv[i], "--profile")) profile = true;
+		else if (!strcmp(argv[i], "--counters")) counters = true;
+		else if (!strcmp(argv[i], "--trace") && (i + 1 < argc)) trace = argv[++i];
+		else if (!strcmp(argv[i], "--ring") && (i + 1 < argc)) ringFps = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--dark") && (i + 1 < argc)) dark = argv[++i];
+		else if (!strcmp(argv[i], "--gain") && (i + 1 < argc)) gain = argv[++i];
+		else if (!strcmp(argv[i], "--defects") && (i + 1 < argc)) defects = argv[++i];
+		else if (argv[i][0] == '-'){ Usage(); return 2; }
+		else files.push_back(argv[i]);
+	}
+	if (files.empty() && !(ringFps > 0)){ Usage(); return 2; }
+	if (jobs <= 0) jobs = 1;
+	if (jobs > (int)files.size()) jobs = (int)files.size();
+
+	if (!MSLoadSettings(settings, &params, &error)){
+		fprintf(stderr, "%s: %s\n", settings, error.c_str());
+		return 1;
+	}
+
+	if (dark || gain || defects){
+		MSIngest *calibration = LoadIngest(dark, gain, defects);
+		if (!calibration) return 1;
+		ingest.reset(calibration, MSIngestDestroy);
+	}
+
+	MatPoolInstall();
+	setNumThreads(threads); //OpenCV internal parallelism per file
+	if (trace) MSTraceStart(1 << 20);
+	if (counters && !MSCountersStart()){
+		fprintf(stderr, "hardware counters not available, see /proc/sys/kernel/perf_event_paranoid\n");
+		counters = false;
+	}
+
+	if (ringFps > 0){
+		MSContext *ctx = MSContextCreate(threads);
+		MSRingStats stats;
+		ctx->ingest = ingest;
+		int status = MSFrameRingBenchmark(ctx, 2048, 2048, CV_16UC1, params, ringFps, (int)(ringFps * 10), 4, &stats);
+		MSContextDestroy(ctx);
+		if (status != MS_OK){
+			fprintf(stderr, "ring: %s\n", MSStatusText(status));
+			return 1;
+		}
+		printf("%d frames, %d dropped, %.1f fps\tlatency mean %.0f us\tp50 %.0f us\tp99 %.0f us\tmax %.0f us\tjitter %.0f us\n",
+			stats.frames, stats.dropped, stats.fps, stats.meanUs, stats.p50Us, stats.p99Us, stats.maxUs, stats.jitterUs);
+		if (profile) PrintProfile();
+		if (counters) PrintCounters();
+		if (trace) WriteTrace(trace);
+		return stats.dropped ? 1 : 0;
+	}
+
+	std::atomic<int> next(0), failed(0);
+	std::mutex printLock;
+	std::vector<std::thread> workers;
+	double start = NowMs();
+
+	for (int j = 0; j < jobs; j++){
+		workers.emplace_back([&]{
+			MSContext *ctx = MSContextCreate(threads);
+			Mat dst;
+
+			ctx->ingest = ingest;
+			int i;
+
+			while ((i = next++) < (int)files.size()){
+				double t0 = NowMs(), t1, t2;
+				Mat src = imread(files[i], IMREAD_ANYDEPTH | IMREAD_GRAYSCALE);
+				int status = MS_ERR_INVALID_TYPE;
+
+				t1 = NowMs();
+				if (!src.empty()){
+					dst.release();
+					if (sgl) dst.create(src.size(), CV_32FC1);
+					status = MSProcess(ctx, src, dst, params);
+				}
+				t2 = NowMs();
+				bool written = false;
+				std::string writeError = "cannot write";
+				if (status == MS_OK){
+					std::string path = OutputPath(outdir, files[i], sgl);
+					try {
+						written = imwrite(path, dst);
+					}
+					catch (const cv::Exception &e){
+						writeError = e.what();
+					}
+					if (!written) writeError = path + ": " + writeError;
+				}
+
+				std::lock_guard<std::mutex> guard(printLock);
+				if (written){
+					printf("%s\t%dx%d\tread %.1f ms\tprocess %.1f ms\twrite %.1f ms\n", files[i].c_str(),
+						src.cols, src.rows, t1 - t0, t2 - t1, NowMs() - t2);
+				}
+				else{
+					fprintf(stderr, "%s: %s\n", files[i].c_str(), src.empty() ? "cannot read" :
+						status != MS_OK ? MSStatusText(status) : writeError.c_str());
+					failed++;
+				}
+			}
+			MSContextDestroy(ctx);
+		});
+	}
+	for (size_t j = 0; j < workers.size(); j++) workers[j].join();
+
+	printf("%d files, %d failed, %.1f ms total, %d jobs x %d threads\n",
+		(int)files.size(), failed.load(), NowMs() - start, jobs, threads);
+	if (profile) PrintProfile();
+	if (counters) PrintCounters();
+	if (trace) WriteTrace(trace);
+	return failed ? 1 : 0;
+}
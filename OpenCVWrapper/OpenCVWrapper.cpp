@@ -1,13 +1,24 @@
 #include <Windows.h>
 #include "nivision.h"
 #include "OpenCVWrapper.h"
+#include "MatPool.h"
+#include "Multiscale.h"
+#include "Context.h"
+#include "Pipeline.h"
+#include "Plan.h"
+#include "Batch.h"
+#include "Async.h"
+#include "FrameRing.h"
+#include "Deadline.h"
+#include "Ingest.h"
 
 #include "opencv2\opencv.hpp"
 
 using namespace cv;
 using namespace std;
 
-extern "C" __declspec(dllexport) void opencv2PyrDown(
+//Context - NULL runs on the calling thread, else on the context threads
+static void ADV_PyrDown(MSContext *Context,
 		NIImageHandle SrcImage, NIImageHandle DstImage,
 		LVErrorCluster *ErrorCluster)
 {
@@ -17,12 +28,12 @@ extern "C" __declspec(dllexport) void opencv2PyrDown(
 	int opencv2type = 0; int bpp = 0;
 
 	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
 	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
 	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
 
-	LV_SetThreadCore(1); //must be called prior to LV_LVDTToGRImage
-	LV_LVDTToGRImage(SrcImage, &ImgSrc);
-	LV_LVDTToGRImage(DstImage, &ImgDst);
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
 
 	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
 	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
@@ -57,10 +68,19 @@ extern "C" __declspec(dllexport) void opencv2PyrDown(
 	Mat dst(LVHeight/2, LVWidth/2, opencv2type, LVImagePtrDst, LVLineWidthDst * bpp);
 
 	// apply the algorithm
-	pyrDown(src, dst, Size(LVWidth/2, LVHeight/2));
-} //opencv2PyrDown
+	MS_PROFILE(MS_PROF_DECOMPOSE);
+	if (Context) MSContextPyrDown(Context, src, dst);
+	else pyrDown(src, dst, Size(LVWidth/2, LVHeight/2));
+} //ADV_PyrDown
 
-extern "C" __declspec(dllexport) void opencv2PyrUp(
+extern "C" __declspec(dllexport) void opencv2PyrDown(
+		NIImageHandle SrcImage, NIImageHandle DstImage,
+		LVErrorCluster *ErrorCluster)
+{
+	ADV_PyrDown(NULL, SrcImage, DstImage, ErrorCluster);
+}
+
+static void ADV_PyrUp(MSContext *Context,
 		const NIImageHandle SrcImage, NIImageHandle DstImage, //Dst is double size as Src
 		LVErrorCluster *ErrorCluster)
 {
@@ -70,12 +90,12 @@ extern "C" __declspec(dllexport) void opencv2PyrUp(
 	int opencv2type = 0; int bpp = 0;
 
 	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
 	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
 	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
 
-	LV_SetThreadCore(1);
-	LV_LVDTToGRImage(SrcImage, &ImgSrc); 
-	LV_LVDTToGRImage(DstImage, &ImgDst);
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
 
 	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
 	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
@@ -110,19 +130,82 @@ extern "C" __declspec(dllexport) void opencv2PyrUp(
 	Mat dst(LVHeight * 2, LVWidth * 2, opencv2type, LVImagePtrDst, LVLineWidthDst * bpp);
 
 	// apply the algorithm
-	pyrUp(src, dst, Size(LVWidth*2, LVHeight*2));
-} //opencv2PyrUp
+	MS_PROFILE(MS_PROF_RECONSTRUCT);
+	if (Context) MSContextPyrUp(Context, src, dst);
+	else pyrUp(src, dst, Size(LVWidth*2, LVHeight*2));
+} //ADV_PyrUp
 
-extern "C" __declspec(dllexport) void opencv2CLAHE(
-		const void *SrcImage, void *DstImage,
-		double *ClipLimit, int *TileWidth, int *TileHeight,
+extern "C" __declspec(dllexport) void opencv2PyrUp(
+		const NIImageHandle SrcImage, NIImageHandle DstImage, //Dst is double size as Src
+		LVErrorCluster *ErrorCluster)
+{
+	ADV_PyrUp(NULL, SrcImage, DstImage, ErrorCluster);
+}
+
+//Maps MSStatus of the native core to LabVIEW / IMAQ error codes
+static int ADV_StatusToError(int status)
+{
+	switch (status){
+		case MS_OK: return 0;
+		case MS_ERR_INVALID_TYPE: return ERR_INVALID_IMAGE_TYPE;
+		case MS_ERR_TOO_SMALL: return ERR_IMAGE_TOO_SMALL;
+		case MS_ERR_OPENCV: return ERR_MS_OPENCV;
+		case MS_ERR_OUT_OF_MEMORY: return ERR_OUT_OF_MEMORY;
+		case MS_ERR_TIMEOUT: return ERR_MS_TIMEOUT;
+		default: return ERR_MS_INVALID_PARAMETER;
+	}
+}
+
+static int ADV_ImageTypeToMat(int imageType)
+{
+	switch (imageType){
+		case IMAQ_IMAGE_U16: return CV_16UC1;
+		case IMAQ_IMAGE_SGL: return CV_32FC1;
+		default: return -1;
+	}
+}
+
+//Wraps the LV image memory into a Mat header, no copy
+static int ADV_ImageToMat(Image *img, Mat &mat)
+{
+	int opencv2type;
+
+	switch (((ImageInfo *)img)->imageType){
+		case IMAQ_IMAGE_U16:
+			opencv2type = CV_16UC1;
+			break;
+		case IMAQ_IMAGE_SGL:
+			opencv2type = CV_32FC1;
+			break;
+		default:
+			return ERR_INVALID_IMAGE_TYPE;
+	}
+	if (!((ImageInfo *)img)->imageStart) return ERR_NOT_IMAGE;
+
+	mat = Mat(((ImageInfo *)img)->yRes, ((ImageInfo *)img)->xRes, opencv2type,
+		((ImageInfo *)img)->imageStart, ((ImageInfo *)img)->pixelsPerLine * CV_ELEM_SIZE(opencv2type));
+	return 0;
+}
+
+//Display images are U8 or U16, wrapped the same way
+static int ADV_DisplayToMat(Image *img, Mat &mat)
+{
+	if (((ImageInfo *)img)->imageType != IMAQ_IMAGE_U8) return ADV_ImageToMat(img, mat);
+	if (!((ImageInfo *)img)->imageStart) return ERR_NOT_IMAGE;
+
+	mat = Mat(((ImageInfo *)img)->yRes, ((ImageInfo *)img)->xRes, CV_8UC1,
+		((ImageInfo *)img)->imageStart, ((ImageInfo *)img)->pixelsPerLine);
+	return 0;
+}
+
+static void ADV_CLAHE(const void *SrcImage, void *DstImage,
+		MSClaheParams *Params, Ptr<CLAHE> &clahe,
 		LVErrorCluster *ErrorCluster)
 {
 	Image *ImgSrc, *ImgDst;
-	unsigned short int *LVImagePtrSrcU16, *LVImagePtrDstU16;
-	int LVWidth, LVHeight,	LVLineWidthSrc, LVLineWidthDst;
+	Mat src, dst;
+	int err;
 
-	CHECK_ERROR_IN(ErrorCluster);
 	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
 	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
 
@@ -131,216 +214,1064 @@ extern "C" __declspec(dllexport) void opencv2CLAHE(
 	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
 	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
 
-	switch (((ImageInfo *)ImgSrc)->imageType){
-		case IMAQ_IMAGE_U16:
-			LVImagePtrSrcU16  = (unsigned short int *)((ImageInfo *)ImgSrc)->imageStart;
-			LV_IS_NOT_IMAGE(LVImagePtrSrcU16, ErrorCluster);
-			break;
-		default:
-			ADV_SetLVError(ERR_INVALID_IMAGE_TYPE, __func__, ErrorCluster);
-			return;
-			break;
+	if ((((ImageInfo *)ImgSrc)->imageType != IMAQ_IMAGE_U16) || (((ImageInfo *)ImgDst)->imageType != IMAQ_IMAGE_U16)){
+		ADV_SetLVError(ERR_INVALID_IMAGE_TYPE, __func__, ErrorCluster);
+		return;
 	}
 
-	LVWidth = ((ImageInfo *)ImgSrc)->xRes;
-	LVHeight = ((ImageInfo *)ImgSrc)->yRes;
-	LVLineWidthSrc = ((ImageInfo *)ImgSrc)->pixelsPerLine;
- 
-	imaqSetImageSize (ImgDst, LVWidth, LVHeight);
-	LVLineWidthDst = ((ImageInfo *)ImgDst)->pixelsPerLine;
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
 
-	switch (((ImageInfo *)ImgDst)->imageType){
-		case IMAQ_IMAGE_U16:
-			LVImagePtrDstU16  = (unsigned short int *)((ImageInfo *)ImgDst)->imageStart;
-			LV_IS_NOT_IMAGE(LVImagePtrDstU16, ErrorCluster);
-			break;
-		default:
-			ADV_SetLVError(ERR_INVALID_IMAGE_TYPE, __func__, ErrorCluster);
-			return;
-			break;
-	}
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	// apply the CLAHE algorithm
+	MSClahe(src, dst, Params, clahe);
+}
+
+static void ADV_UnsharpMask(const void *SrcImage, void *DstImage,
+		const MSUnsharpParams &Params, Mat scratch[3],
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
 
-	Mat src(LVWidth, LVHeight, CV_16UC1);	
-	Mat dst(LVWidth, LVHeight, CV_16UC1);
-	Size tileGridSize;
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
 
-	// Copy, line by line, the LV image image into the OpenCV image.
-	for (int y = 0; y < LVHeight; ++y) {
-    	memcpy ((unsigned short *)src.data + y * LVWidth, 
-			LVImagePtrSrcU16 + y * LVLineWidthSrc, 
-			LVWidth * sizeof(unsigned short int)); //16 bit
-	}
+	ImgSrc = ADV_LVDTToAddress(SrcImage);
+	ImgDst = ADV_LVDTToAddress(DstImage);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
 
-    // apply the CLAHE algorithm
-    Ptr<CLAHE> clahe = createCLAHE();
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
 
-	*ClipLimit = *ClipLimit==0?40:*ClipLimit;
-	*TileWidth = *TileWidth==0?8:*TileWidth;
-	*TileHeight = *TileHeight==0?8:*TileHeight;
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
 
-    clahe->setClipLimit(*ClipLimit); //40
-	tileGridSize.width = *TileWidth; //8
-	tileGridSize.height = *TileHeight; //8
-	clahe->setTilesGridSize(tileGridSize);
+	MSUnsharpMask(src, dst, Params, scratch);
+}
+
+extern "C" __declspec(dllexport) void opencv2CLAHE(
+		const void *SrcImage, void *DstImage,
+		double *ClipLimit, int *TileWidth, int *TileHeight,
+		LVErrorCluster *ErrorCluster)
+{
+	MSClaheParams params;
+	Ptr<CLAHE> clahe;
 
-	*ClipLimit = clahe->getClipLimit();
-	tileGridSize = clahe->getTilesGridSize();
-	*TileWidth = tileGridSize.width;
-	*TileHeight = tileGridSize.height;
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
 
-    clahe->apply(src, dst);
+	params.clipLimit = *ClipLimit;
+	params.tileWidth = *TileWidth;
+	params.tileHeight = *TileHeight;
 
-	// Copy, line by line, the OpenCV image into the LV image.
-	for (int y = 0; y < LVHeight; ++y) {
-    	memcpy (LVImagePtrDstU16 + y * LVLineWidthDst, 
-			(unsigned short *)dst.data + y * LVWidth, 
-			LVWidth * sizeof(unsigned short int));
-	}
+	ADV_CLAHE(SrcImage, DstImage, &params, clahe, ErrorCluster);
 
+	*ClipLimit = params.clipLimit;
+	*TileWidth = params.tileWidth;
+	*TileHeight = params.tileHeight;
 }
 
-//based on https://stackoverflow.com/questions/68703443/unsharp-mask-implementation-with-opencv
 extern "C" __declspec(dllexport) void opencv2UnsharpMask(
 		const void *SrcImage, void *DstImage,
 		float Radius, float Amount, float Threshold,
 		LVErrorCluster *ErrorCluster)
+{
+	MSUnsharpParams params;
+	Mat scratch[3];
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+
+	params.amount = Amount;
+	params.radius = Radius;
+	params.threshold = Threshold;
+
+	ADV_UnsharpMask(SrcImage, DstImage, params, scratch, ErrorCluster);
+}
+
+//==============================================================================
+// Context API. Every export takes the context created by opencv2ContextCreate,
+// several contexts can be used from parallel loops without sharing state.
+
+extern "C" __declspec(dllexport) void opencv2ContextCreate(
+		int NumThreads, //0 - half of the cores
+		MSContext **Context,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+
+	*Context = MSContextCreate(NumThreads);
+	if (!*Context) ADV_SetLVError(ERR_OUT_OF_MEMORY, __func__, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void opencv2ContextDestroy(MSContext *Context)
+{
+	MSContextDestroy(Context);
+}
+
+extern "C" __declspec(dllexport) void opencv2ContextSetParams(
+		MSContext *Context, const MSContextParams *Params,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+
+	Context->params = *Params;
+}
+
+extern "C" __declspec(dllexport) void opencv2ContextGetStats(
+		MSContext *Context, int Export, MSExportStats *Stats,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Stats, ErrorCluster);
+	if ((Export < 0) || (Export >= MS_EXPORT_COUNT)) RETURN_ERROR(ERR_MS_INVALID_PARAMETER, ErrorCluster);
+
+	*Stats = Context->stats[Export];
+}
+
+//Calibration of raw U16 frames of Width x Height for every later process call of the context.
+//DarkImage (U16 or SGL) and GainImage (SGL) may be NULL, Defects holds DefectCount (x, y) pairs
+extern "C" __declspec(dllexport) void MultiscaleIngestSet(
+		MSContext *Context, int Width, int Height, NIImageHandle DarkImage, NIImageHandle GainImage,
+		const int32_t *Defects, int DefectCount,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgDark, *ImgGain;
+	MSIngest *ingest;
+	Mat dark, gain;
+	int err, status;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+
+	if (DarkImage){
+		ImgDark = ADV_LVDTToGRImageCached(DarkImage);
+		LV_IS_NOT_IMAGE(ImgDark, ErrorCluster);
+		if ((err = ADV_ImageToMat(ImgDark, dark))) RETURN_ERROR(err, ErrorCluster);
+	}
+	if (GainImage){
+		ImgGain = ADV_LVDTToGRImageCached(GainImage);
+		LV_IS_NOT_IMAGE(ImgGain, ErrorCluster);
+		if ((err = ADV_ImageToMat(ImgGain, gain))) RETURN_ERROR(err, ErrorCluster);
+	}
+
+	//the calibration is copied, the images may be disposed afterwards
+	ingest = MSIngestCreate(Width, Height, dark, gain, Defects, DefectCount, &status);
+	if (!ingest) RETURN_ERROR(ADV_StatusToError(status), ErrorCluster);
+	MSContextSetIngest(Context, ingest);
+}
+
+extern "C" __declspec(dllexport) void MultiscaleIngestClear(MSContext *Context)
+{
+	if (Context) MSContextSetIngest(Context, NULL);
+}
+
+extern "C" __declspec(dllexport) void opencv2PyrDownCtx(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_PYRDOWN);
+
+	ADV_PyrDown(Context, SrcImage, DstImage, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void opencv2PyrUpCtx(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_PYRUP);
+
+	ADV_PyrUp(Context, SrcImage, DstImage, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void opencv2CLAHECtx(
+		MSContext *Context, const void *SrcImage, void *DstImage,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_CLAHE);
+
+	ADV_CLAHE(SrcImage, DstImage, &Context->params.clahe, Context->clahe, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void opencv2UnsharpMaskCtx(
+		MSContext *Context, const void *SrcImage, void *DstImage,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_UNSHARP);
+
+	ADV_UnsharpMask(SrcImage, DstImage, Context->params.unsharp, Context->scratch, ErrorCluster);
+}
+
+//Same as ApplyTransform from MP Helper, whole image on the context threads
+extern "C" __declspec(dllexport) void ApplyTransformCtx(
+		MSContext *Context, NIImageHandle SrcImage,
+		double Divider, double Power, double Multiplier,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc;
+	Mat img;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_TRANSFORM);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	if (((ImageInfo *)ImgSrc)->imageType != IMAQ_IMAGE_SGL) RETURN_ERROR(ERR_INVALID_IMAGE_TYPE, ErrorCluster);
+	if (int err = ADV_ImageToMat(ImgSrc, img)) RETURN_ERROR(err, ErrorCluster);
+
+	MSContextApplyTransform(Context, img, Divider, Power, Multiplier);
+}
+
+extern "C" __declspec(dllexport) void ApplyPowerCtx(
+		MSContext *Context, NIImageHandle SrcImage, double Power,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc;
+	Mat img;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_POWER);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	if (((ImageInfo *)ImgSrc)->imageType != IMAQ_IMAGE_SGL) RETURN_ERROR(ERR_INVALID_IMAGE_TYPE, ErrorCluster);
+	if (int err = ADV_ImageToMat(ImgSrc, img)) RETURN_ERROR(err, ErrorCluster);
+
+	MSContextApplyPower(Context, img, Power);
+}
+
+//Whole MultiScale SubVI.vi chain in one call, Src U16 or SGL, Dst U16 or SGL
+extern "C" __declspec(dllexport) void MultiscaleProcess(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params,
+		LVErrorCluster *ErrorCluster)
 {
 	Image *ImgSrc, *ImgDst;
-	unsigned short int *LVImagePtrSrcU16, *LVImagePtrDstU16;
-	float *LVImagePtrSrcSGL, *LVImagePtrDstSGL;
-	int LVWidth, LVHeight,	LVLineWidthSrc, LVLineWidthDst;
-	int opencv2type = 0;
+	Mat src, dst;
+	int err;
 
 	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
 	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
 	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
 
-	ImgSrc = ADV_LVDTToAddress(SrcImage);
-	ImgDst = ADV_LVDTToAddress(DstImage);
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
 	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSProcess(Context, src, dst, *Params));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//MultiscaleProcess for slider tuning, the decomposition of an unchanged SrcImage is reused
+extern "C" __declspec(dllexport) void MultiscaleProcessIncremental(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
 	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
-	LV_IS_NOT_IMAGE(((ImageInfo *)ImgSrc)->imageStart, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
 
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
 
-	switch (((ImageInfo *)ImgSrc)->imageType){
-		case IMAQ_IMAGE_U16:
-			LVImagePtrSrcU16  = (unsigned short int *)((ImageInfo *)ImgSrc)->imageStart;
-			opencv2type = CV_16UC1;
-			break;
-		case IMAQ_IMAGE_SGL:
-			LVImagePtrSrcSGL  = (float *)((ImageInfo *)ImgSrc)->imageStart;
-			opencv2type = CV_32FC1;
-			break;
-		default:
-			ADV_SetLVError(ERR_INVALID_IMAGE_TYPE, __func__, ErrorCluster);
-			return;
-			break;
-	}
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
 
-	LVWidth = ((ImageInfo *)ImgSrc)->xRes;
-	LVHeight = ((ImageInfo *)ImgSrc)->yRes;
-	LVLineWidthSrc = ((ImageInfo *)ImgSrc)->pixelsPerLine;
- 
-    imaqSetImageSize (ImgDst, LVWidth, LVHeight);
-	LVLineWidthDst = ((ImageInfo *)ImgDst)->pixelsPerLine;
-	LV_IS_NOT_IMAGE(((ImageInfo *)ImgDst)->imageStart, ErrorCluster);
+	err = ADV_StatusToError(MSProcessIncremental(Context, src, dst, *Params));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
 
-	switch (((ImageInfo *)ImgDst)->imageType){
-		case IMAQ_IMAGE_U16:
-			LVImagePtrDstU16  = (unsigned short int *)((ImageInfo *)ImgDst)->imageStart;
-			break;
-		case IMAQ_IMAGE_SGL:
-			LVImagePtrDstSGL  = (float *)((ImageInfo *)ImgDst)->imageStart;
-			break;
-		default:
-			ADV_SetLVError(ERR_INVALID_IMAGE_TYPE, __func__, ErrorCluster);
-			return;
-			break;
-	}
+//DstImage U8 or U16, gets the window of the result after post power and gamma
+extern "C" __declspec(dllexport) void MultiscaleProcessDisplay(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params, const MSDisplayParams *Display,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
 
-	Mat src(LVWidth, LVHeight, opencv2type);	
-	Mat dst(LVWidth, LVHeight, opencv2type);
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NULL(Display, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
 
-	// Copy, line by line, the LV image image into the OpenCV image.
-	switch  (((ImageInfo *)ImgSrc)->imageType){
-		case IMAQ_IMAGE_U16:
-			for (int y = 0; y < LVHeight; ++y) {
-		    	memcpy ((unsigned short *)src.data + y * LVWidth, 
-					LVImagePtrSrcU16 + y * LVLineWidthSrc, 
-					LVWidth * sizeof(unsigned short int)); //16 bit
-			}		
-		break;
-		case IMAQ_IMAGE_SGL:
-			for (int y = 0; y < LVHeight; ++y) {
-		    	memcpy ((float *)src.data + y * LVWidth, 
-					LVImagePtrSrcSGL + y * LVLineWidthSrc, 
-					LVWidth * sizeof(float));
-			}		
-		break;
-		default:
-			ADV_SetLVError(ERR_INVALID_IMAGE_TYPE, __func__, ErrorCluster);
-			return;
-			break;
-	}
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
 
-    // work using floating point images to avoid overflows
-    Mat input;
-    src.convertTo(input, CV_32FC1);
-
-    // copy original for our return value
-    Mat retbuf = input.clone();
-
-    // create the blurred copy
-    Mat blurred;
-    GaussianBlur(input, blurred, Size(3, 3), Radius);
-
-    // subtract blurred from original, pixel-by-pixel to make unsharp mask
-    Mat unsharpMask;
-    subtract(input, blurred, unsharpMask);
-
-    // --- filter on the mask ---
-    
-    //cv::medianBlur(unsharpMask, unsharpMask, 3);
-    blur(unsharpMask, unsharpMask, {3,3});
-
-    
-    // --- end filter ---
-
-    // apply mask to image
-    for (int row = 0; row < src.rows; row++) {
-        for (int col = 0; col < src.cols; col++) {
-            float origGray = input.at<float>(row, col);
-            float difference = unsharpMask.at<float>(row, col);
-            if(norm(difference) >= Threshold) {
-                retbuf.at<float>(row, col) = origGray + Amount * difference;
-            }
-        }
-    }
-
-    // convert back to original type
-    retbuf.convertTo(dst, opencv2type);
-
-	// Copy, line by line, the OpenCV image into the LV image.
-	switch  (((ImageInfo *)ImgDst)->imageType){
-		case IMAQ_IMAGE_U16:
-			for (int y = 0; y < LVHeight; ++y) {
-		    	memcpy (LVImagePtrDstU16 + y * LVLineWidthDst, 
-					(unsigned short *)dst.data + y * LVWidth, 
-					LVWidth * sizeof(unsigned short int));
-			}		
-		break;
-		case IMAQ_IMAGE_SGL:
-			for (int y = 0; y < LVHeight; ++y) {
-		    	memcpy (LVImagePtrDstSGL + y * LVLineWidthDst, 
-					(float *)dst.data + y * LVWidth, 
-					LVWidth * sizeof(float));
-			}		
-		break;
-		default:
-			ADV_SetLVError(ERR_INVALID_IMAGE_TYPE, __func__, ErrorCluster);
-			return;
-			break;
-	}	
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_DisplayToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSProcessDisplay(Context, src, dst, *Params, *Display));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Flatness 0 - default, Stats reports the skipped share of the frame
+extern "C" __declspec(dllexport) void MultiscaleProcessMasked(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params, double Flatness, MSMaskStats *Stats,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSProcessMasked(Context, src, dst, *Params, Flatness, Stats));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Params and DstImages hold Count entries, all results come from one decomposition of SrcImage
+extern "C" __declspec(dllexport) void MultiscaleProcessSweep(
+		MSContext *Context, NIImageHandle SrcImage, const NIImageHandle *DstImages, int Count,
+		const MSParameters *Params, MSSweepStats *Stats,
+		LVErrorCluster *ErrorCluster)
+{
+	std::vector<Mat> dst;
+	Image *ImgSrc, *ImgDst;
+	Mat src;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NULL(DstImages, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	if (Count <= 0) RETURN_ERROR(ERR_MS_INVALID_PARAMETER, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+	if ((err = ADV_ImageToMat(ImgSrc, src))) RETURN_ERROR(err, ErrorCluster);
+
+	dst.resize(Count);
+	for (int i = 0; i < Count; i++){
+		LV_IS_NOT_IMAGE(DstImages[i], ErrorCluster);
+		ImgDst = ADV_LVDTToGRImageCached(DstImages[i]);
+		LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+
+		imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+		if ((err = ADV_ImageToMat(ImgDst, dst[i]))) RETURN_ERROR(err, ErrorCluster);
+	}
+
+	err = ADV_StatusToError(MSProcessSweep(Context, src, dst.data(), Params, Count, Stats));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Viewport of the MultiscaleProcess result, DstImage is resized to Width x Height
+extern "C" __declspec(dllexport) void MultiscaleProcessROI(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params, int Left, int Top, int Width, int Height,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+	if ((Width <= 0) || (Height <= 0)) RETURN_ERROR(ERR_MS_INVALID_PARAMETER, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, Width, Height);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSProcessROI(Context, src, dst, *Params, cv::Rect(Left, Top, Width, Height)));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//2D SGL array of LabVIEW
+typedef struct {
+	int32_t dimSizes[2];
+	float elt[1];
+} ADV_SGLArray, *ADV_SGLArrayPtr, **ADV_SGLArrayHdl;
+
+//Data of the MultiscaleProcessProgressive user event, the preview is a copy
+//since DstImage is overwritten by the next refinement before the handler runs
+typedef struct {
+	MSPreviewInfo Info;
+	ADV_SGLArrayHdl Preview; //rows x columns of DstImage
+} ADV_PreviewEvent;
+
+typedef struct {
+	LVUserEventRef Event;
+	ADV_PreviewEvent Data; //the handle is reused for every refinement
+} ADV_PreviewPost;
+
+//Fires the LabVIEW user event of MultiscaleProcessProgressive, PostLVUserEvent
+//copies the data, handle included. An array that can't be grown goes out empty
+static void ADV_PreviewPostEvent(const MSPreviewInfo *Info, const Mat &Preview, void *User)
+{
+	ADV_PreviewPost *Post = (ADV_PreviewPost *)User;
+	ADV_SGLArrayHdl *Handle = &Post->Data.Preview;
+
+	Post->Data.Info = *Info;
+	if (NumericArrayResize(fS, 2, (UHandle *)Handle, Preview.total()) == noErr){
+		Mat copy(Preview.rows, Preview.cols, CV_32FC1, (**Handle)->elt);
+		(**Handle)->dimSizes[0] = Preview.rows;
+		(**Handle)->dimSizes[1] = Preview.cols;
+		Preview.convertTo(copy, CV_32FC1);
+	}
+	else if (*Handle) (**Handle)->dimSizes[0] = (**Handle)->dimSizes[1] = 0;
+	PostLVUserEvent(Post->Event, (void *)&Post->Data);
+}
+
+//MultiscaleProcess that fills DstImage with upsampled previews of the levels from
+//PreviewLevel to 1 before the result, Event (may be NULL) fires for each and at the end
+//with an ADV_PreviewEvent: the MSPreviewInfo and a 2D SGL copy of that preview
+extern "C" __declspec(dllexport) void MultiscaleProcessProgressive(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params, int PreviewLevel, LVUserEventRef *Event,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	ADV_PreviewPost Post = {};
+	Mat src, dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	if (Event) Post.Event = *Event;
+	err = ADV_StatusToError(MSProcessProgressive(Context, src, dst, *Params, PreviewLevel,
+		Event ? ADV_PreviewPostEvent : NULL, Event ? (void *)&Post : NULL));
+	if (Post.Data.Preview) DSDisposeHandle(Post.Data.Preview);
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Count frames in one call, Mode is an MSBatchMode, Stats may be NULL
+extern "C" __declspec(dllexport) void MultiscaleProcessBatch(
+		MSContext *Context, const NIImageHandle *SrcImages, const NIImageHandle *DstImages, int Count,
+		const MSParameters *Params, int Mode, MSBatchStats *Stats,
+		LVErrorCluster *ErrorCluster)
+{
+	std::vector<Mat> src, dst;
+	Image *ImgSrc, *ImgDst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NULL(SrcImages, ErrorCluster);
+	LV_IS_NULL(DstImages, ErrorCluster);
+	if (Count <= 0) RETURN_ERROR(ERR_MS_INVALID_PARAMETER, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_BATCH);
+
+	//images are resolved here, the workers only see Mats
+	src.resize(Count);
+	dst.resize(Count);
+	for (int i = 0; i < Count; i++){
+		LV_IS_NOT_IMAGE(SrcImages[i], ErrorCluster);
+		LV_IS_NOT_IMAGE(DstImages[i], ErrorCluster);
+		ImgSrc = ADV_LVDTToGRImageCached(SrcImages[i]);
+		ImgDst = ADV_LVDTToGRImageCached(DstImages[i]);
+		LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+		LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+		LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+
+		imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+		if ((err = ADV_ImageToMat(ImgSrc, src[i])) || (err = ADV_ImageToMat(ImgDst, dst[i]))) RETURN_ERROR(err, ErrorCluster);
+	}
+
+	err = ADV_StatusToError(MSProcessBatch(Context, src.data(), dst.data(), Count, *Params, Mode, Stats));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Fires the LabVIEW user event registered with MultiscaleAsyncCreate
+static void ADV_AsyncPostEvent(const MSAsyncCompletion *Completion, void *User)
+{
+	LVUserEventRef Event = (LVUserEventRef)(uintptr_t)User;
+	PostLVUserEvent(Event, (void *)Completion);
+}
+
+//Event may be NULL, completions are then collected with MultiscaleAsyncWait.
+//The context is used by the queue until MultiscaleAsyncDestroy
+extern "C" __declspec(dllexport) void MultiscaleAsyncCreate(
+		MSContext *Context, int Depth, LVUserEventRef *Event, MSAsync **Async,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Async, ErrorCluster);
+	if ((Depth <= 0) || (Depth > MS_ASYNC_MAX_DEPTH)) RETURN_ERROR(ERR_MS_INVALID_PARAMETER, ErrorCluster);
+
+	*Async = Event ? MSAsyncCreate(Context, Depth, ADV_AsyncPostEvent, (void *)(uintptr_t)*Event)
+		: MSAsyncCreate(Context, Depth, NULL, NULL);
+	if (!*Async) ADV_SetLVError(ERR_OUT_OF_MEMORY, __func__, ErrorCluster);
+}
+
+//Finishes the queued frames, always runs so the queue is freed on error
+extern "C" __declspec(dllexport) void MultiscaleAsyncDestroy(MSAsync *Async)
+{
+	MSAsyncDestroy(Async);
+}
+
+//Src is copied, DstImage must not be used until its ticket completes
+extern "C" __declspec(dllexport) void MultiscaleAsyncSubmit(
+		MSAsync *Async, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params, int TimeoutMs, int64_t *Ticket,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Async, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NULL(Ticket, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSAsyncSubmit(Async, src, dst, *Params, TimeoutMs, Ticket));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//TimeoutMs -1 waits forever, the error is the status of the frame
+extern "C" __declspec(dllexport) void MultiscaleAsyncWait(
+		MSAsync *Async, int64_t Ticket, int TimeoutMs, MSAsyncCompletion *Completion,
+		LVErrorCluster *ErrorCluster)
+{
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Async, ErrorCluster);
+
+	err = ADV_StatusToError(MSAsyncWait(Async, Ticket, TimeoutMs, Completion));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Preallocated frame slots between one acquisition and one processing loop
+extern "C" __declspec(dllexport) void MultiscaleRingCreate(
+		int Width, int Height, int ImageType, int Slots, MSFrameRing **Ring,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Ring, ErrorCluster);
+
+	*Ring = MSFrameRingCreate(Width, Height, ADV_ImageTypeToMat(ImageType), Slots);
+	if (!*Ring) ADV_SetLVError(ERR_MS_INVALID_PARAMETER, __func__, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void MultiscaleRingDestroy(MSFrameRing *Ring)
+{
+	MSFrameRingDestroy(Ring);
+}
+
+//Producer: slot memory for a driver to write into, Acquired 0 if the ring is full
+extern "C" __declspec(dllexport) void MultiscaleRingAcquire(
+		MSFrameRing *Ring, void **Pixels, int *LineBytes, int *Acquired,
+		LVErrorCluster *ErrorCluster)
+{
+	Mat *slot;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Ring, ErrorCluster);
+	LV_IS_NULL(Pixels, ErrorCluster);
+	LV_IS_NULL(LineBytes, ErrorCluster);
+	LV_IS_NULL(Acquired, ErrorCluster);
+
+	slot = MSFrameRingAcquire(Ring);
+	*Pixels = slot ? slot->data : NULL;
+	*LineBytes = slot ? (int)slot->step : 0;
+	*Acquired = slot != NULL;
+}
+
+//Producer: publishes the slot returned by MultiscaleRingAcquire, an error without one
+extern "C" __declspec(dllexport) void MultiscaleRingCommit(
+		MSFrameRing *Ring,
+		LVErrorCluster *ErrorCluster)
+{
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Ring, ErrorCluster);
+
+	err = ADV_StatusToError(MSFrameRingCommit(Ring));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Producer: copies an IMAQ image into the next slot, Pushed 0 if the ring is full
+extern "C" __declspec(dllexport) void MultiscaleRingPush(
+		MSFrameRing *Ring, NIImageHandle SrcImage, int *Pushed,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc;
+	Mat src, *slot;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Ring, ErrorCluster);
+	LV_IS_NULL(Pushed, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	if ((err = ADV_ImageToMat(ImgSrc, src))) RETURN_ERROR(err, ErrorCluster);
+	if (src.type() != Ring->type) RETURN_ERROR(ERR_INVALID_IMAGE_TYPE, ErrorCluster);
+	if ((src.cols != Ring->width) || (src.rows != Ring->height)) RETURN_ERROR(ERR_INCOMP_SIZE, ErrorCluster);
+
+	*Pushed = 0;
+	if (!(slot = MSFrameRingAcquire(Ring))) return;
+	src.copyTo(*slot);
+	if ((err = ADV_StatusToError(MSFrameRingCommit(Ring)))) RETURN_ERROR(err, ErrorCluster);
+	*Pushed = 1;
+}
+
+//Consumer: runs the pipeline on the oldest slot in place, TimeoutMs -1 waits forever
+extern "C" __declspec(dllexport) void MultiscaleRingProcess(
+		MSFrameRing *Ring, MSContext *Context, NIImageHandle DstImage,
+		const MSParameters *Params, int TimeoutMs, int64_t *Sequence,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgDst;
+	Mat dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Ring, ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
+
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, Ring->width, Ring->height);
+
+	if ((err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSFrameRingProcess(Ring, Context, dst, *Params, TimeoutMs, Sequence));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Latency and jitter from commit to processed at a fixed frame rate
+extern "C" __declspec(dllexport) void MultiscaleRingBenchmark(
+		MSContext *Context, int Width, int Height, int ImageType,
+		const MSParameters *Params, double Fps, int Frames, int Slots, MSRingStats *Stats,
+		LVErrorCluster *ErrorCluster)
+{
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NULL(Stats, ErrorCluster);
+
+	err = ADV_StatusToError(MSFrameRingBenchmark(Context, Width, Height, ADV_ImageTypeToMat(ImageType),
+		*Params, Fps, Frames, Slots, Stats));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//MultiscaleProcess within BudgetUs, sheds unsharp, filters and pow precision when late
+extern "C" __declspec(dllexport) void MultiscaleProcessDeadline(
+		MSContext *Context, NIImageHandle SrcImage, NIImageHandle DstImage,
+		const MSParameters *Params, double BudgetUs, MSFrameReport *Report,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Context, MS_EXPORT_MULTISCALE);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+	LV_IS_TOO_SMALL(ImgSrc, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSProcessDeadline(Context, src, dst, *Params, BudgetUs, Report));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Plan for repeated frames of the same geometry, ImageType is IMAQ_IMAGE_U16 or IMAQ_IMAGE_SGL
+extern "C" __declspec(dllexport) void MultiscalePlanCreate(
+		MSContext *Context, int Width, int Height, int ImageType,
+		const MSParameters *Params, MSPlan **Plan,
+		LVErrorCluster *ErrorCluster)
+{
+	int status;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+	LV_IS_NULL(Plan, ErrorCluster);
+
+	*Plan = MSPlanCreate(Context, Width, Height, ADV_ImageTypeToMat(ImageType), *Params, &status);
+	if (!*Plan) ADV_SetLVError(ADV_StatusToError(status), __func__, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void MultiscalePlanDestroy(MSPlan *Plan)
+{
+	MSPlanDestroy(Plan);
+}
+
+//Src must match the plan, Dst is resized to the source
+extern "C" __declspec(dllexport) void MultiscalePlanExecute(
+		MSPlan *Plan, NIImageHandle SrcImage, NIImageHandle DstImage,
+		LVErrorCluster *ErrorCluster)
+{
+	Image *ImgSrc, *ImgDst;
+	Mat src, dst;
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	MATPOOL_SCOPE();
+	LV_IS_NULL(Plan, ErrorCluster);
+	LV_IS_NOT_IMAGE(SrcImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(DstImage, ErrorCluster);
+	MSContextTimer timer(Plan->ctx, MS_EXPORT_MULTISCALE);
+
+	ImgSrc = ADV_LVDTToGRImageCached(SrcImage);
+	ImgDst = ADV_LVDTToGRImageCached(DstImage);
+	LV_IS_NOT_IMAGE(ImgSrc, ErrorCluster);
+	LV_IS_NOT_IMAGE(ImgDst, ErrorCluster);
+
+	imaqSetImageSize (ImgDst, ((ImageInfo *)ImgSrc)->xRes, ((ImageInfo *)ImgSrc)->yRes);
+
+	if ((err = ADV_ImageToMat(ImgSrc, src)) || (err = ADV_ImageToMat(ImgDst, dst))) RETURN_ERROR(err, ErrorCluster);
+
+	err = ADV_StatusToError(MSPlanExecute(Plan, src, dst));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Per-frame time in microseconds with planning every frame and with a prepared plan,
+//small frames (e.g. 64x64) show the fixed overhead best
+extern "C" __declspec(dllexport) void MultiscalePlanBenchmark(
+		MSContext *Context, int Width, int Height, int ImageType,
+		const MSParameters *Params, int Iterations,
+		double *ReplanUs, double *ExecuteUs,
+		LVErrorCluster *ErrorCluster)
+{
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+
+	err = ADV_StatusToError(MSPlanBenchmark(Context, Width, Height, ADV_ImageTypeToMat(ImageType),
+		*Params, Iterations, ReplanUs, ExecuteUs));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Level-synchronous versus tile graph schedule, per frame in microseconds
+extern "C" __declspec(dllexport) void MultiscaleScheduleBenchmark(
+		MSContext *Context, int Width, int Height, int ImageType,
+		const MSParameters *Params, int Iterations,
+		double *LevelsUs, double *GraphUs, double *CriticalPathUs, double *WorkUs,
+		LVErrorCluster *ErrorCluster)
+{
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Context, ErrorCluster);
+	LV_IS_NULL(Params, ErrorCluster);
+
+	err = ADV_StatusToError(MSPlanScheduleBenchmark(Context, Width, Height, ADV_ImageTypeToMat(ImageType),
+		*Params, Iterations, LevelsUs, GraphUs, CriticalPathUs, WorkUs));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+//Per-stage latency since the last reset, Stats holds Count entries in MSProfileStage order
+extern "C" __declspec(dllexport) void opencv2ProfileStats(
+		MSProfileStats *Stats, int Count,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Stats, ErrorCluster);
+
+	for (int i = 0; (i < Count) && (i < MS_PROF_COUNT); i++) MSProfileQuery(i, &Stats[i]);
+}
+
+//Name of a stage for the LabVIEW table, Size bytes including the terminator
+extern "C" __declspec(dllexport) void opencv2ProfileStageName(int Stage, char *Name, int Size)
+{
+	if (Name && (Size > 0)) snprintf(Name, Size, "%s", MSProfileStageName(Stage));
+}
+
+extern "C" __declspec(dllexport) void opencv2ProfileReset()
+{
+	MSProfileReset();
+}
+
+//Stage of a name from opencv2ProfileStageName, -1 if unknown
+extern "C" __declspec(dllexport) int opencv2ProfileStageId(const char *Name)
+{
+	for (int i = 0; Name && (i < MS_PROF_COUNT); i++) if (!strcmp(Name, MSProfileStageName(i))) return i;
+	return -1;
+}
+
+//Sample timed outside of this DLL (MP Helper), Ticks of the time stamp counter
+extern "C" __declspec(dllexport) void opencv2ProfileRecord(int Stage, uint64_t Ticks)
+{
+	if ((Stage >= 0) && (Stage < MS_PROF_COUNT)) MSProfileRecord(Stage, Ticks);
+}
+
+//Hardware counters per stage, Linux only, the Windows build reports ERR_MS_NOT_SUPPORTED
+extern "C" __declspec(dllexport) void opencv2CountersStart(
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+
+	if (!MSCountersStart()) ADV_SetLVError(ERR_MS_NOT_SUPPORTED, __func__, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void opencv2CountersStop()
+{
+	MSCountersStop();
+}
+
+//Counters since the last opencv2ProfileReset, Stats holds Count entries in MSProfileStage order
+extern "C" __declspec(dllexport) void opencv2CounterStats(
+		MSCounterStats *Stats, int Count,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Stats, ErrorCluster);
+
+	for (int i = 0; (i < Count) && (i < MS_PROF_COUNT); i++) MSCountersQuery(i, &Stats[i]);
+}
+
+//Records stage, tile and chunk events of all threads into Capacity preallocated slots,
+//an error while already recording
+extern "C" __declspec(dllexport) void opencv2TraceStart(
+		int Capacity,
+		LVErrorCluster *ErrorCluster)
+{
+	int err;
+
+	CHECK_ERROR_IN(ErrorCluster);
+
+	err = ADV_StatusToError(MSTraceStart(Capacity));
+	if (err) ADV_SetLVError(err, __func__, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void opencv2TraceStop()
+{
+	MSTraceStop();
+}
+
+//Chrome trace JSON for chrome://tracing or ui.perfetto.dev, Dropped events did not fit
+extern "C" __declspec(dllexport) void opencv2TraceWrite(
+		const char *Path, int *Events, int *Dropped,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Path, ErrorCluster);
+
+	if (!MSTraceWrite(Path, Events, Dropped)) ADV_SetLVError(ERR_MS_FILE, __func__, ErrorCluster);
+}
+
+//Replaces a Conv Flt Presets kernel with the one used by Convolution with PreSets.vi
+extern "C" __declspec(dllexport) void opencv2SetConvKernel(
+		int Preset, const float *Kernel, int Size, //Size x Size, odd
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(Kernel, ErrorCluster);
+
+	if (!MSSetConvKernel(Preset, Kernel, Size)) ADV_SetLVError(ERR_MS_INVALID_PARAMETER, __func__, ErrorCluster);
+}
+
+//Called by ImagesPool.vi with 0 when it starts, which turns the image cache on,
+//and with the handle before every IMAQ Dispose. Any call flushes the whole cache
+extern "C" __declspec(dllexport) void opencv2ImageCacheInvalidate(NIImageHandle Image)
+{
+	ADV_ImageCacheInvalidate(Image);
+}
+
+//Per-call marshalling overhead in microseconds, before and after caching.
+//GRCachedUs is the uncached path until opencv2ImageCacheInvalidate turns the cache on
+extern "C" __declspec(dllexport) void opencv2ImageCacheBenchmark(
+		NIImageHandle NIImage, const void *LVImage, int Iterations,
+		double *GRUncachedUs, double *GRCachedUs,
+		double *LVDTUncachedUs, double *LVDTCachedUs,
+		LVErrorCluster *ErrorCluster)
+{
+	LARGE_INTEGER freq, t0, t1;
+	Image *image;
+	double scale;
+
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NOT_IMAGE(NIImage, ErrorCluster);
+	LV_IS_NOT_IMAGE(LVImage, ErrorCluster);
+	Iterations = Iterations > 0 ? Iterations : 10000;
+
+	QueryPerformanceFrequency(&freq);
+	scale = 1e6 / ((double)freq.QuadPart * Iterations);
+
+	QueryPerformanceCounter(&t0);
+	for (int i = 0; i < Iterations; i++){
+		LV_SetThreadCore(1);
+		LV_LVDTToGRImage(NIImage, &image);
+	}
+	QueryPerformanceCounter(&t1);
+	*GRUncachedUs = (t1.QuadPart - t0.QuadPart) * scale;
+
+	ADV_LVDTToGRImageCached(NIImage); //warm up
+	QueryPerformanceCounter(&t0);
+	for (int i = 0; i < Iterations; i++) image = ADV_LVDTToGRImageCached(NIImage);
+	QueryPerformanceCounter(&t1);
+	*GRCachedUs = (t1.QuadPart - t0.QuadPart) * scale;
+
+	QueryPerformanceCounter(&t0);
+	for (int i = 0; i < Iterations; i++) image = ADV_LVDTToAddressUncached(LVImage);
+	QueryPerformanceCounter(&t1);
+	*LVDTUncachedUs = (t1.QuadPart - t0.QuadPart) * scale;
+
+	ADV_LVDTToAddress(LVImage); //warm up
+	QueryPerformanceCounter(&t0);
+	for (int i = 0; i < Iterations; i++) image = ADV_LVDTToAddress(LVImage);
+	QueryPerformanceCounter(&t1);
+	*LVDTCachedUs = (t1.QuadPart - t0.QuadPart) * scale;
+
+	LV_IS_NOT_IMAGE(image, ErrorCluster);
+}
+
+extern "C" __declspec(dllexport) void opencv2MatPoolStats(
+		const char *ExportName, MatPoolStats *Stats, double *ReservedMB,
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+	LV_IS_NULL(ExportName, ErrorCluster);
+	LV_IS_NULL(Stats, ErrorCluster);
+
+	if (!MatPoolGetStats(ExportName, Stats)) memset(Stats, 0, sizeof(MatPoolStats));
+	if (ReservedMB) *ReservedMB = MatPoolInstance()->getReservedSize() / (1024.0 * 1024.0);
+}
+
+extern "C" __declspec(dllexport) void opencv2MatPoolControl(
+		LVBoolean ResetStats, LVBoolean FreeReserved, double MaxReservedMB, //0 - keep current
+		LVErrorCluster *ErrorCluster)
+{
+	CHECK_ERROR_IN(ErrorCluster);
+
+	if (ResetStats) MatPoolResetStats();
+	if (MaxReservedMB > 0) MatPoolInstance()->setMaxReservedSize((size_t)(MaxReservedMB * 1024.0 * 1024.0));
+	if (FreeReserved) MatPoolInstance()->freeAllReservedBuffers();
 }
 
 BOOL APIENTRY DllMain( HMODULE hModule, DWORD  ul_reason_for_call, LPVOID lpReserved)
@@ -351,6 +1282,7 @@ BOOL APIENTRY DllMain( HMODULE hModule, DWORD  ul_reason_for_call, LPVOID lpRese
 		case DLL_THREAD_ATTACH:
 			break;
 		case DLL_THREAD_DETACH:
+			ADV_LVImageScratchFree();
 			break;
 		case DLL_PROCESS_DETACH:
 			break;
@@ -12,12 +12,20 @@
 #include <stdio.h>
 #include "extcode.h"
 #include "nivision.h"
+#include "Profile.h"
 		
 typedef uintptr_t NIImageHandle;
 
 extern "C" int LV_LVDTToGRImage(NIImageHandle niImageHandle, void *image);
 extern "C" int LV_SetThreadCore(int NumThreads);
 
+//Wrapper specific errors, LabVIEW user defined range
+#define ERR_MS_INVALID_PARAMETER	5000
+#define ERR_MS_OPENCV				5001
+#define ERR_MS_TIMEOUT				5002
+#define ERR_MS_FILE					5003
+#define ERR_MS_NOT_SUPPORTED		5004
+
 #define U8	0x1
 #define U16 	0x2
 #define I16	0x4
@@ -60,6 +68,9 @@ extern "C" uint8_t GGetOneErrorCode(int ErrorCode, LStrHandle* ErrStr);
 #define LV_IS_NOT_IMAGE(img,ErrorCluster) \
 	if (!(img)) {ADV_SetLVError(ERR_NOT_IMAGE, __func__, ErrorCluster); return;}
 
+#define LV_IS_NULL(ptr,ErrorCluster) \
+	if (!(ptr)) {ADV_SetLVError(ERR_NULL_POINTER, __func__, ErrorCluster); return;}
+
 #define IS_NOT_IMAGE2(img1,img2) \
 	if ( (!(img1)) || (!(img2)) ) return;
 
@@ -151,7 +162,7 @@ extern "C" uint8_t GGetOneErrorCode(int ErrorCode, LStrHandle* ErrStr);
 
 
 
-Image* ADV_LVDTToAddress(const void *LVImageHdl)
+Image* ADV_LVDTToAddressUncached(const void *LVImageHdl)
 {
 	IMAQ_Image *LV_Image;
 	Image* ret;
@@ -166,6 +177,97 @@ Image* ADV_LVDTToAddress(const void *LVImageHdl)
 	return ret;
 }
 
+//The IMAQ_Image scratch is allocated once per thread and reused, the name
+//handle is resized by LV_LVDTToImage if necessary. Freed when the thread exits
+static __declspec(thread) IMAQ_Image *ADV_LVImageScratch;
+
+Image* ADV_LVDTToAddress(const void *LVImageHdl)
+{
+	MS_PROFILE(MS_PROF_MARSHAL);
+	IMAQ_Image *LV_Image = ADV_LVImageScratch;
+
+	if (!LV_Image){
+		LV_Image = (IMAQ_Image*)DSNewPtr(sizeof(IMAQ_Image));
+		if (!LV_Image) return NULL;
+		LV_Image->name = (LStrHandle)DSNewHandle(sizeof(LStrHandle));
+		ADV_LVImageScratch = LV_Image;
+	}
+	LV_Image->address = NULL;
+	LV_LVDTToImage(LV_Image, LVImageHdl); //first cluster, second image
+	
+	return LV_Image->address;
+}
+
+//Frees the scratch of the calling thread, DllMain on DLL_THREAD_DETACH
+void ADV_LVImageScratchFree()
+{
+	IMAQ_Image *LV_Image = ADV_LVImageScratch;
+
+	if (!LV_Image) return;
+	ADV_LVImageScratch = NULL;
+	if (LV_Image->name) DSDisposeHandle(LV_Image->name);
+	DSDisposePtr(LV_Image);
+}
+
+//Resolved image cache, direct mapped by NIImageHandle. Nothing of a cached
+//Image* is read to check it, only the image pool knows that one is gone:
+//the cache stays off until ImagesPool.vi calls the invalidate export, with
+//0 when it starts and with the handle before every IMAQ Dispose. Each call
+//starts a new generation and entries of older ones miss, disposals are rare
+#define IMAGE_CACHE_SIZE 64
+
+typedef struct {
+	NIImageHandle handle;
+	Image *image;
+	LONG generation;
+} ADV_ImageCacheEntry;
+
+static ADV_ImageCacheEntry ADV_ImageCache[IMAGE_CACHE_SIZE];
+static SRWLOCK ADV_ImageCacheLock = SRWLOCK_INIT;
+static LONG ADV_ImageCacheGeneration; //0 - off, the pool has not called the invalidate export yet
+
+static int ADV_ImageCacheSlot(NIImageHandle niImageHandle)
+{
+	return (int)(((uint64_t)niImageHandle * 0x9E3779B97F4A7C15ull) >> 58); //64 slots
+}
+
+Image* ADV_LVDTToGRImageCached(NIImageHandle niImageHandle)
+{
+	MS_PROFILE(MS_PROF_MARSHAL);
+	Image *image = NULL;
+	ADV_ImageCacheEntry entry;
+	LONG generation;
+	int slot = ADV_ImageCacheSlot(niImageHandle);
+
+	AcquireSRWLockShared(&ADV_ImageCacheLock);
+	entry = ADV_ImageCache[slot];
+	generation = ADV_ImageCacheGeneration;
+	ReleaseSRWLockShared(&ADV_ImageCacheLock);
+	if (generation && (entry.generation == generation) && (entry.handle == niImageHandle) && entry.image) return entry.image;
+
+	LV_SetThreadCore(1); //must be called prior to LV_LVDTToGRImage
+	LV_LVDTToGRImage(niImageHandle, &image);
+	if (!image || !generation) return image;
+
+	//an invalidation since the lookup may be about this handle
+	AcquireSRWLockExclusive(&ADV_ImageCacheLock);
+	if (ADV_ImageCacheGeneration == generation){
+		ADV_ImageCache[slot].handle = niImageHandle;
+		ADV_ImageCache[slot].image = image;
+		ADV_ImageCache[slot].generation = generation;
+	}
+	ReleaseSRWLockExclusive(&ADV_ImageCacheLock);
+	
+	return image;
+}
+
+void ADV_ImageCacheInvalidate(NIImageHandle niImageHandle) //0 - the pool starts
+{
+	AcquireSRWLockExclusive(&ADV_ImageCacheLock);
+	ADV_ImageCacheGeneration = ADV_ImageCacheGeneration == MAXLONG ? 1 : ADV_ImageCacheGeneration + 1;
+	ReleaseSRWLockExclusive(&ADV_ImageCacheLock);
+}
+
 
 int ADV_SetLVError(int ErrorCode, const char *errText, LVErrorCluster *ErrorCluster)
 {
@@ -0,0 +1,144 @@
+//==============================================================================
+//
+// Title:       Pipeline
+// Purpose:     Whole multiscale chain of MultiScale SubVI.vi in one call.
+//
+//==============================================================================
+
+#include <string.h>
+#include "Pipeline.h"
+#include "Context.h"
+#include "Plan.h"
+
+using namespace cv;
+
+int MSLevelCount(int width, int height, int requested)
+{
+	int levels = 0, size = width < height ? width : height;
+
+	if (requested > MS_MAX_LEVELS) requested = MS_MAX_LEVELS;
+	while ((levels < requested) && ((size / 2) >= MS_MIN_LEVEL_SIZE)){
+		size /= 2;
+		levels++;
+	}
+	return levels;
+}
+
+//Reference values from Settings.ini
+void MSDefaultParameters(MSParameters *params)
+{
+	static const float lutPower[MS_MAX_LEVELS] = {
+		0.584615f, 0.430769f, 0.384615f, 0.438462f, 0.423077f, 0.553846f,
+		0.646154f, 0.615385f, 0.615385f, 0.600000f, 0.400000f, 0.400000f };
+	static const float lutMultiplier[MS_MAX_LEVELS] = {
+		177.230774f, 212.676926f, 153.600006f, 248.123077f, 196.923080f, 248.123077f,
+		252.061539f, 114.215385f, 248.123077f, 110.276924f, 102.400002f, 102.400002f };
+
+	memset(params, 0, sizeof(MSParameters));
+	params->preprocessing = MS_PREPROC_CONVOLUTION;
+	params->convolution = MS_CONV_SEIFERT_5X5;
+	params->levels = MS_MAX_LEVELS;
+	memcpy(params->lutPower, lutPower, sizeof(lutPower));
+	memcpy(params->lutMultiplier, lutMultiplier, sizeof(lutMultiplier));
+	params->filters[1] = MS_CONV_SEIFERT_5X5;
+	params->filters[2] = MS_CONV_HIGHLIGHT_DETAILS_3X3;
+	params->xValuePostProc = 1.205947;
+	params->unsharp.amount = 6.0f;
+	params->unsharp.radius = 33.0f;
+	params->unsharp.threshold = 30.0f;
+}
+
+MSPlan* MSContextPlan(MSContext *ctx, const Mat &src, const MSParameters &params, int *status)
+{
+	*status = MS_OK;
+	if (!MSPlanMatches(ctx->plan, src.cols, src.rows, src.type(), params)){
+		MSPlanDestroy(ctx->plan);
+		ctx->plan = MSPlanCreate(ctx, src.cols, src.rows, src.type(), params, status);
+	}
+	return ctx->plan;
+}
+
+int MSProcess(MSContext *ctx, const Mat &src, Mat &dst, const MSParameters &params)
+{
+	int status;
+	MSPlan *plan = MSContextPlan(ctx, src, params, &status);
+
+	return plan ? MSPlanExecute(plan, src, dst) : status;
+}
+
+// Context plan retuned to params where the decomposition can stay
+static MSPlan* MSContextTunedPlan(MSContext *ctx, const Mat &src, const MSParameters &params, int *status)
+{
+	*status = MS_OK;
+	if (!MSPlanRetunable(ctx->plan, src.cols, src.rows, src.type(), params)) return MSContextPlan(ctx, src, params, status);
+	MSPlanRetune(ctx->plan, params);
+	return ctx->plan;
+}
+
+int MSProcessIncremental(MSContext *ctx, const Mat &src, Mat &dst, const MSParameters &params)
+{
+	int status;
+	MSPlan *plan = MSContextTunedPlan(ctx, src, params, &status);
+
+	return plan ? MSPlanExecuteIncremental(plan, src, dst, NULL, NULL) : status;
+}
+
+int MSProcessROI(MSContext *ctx, const Mat &src, Mat &dst, const MSParameters &params, const Rect &roi)
+{
+	int status;
+	MSPlan *plan = MSContextTunedPlan(ctx, src, params, &status);
+
+	return plan ? MSPlanExecuteROI(plan, src, dst, roi, NULL) : status;
+}
+
+int MSProcessSweep(MSContext *ctx, const Mat &src, Mat *dst, const MSParameters *params, int count,
+	MSSweepStats *stats)
+{
+	int status;
+	MSPlan *plan;
+
+	if (count <= 0) return MS_ERR_INVALID_PARAMETER;
+	plan = MSContextTunedPlan(ctx, src, params[0], &status);
+	return plan ? MSPlanExecuteSweep(plan, src, dst, params, count, stats) : status;
+}
+
+int MSProcessDisplay(MSContext *ctx, const Mat &src, Mat &dst, const MSParameters &params,
+	const MSDisplayParams &display)
+{
+	int status;
+	MSPlan *plan = MSContextPlan(ctx, src, params, &status);
+
+	return plan ? MSPlanExecuteDisplay(plan, src, dst, display) : status;
+}
+
+int MSProcessMasked(MSContext *ctx, const Mat &src, Mat &dst, const MSParameters &params, double flatness,
+	MSMaskStats *stats)
+{
+	int status;
+	MSPlan *plan = MSContextPlan(ctx, src, params, &status);
+
+	return plan ? MSPlanExecuteMasked(plan, src, dst, flatness, stats) : status;
+}
+
+int MSProcessProgressive(MSContext *ctx, const Mat &src, Mat &dst, const MSParameters &params,
+	int previewLevel, MSPreviewCallback callback, void *user)
+{
+	int status;
+	MSPlan *plan = MSContextPlan(ctx, src, params, &status);
+
+	return plan ? MSPlanExecuteProgressive(plan, src, dst, previewLevel, callback, user) : status;
+}
+
+const char* MSStatusText(int status)
+{
+	switch (status){
+		case MS_OK: return "OK";
+		case MS_ERR_INVALID_TYPE: return "Invalid image type, U16 or SGL expected";
+		case MS_ERR_INVALID_PARAMETER: return "Invalid parameter";
+		case MS_ERR_TOO_SMALL: return "Image too small";
+		case MS_ERR_OPENCV: return "OpenCV exception";
+		case MS_ERR_OUT_OF_MEMORY: return "Out of memory";
+		case MS_ERR_TIMEOUT: return "Timeout";
+		default: return "Unknown error";
+	}
+}
@@ -0,0 +1,127 @@
+//==============================================================================
+//
+// Title:       Pipeline
+// Purpose:     Whole multiscale chain of MultiScale SubVI.vi in one call.
+//
+//              Preprocessing convolution, level count check, Laplacian
+//              decomposition, per-level LUT power/multiplier and filter,
+//              reconstruction, X Value PostProc power and unsharp mask.
+//
+//==============================================================================
+
+#ifndef __Pipeline_H__
+#define __Pipeline_H__
+
+#include <stdint.h>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "Multiscale.h"
+
+struct MSContext;
+struct MSPlan;
+
+#define MS_MAX_LEVELS	12
+#define MS_MIN_LEVEL_SIZE	8 //coarsest level is at least 8x8
+
+enum MSPreprocessing {
+	MS_PREPROC_NONE = 0,
+	MS_PREPROC_CONVOLUTION
+};
+
+// Mirrors Multiscale Parameters Typedef.ctl (and Settings.ini)
+typedef struct {
+	int32_t preprocessing;               // MSPreprocessing
+	int32_t convolution;                 // MSConvPreset of the preprocessing
+	int32_t levels;                      // used entries of the arrays below
+	float lutPower[MS_MAX_LEVELS];
+	float lutMultiplier[MS_MAX_LEVELS];
+	int32_t filters[MS_MAX_LEVELS];      // MSConvPreset per level
+	double xValuePostProc;               // 0 or 1 - no post power
+	MSUnsharpParams unsharp;             // amount 0 - no unsharp mask
+	double divider;                      // 0 - max |coefficient| of every level
+} MSParameters;
+
+enum MSStatus {
+	MS_OK = 0,
+	MS_ERR_INVALID_TYPE,
+	MS_ERR_INVALID_PARAMETER,
+	MS_ERR_TOO_SMALL,
+	MS_ERR_OPENCV,
+	MS_ERR_OUT_OF_MEMORY,
+	MS_ERR_TIMEOUT
+};
+
+// Pyramid storage kept by a plan between frames
+typedef struct {
+	std::vector<cv::Mat> gauss;  //gauss[0] is the preprocessed input
+	std::vector<cv::Mat> bands;  //Laplacian bands, transformed in place
+	std::vector<cv::Mat> up;     //pyrUp scratch of every level
+} MSPyramid;
+
+// Same as Get Amount of Pyramid Levels.vi / Check Amount of Pyramid Levels.vi
+int MSLevelCount(int width, int height, int requested);
+
+void MSDefaultParameters(MSParameters *params);
+
+// src U16 or SGL, dst U16 or SGL (created with the type of src if empty).
+// The plan for the geometry and parameters is cached in the context
+int MSProcess(MSContext *ctx, const cv::Mat &src, cv::Mat &dst, const MSParameters &params);
+
+// MSProcess for interactive tuning: a change of tone curves, filters, post power
+// or unsharp mask keeps the cached plan and, for the same frame, its decomposition
+int MSProcessIncremental(MSContext *ctx, const cv::Mat &src, cv::Mat &dst, const MSParameters &params);
+
+// Only roi of the result into dst (roi.size()), for zoomed viewing. Same caching
+// with the adaptive divider, a fixed one decomposes only what roi needs
+int MSProcessROI(MSContext *ctx, const cv::Mat &src, cv::Mat &dst, const MSParameters &params, const cv::Rect &roi);
+
+typedef struct {
+	int32_t count;           // parameter sets
+	int32_t decomposed;      // 1 - the frame was decomposed, 0 - it was cached
+	double decomposeUs;      // input and decomposition
+	double sweepUs;          // tone curves, filters, reconstruction and output of all sets
+	double perSetUs;         // sweepUs / count
+} MSSweepStats;
+
+// MSProcess of src with count parameter sets into dst[count], the frame is
+// decomposed once for all of them. The sets may differ in everything but
+// preprocessing, convolution and levels. stats may be NULL
+int MSProcessSweep(MSContext *ctx, const cv::Mat &src, cv::Mat *dst, const MSParameters *params, int count,
+	MSSweepStats *stats);
+
+// MSProcess into a U8 or U16 display buffer (U8 if empty), see MSPlanExecuteDisplay
+int MSProcessDisplay(MSContext *ctx, const cv::Mat &src, cv::Mat &dst, const MSParameters &params,
+	const MSDisplayParams &display);
+
+typedef struct {
+	int32_t tiles;           // of the tile mask
+	int32_t deadTiles;       // flat or saturated
+	double skipped;          // fraction of the tone curve and filter work skipped
+} MSMaskStats;
+
+// MSProcess that leaves out flat or saturated regions, see MSPlanExecuteMasked.
+// flatness 0 - default, stats may be NULL
+int MSProcessMasked(MSContext *ctx, const cv::Mat &src, cv::Mat &dst, const MSParameters &params, double flatness,
+	MSMaskStats *stats);
+
+// One refinement of MSProcessProgressive, the LabVIEW user event data starts with it
+typedef struct {
+	int32_t level;           // reconstructed pyramid level, 0 - final result
+	int32_t width, height;   // of that level
+	double elapsedUs;        // since the start of the frame
+} MSPreviewInfo;
+
+// Runs on the processing thread, preview is out and valid during the call only
+typedef void (*MSPreviewCallback)(const MSPreviewInfo *info, const cv::Mat &preview, void *user);
+
+// MSProcess with previews of the coarse levels before the full resolution
+// result, see MSPlanExecuteProgressive. callback may be NULL
+int MSProcessProgressive(MSContext *ctx, const cv::Mat &src, cv::Mat &dst, const MSParameters &params,
+	int previewLevel, MSPreviewCallback callback, void *user);
+
+// Plan cached in the context for the geometry of src, NULL and status on failure
+MSPlan* MSContextPlan(MSContext *ctx, const cv::Mat &src, const MSParameters &params, int *status);
+
+const char* MSStatusText(int status);
+
+#endif  /* ndef __Pipeline_H__ */
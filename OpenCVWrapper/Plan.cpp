@@ -0,0 +1,1389 @@
+//==============================================================================
+//
+// Title:       Plan
+// Purpose:     Plan/execute API for repeated same-geometry processing.
+//
+//==============================================================================
+
+#include <string.h>
+#include <new>
+#include <chrono>
+#include <algorithm>
+#include "Plan.h"
+#include "Context.h"
+#include "Profile.h"
+#include "Ingest.h"
+
+using namespace cv;
+
+static double MSNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+bool MSParametersEqual(const MSParameters &a, const MSParameters &b)
+{
+	if ((a.preprocessing != b.preprocessing) || (a.convolution != b.convolution) || (a.levels != b.levels)) return false;
+	if ((a.xValuePostProc != b.xValuePostProc) || (a.divider != b.divider)) return false;
+	if ((a.unsharp.amount != b.unsharp.amount) || (a.unsharp.radius != b.unsharp.radius) ||
+		(a.unsharp.threshold != b.unsharp.threshold)) return false;
+	for (int k = 0; k < a.levels; k++){
+		if ((a.lutPower[k] != b.lutPower[k]) || (a.lutMultiplier[k] != b.lutMultiplier[k]) ||
+			(a.filters[k] != b.filters[k])) return false;
+	}
+	return true;
+}
+
+bool MSPlanMatches(const MSPlan *plan, int width, int height, int type, const MSParameters &params)
+{
+	return plan && (plan->width == width) && (plan->height == height) && (plan->type == type) &&
+		(plan->kernelGeneration == MSConvKernelGeneration()) && MSParametersEqual(plan->params, params);
+}
+
+// Tiles are full-width row strips, pyrDown/pyrUp treat the left and right
+// border differently from the inside, rows only need a halo
+#define MS_TILE_MIN_ROWS	8
+#define MS_TILE_HALO	4 //pyrDown source rows above and below a tile, even
+#define MS_ROI_HALO	2 //unsharp mask at level 0 and pyrUp source around a viewport window
+#define MS_FLAT_EPSILON	(1.0 / 256) //tone curve values this small are left at 0
+
+static void MSPlanStrips(int rows, int threads, std::vector<int> &starts)
+{
+	int height = std::max(MS_TILE_MIN_ROWS, (rows + threads * 4 - 1) / (threads * 4));
+
+	starts.clear();
+	for (int r = 0; r < rows; r += height) starts.push_back(r);
+	starts.push_back(rows);
+}
+
+// Rows [d0, d1) of gauss[k + 1]. The source window starts on an even row and
+// ends with the image or a halo past the tile, so its pyrDown has the same
+// rows as the pyrDown of the whole level
+static void MSTileDown(MSPlan *plan, int k, int d0, int d1, Mat &tile)
+{
+	const Mat &src = plan->pyr.gauss[k];
+	Mat &dst = plan->pyr.gauss[k + 1];
+	int s0 = std::max(0, 2 * d0 - MS_TILE_HALO), s1 = std::min(src.rows, 2 * d1 + MS_TILE_HALO);
+
+	pyrDown(src.rowRange(s0, s1), tile, Size(dst.cols, s1 == src.rows ? dst.rows - s0 / 2 : (s1 - s0) / 2));
+	tile.rowRange(d0 - s0 / 2, d1 - s0 / 2).copyTo(dst.rowRange(d0, d1));
+}
+
+// Source rows of the pyrUp of gauss[k + 1] needed for rows [r0, r1) of level k
+static void MSTileUpRows(const MSPlan *plan, int k, int r0, int r1, int *a0, int *a1)
+{
+	*a0 = std::max(0, r0 / 2 - 2);
+	*a1 = std::min(plan->sizes[k + 1].height, (r1 + 1) / 2 + 2);
+}
+
+// Rows [r0, r1) of pyrUp(gauss[k + 1]) at the size of level k
+static Mat MSTileUp(MSPlan *plan, int k, int r0, int r1, Mat &tile)
+{
+	const Mat &src = plan->pyr.gauss[k + 1];
+	int a0, a1, rows = plan->sizes[k].height;
+
+	MSTileUpRows(plan, k, r0, r1, &a0, &a1);
+	pyrUp(src.rowRange(a0, a1), tile, Size(plan->sizes[k].width, a1 == src.rows ? rows - 2 * a0 : 2 * (a1 - a0)));
+	return tile.rowRange(r0 - 2 * a0, r1 - 2 * a0);
+}
+
+// Scratch of a graph task, allocated with the graph so the runs allocate nothing
+static int MSPlanTile(MSPlan *plan, int rows, int cols)
+{
+	plan->tiles.push_back(Mat(rows, cols, CV_32FC1));
+	return (int)plan->tiles.size() - 1;
+}
+
+// Calibration of the context if in is a raw frame it applies to
+static const MSIngest* MSPlanIngest(const MSPlan *plan, const Mat &in)
+{
+	const MSIngest *ingest = plan->ctx->ingest.get();
+
+	if (!ingest || (in.type() != CV_16UC1) || (in.cols != ingest->width) || (in.rows != ingest->height)) return NULL;
+	return ingest;
+}
+
+// Largest |coefficient| of level k the tone curve maps to at most
+// MS_FLAT_EPSILON, segments up to it are set to 0. -1 - no MS_SHED_FLAT in
+// the running frame or the curve does not map 0 to 0
+static float MSPlanFlatLimit(const MSPlan *plan, int k, double divider)
+{
+	double power = plan->params.lutPower[k], multiplier = plan->params.lutMultiplier[k];
+
+	if (!plan->flat || !(power > 0)) return -1;
+	if (!(divider > 0) || !(multiplier > 0)) return 0;
+	return (float)(divider * pow(MS_FLAT_EPSILON / multiplier, 1.0 / power));
+}
+
+// Tone curve of rows [begin, end) of band k, the plain kernel of every other
+// path unless flat segments are left out (limit >= 0)
+static void MSPlanToneRows(MSPlan *plan, int k, Mat &band, int begin, int end, double divider, float limit)
+{
+	if (limit < 0) MSApplyTransformTable(band, begin, end, divider, plan->tone[k]);
+	else MSApplyTransformTableFlat(band, begin, end, divider, plan->tone[k], plan->segMax[k], limit);
+}
+
+// Rows [r0, r1) of band k have no segment above limit, so they are 0 after the tone curve
+static bool MSPlanRowsFlat(const MSPlan *plan, int k, int r0, int r1, float limit)
+{
+	const Mat &seg = plan->segMax[k];
+
+	if (limit < 0) return false;
+	for (int y = std::max(0, r0); y < std::min(seg.rows, r1); y++){
+		const float *ptr = seg.ptr<float>(y);
+		for (int s = 0; s < seg.cols; s++) if (ptr[s] > limit) return false;
+	}
+	return true;
+}
+
+// Buffers whose row ranges are tracked while building the graph
+enum MSPlanBuffer { MS_BUF_GAUSS, MS_BUF_BAND, MS_BUF_UP, MS_BUF_MAX, MS_BUF_COUNT };
+
+typedef struct {
+	int task, begin, end;
+	bool write;
+} MSAccess;
+
+// Adds the edges to every earlier task that wrote the rows, or read them if this task writes
+static void MSTrack(MSPlan *plan, std::vector<std::vector<MSAccess> > &log, int task,
+	int buffer, int k, int begin, int end, bool write)
+{
+	std::vector<MSAccess> &list = log[k * MS_BUF_COUNT + buffer];
+	MSAccess access = { task, std::max(0, begin), end, write };
+
+	for (size_t i = 0; i < list.size(); i++){
+		if ((list[i].task != task) && (list[i].begin < access.end) && (access.begin < list[i].end) &&
+			(write || list[i].write)) plan->graph.depend(task, list[i].task);
+	}
+	list.push_back(access);
+}
+
+// Decomposition, tone curves, filters and reconstruction as a graph of tiles.
+// Tasks are added in the order of the level schedule and the edges follow the
+// rows they read and write, so coarse levels start while fine ones are still
+// running and the result is the same as level after level
+static void MSPlanBuildGraph(MSPlan *plan, int threads)
+{
+	std::vector<std::vector<MSAccess> > log((plan->levels + 1) * MS_BUF_COUNT);
+	std::vector<std::vector<int> > upTiles(plan->levels); //pyrUp scratch of every strip, band and reconstruction task share it
+	MSPyramid &pyr = plan->pyr;
+	bool adaptive = !(plan->params.divider > 0);
+	int k, t, task, a0, a1, slot;
+
+	plan->strips.resize(plan->levels + 1);
+	plan->tileMax.resize(plan->levels);
+	plan->tiles.clear();
+	for (k = 0; k <= plan->levels; k++) MSPlanStrips(plan->sizes[k].height, threads, plan->strips[k]);
+	for (k = 0; k < plan->levels; k++) plan->tileMax[k].assign(plan->strips[k].size() - 1, 0);
+
+	const std::vector<int> &rows0 = plan->strips[0];
+	for (t = 0; t + 1 < (int)rows0.size(); t++){
+		int r0 = rows0[t], r1 = rows0[t + 1];
+		bool pre = !plan->preKernel.empty();
+		task = plan->graph.add([plan, &pyr, r0, r1, pre]{
+			MS_TRACE(MS_TRACE_TILE_INPUT, 0, r0);
+			Mat &dst = pre ? pyr.up[0] : pyr.gauss[0];
+			const MSIngest *ingest = MSPlanIngest(plan, *plan->input);
+			if (ingest) MSIngestRows(ingest, *plan->input, dst, r0, r1, Mat());
+			else plan->input->rowRange(r0, r1).convertTo(dst.rowRange(r0, r1), CV_32FC1);
+		});
+		MSTrack(plan, log, task, pre ? MS_BUF_UP : MS_BUF_GAUSS, 0, r0, r1, true);
+	}
+	if (!plan->preKernel.empty()){
+		int halo = plan->preKernel.rows / 2;
+		for (t = 0; t + 1 < (int)rows0.size(); t++){
+			int r0 = rows0[t], r1 = rows0[t + 1];
+			task = plan->graph.add([plan, &pyr, r0, r1]{
+				MS_TRACE(MS_TRACE_TILE_INPUT, 0, r0);
+				filter2D(pyr.up[0].rowRange(r0, r1), pyr.gauss[0].rowRange(r0, r1), -1, plan->preKernel,
+					Point(-1, -1), 0, BORDER_REFLECT_101);
+			});
+			MSTrack(plan, log, task, MS_BUF_UP, 0, r0 - halo, r1 + halo, false);
+			MSTrack(plan, log, task, MS_BUF_GAUSS, 0, r0, r1, true);
+		}
+	}
+
+	// decomposition
+	for (k = 0; k < plan->levels; k++){
+		const std::vector<int> &down = plan->strips[k + 1], &rows = plan->strips[k];
+		for (t = 0; t + 1 < (int)down.size(); t++){
+			int d0 = down[t], d1 = down[t + 1];
+			int s0 = std::max(0, 2 * d0 - MS_TILE_HALO), s1 = std::min(plan->sizes[k].height, 2 * d1 + MS_TILE_HALO);
+			slot = MSPlanTile(plan, s1 == plan->sizes[k].height ? plan->sizes[k + 1].height - s0 / 2 : (s1 - s0) / 2,
+				plan->sizes[k + 1].width);
+			task = plan->graph.add([plan, k, d0, d1, slot]{
+				MS_TRACE(MS_TRACE_TILE_DOWN, k + 1, d0);
+				MSTileDown(plan, k, d0, d1, plan->tiles[slot]);
+			});
+			MSTrack(plan, log, task, MS_BUF_GAUSS, k, 2 * d0 - MS_TILE_HALO, 2 * d1 + MS_TILE_HALO, false);
+			MSTrack(plan, log, task, MS_BUF_GAUSS, k + 1, d0, d1, true);
+		}
+		for (t = 0; t + 1 < (int)rows.size(); t++){
+			int r0 = rows[t], r1 = rows[t + 1];
+			MSTileUpRows(plan, k, r0, r1, &a0, &a1);
+			slot = MSPlanTile(plan, a1 == plan->sizes[k + 1].height ? plan->sizes[k].height - 2 * a0 : 2 * (a1 - a0),
+				plan->sizes[k].width);
+			upTiles[k].push_back(slot);
+			task = plan->graph.add([plan, &pyr, k, t, r0, r1, adaptive, slot]{
+				MS_TRACE(MS_TRACE_TILE_BAND, k, r0);
+				Mat band = pyr.bands[k].rowRange(r0, r1), seg = plan->segMax[k].rowRange(r0, r1);
+				float max = MSSubtractSegmentMax(pyr.gauss[k].rowRange(r0, r1), MSTileUp(plan, k, r0, r1, plan->tiles[slot]), band, seg);
+				if (adaptive) plan->tileMax[k][t] = max;
+			});
+			MSTrack(plan, log, task, MS_BUF_GAUSS, k + 1, a0, a1, false);
+			MSTrack(plan, log, task, MS_BUF_GAUSS, k, r0, r1, false);
+			MSTrack(plan, log, task, MS_BUF_BAND, k, r0, r1, true);
+			MSTrack(plan, log, task, MS_BUF_MAX, k, t, t + 1, true);
+		}
+	}
+
+	// per level tone curve and filter, the filtered band goes to up[k]
+	for (k = 0; k < plan->levels; k++){
+		const std::vector<int> &rows = plan->strips[k];
+		int tiles = (int)rows.size() - 1;
+		for (t = 0; t < tiles; t++){
+			int r0 = rows[t], r1 = rows[t + 1];
+			task = plan->graph.add([plan, &pyr, k, r0, r1]{
+				MS_TRACE(MS_TRACE_TILE_TONE, k, r0);
+				double divider = plan->params.divider;
+				if (!(divider > 0)){
+					const std::vector<double> &max = plan->tileMax[k];
+					divider = *std::max_element(max.begin(), max.end());
+				}
+				if (divider > 0) MSPlanToneRows(plan, k, pyr.bands[k], r0, r1, divider, MSPlanFlatLimit(plan, k, divider));
+			});
+			if (adaptive) MSTrack(plan, log, task, MS_BUF_MAX, k, 0, tiles, false);
+			MSTrack(plan, log, task, MS_BUF_BAND, k, r0, r1, true);
+		}
+		if (plan->kernels[k].empty()) continue;
+
+		int halo = plan->kernels[k].rows / 2;
+		for (t = 0; t < tiles; t++){
+			int r0 = rows[t], r1 = rows[t + 1];
+			task = plan->graph.add([plan, &pyr, k, r0, r1, halo]{
+				MS_TRACE(MS_TRACE_TILE_FILTER, k, r0);
+				double divider = plan->params.divider;
+				if (!(divider > 0)){
+					const std::vector<double> &max = plan->tileMax[k];
+					divider = *std::max_element(max.begin(), max.end());
+				}
+				// a strip of zeros with zeros around it stays 0
+				if (MSPlanRowsFlat(plan, k, r0 - halo, r1 + halo, MSPlanFlatLimit(plan, k, divider)))
+					pyr.up[k].rowRange(r0, r1) = Scalar(0);
+				else filter2D(pyr.bands[k].rowRange(r0, r1), pyr.up[k].rowRange(r0, r1), -1, plan->kernels[k],
+					Point(-1, -1), 0, BORDER_REFLECT_101);
+			});
+			MSTrack(plan, log, task, MS_BUF_BAND, k, r0 - halo, r1 + halo, false);
+			MSTrack(plan, log, task, MS_BUF_UP, k, r0, r1, true);
+		}
+	}
+
+	// reconstruction into the gauss levels, post power on the last one
+	for (k = plan->levels - 1; k >= 0; k--){
+		const std::vector<int> &rows = plan->strips[k];
+		bool filtered = !plan->kernels[k].empty();
+		for (t = 0; t + 1 < (int)rows.size(); t++){
+			int r0 = rows[t], r1 = rows[t + 1];
+			slot = upTiles[k][t]; //the band task of the strip is done before, its rows are read here
+			task = plan->graph.add([plan, &pyr, k, r0, r1, filtered, slot]{
+				MS_TRACE(MS_TRACE_TILE_RECON, k, r0);
+				add((filtered ? pyr.up[k] : pyr.bands[k]).rowRange(r0, r1), MSTileUp(plan, k, r0, r1, plan->tiles[slot]),
+					pyr.gauss[k].rowRange(r0, r1));
+				if (!k && plan->postPower) MSApplyPowerTable(pyr.gauss[0], r0, r1, plan->post);
+			});
+			MSTileUpRows(plan, k, r0, r1, &a0, &a1);
+			MSTrack(plan, log, task, MS_BUF_GAUSS, k + 1, a0, a1, false);
+			MSTrack(plan, log, task, filtered ? MS_BUF_UP : MS_BUF_BAND, k, r0, r1, false);
+			MSTrack(plan, log, task, MS_BUF_GAUSS, k, r0, r1, true);
+		}
+	}
+}
+
+MSPlan* MSPlanCreate(MSContext *ctx, int width, int height, int type, const MSParameters &params, int *status)
+{
+	MSPlan *plan;
+	int k, threads;
+
+	*status = MS_OK;
+	if ((type != CV_16UC1) && (type != CV_32FC1)) { *status = MS_ERR_INVALID_TYPE; return NULL; }
+	if ((params.levels < 0) || (params.levels > MS_MAX_LEVELS)) { *status = MS_ERR_INVALID_PARAMETER; return NULL; }
+	if ((width < MS_MIN_LEVEL_SIZE) || (height < MS_MIN_LEVEL_SIZE)) { *status = MS_ERR_TOO_SMALL; return NULL; }
+
+	plan = new (std::nothrow) MSPlan;
+	if (!plan) { *status = MS_ERR_OUT_OF_MEMORY; return NULL; }
+
+	plan->ctx = ctx;
+	plan->width = width;
+	plan->height = height;
+	plan->type = type;
+	plan->params = params;
+	plan->levels = MSLevelCount(width, height, params.levels);
+	threads = ctx->pool.size();
+
+	try {
+		// level layout and partitioning, about four chunks per thread
+		plan->sizes.resize(plan->levels + 1);
+		plan->grains.resize(plan->levels + 1);
+		plan->sizes[0] = Size(width, height);
+		for (k = 0; k <= plan->levels; k++){
+			if (k) plan->sizes[k] = Size(plan->sizes[k - 1].width / 2, plan->sizes[k - 1].height / 2);
+			plan->grains[k] = std::max(1, plan->sizes[k].height / (threads * 4));
+		}
+
+		// tone curves and kernels
+		plan->kernelGeneration = MSConvKernelGeneration(); //before reading them, a later change only rebuilds again
+		plan->tone.resize(plan->levels);
+		plan->kernels.resize(plan->levels);
+		for (k = 0; k < plan->levels; k++){
+			MSPowTableInit(plan->tone[k], params.lutPower[k], params.lutMultiplier[k]);
+			plan->kernels[k] = MSGetConvKernel(params.filters[k]);
+		}
+		plan->postPower = (params.xValuePostProc > 0) && (params.xValuePostProc != 1.0);
+		if (plan->postPower) MSPowTableInit(plan->post, params.xValuePostProc, 1.0);
+		if (params.preprocessing == MS_PREPROC_CONVOLUTION) plan->preKernel = MSGetConvKernel(params.convolution);
+		if (plan->levels) MSCoarseTableInit(plan->coarse0, params.lutPower[0], params.lutMultiplier[0]);
+		memset(plan->stageCost, 0, sizeof(plan->stageCost));
+		memset(plan->toneCost, 0, sizeof(plan->toneCost));
+		plan->graphCost = 0;
+		plan->cacheHash = 0;
+		plan->tunedValid = plan->reconstructed = false;
+		plan->flat = false;
+
+		// buffers
+		plan->pyr.gauss.resize(plan->levels + 1);
+		plan->pyr.bands.resize(plan->levels);
+		plan->pyr.up.resize(plan->levels);
+		for (k = 0; k <= plan->levels; k++) plan->pyr.gauss[k].create(plan->sizes[k], CV_32FC1);
+		plan->segMax.resize(plan->levels);
+		plan->bandMax.assign(plan->levels, 0);
+		for (k = 0; k < plan->levels; k++){
+			plan->pyr.bands[k].create(plan->sizes[k], CV_32FC1);
+			plan->pyr.up[k].create(plan->sizes[k], CV_32FC1);
+			plan->segMax[k].create(plan->sizes[k].height, (plan->sizes[k].width + MS_FLAT_SEGMENT - 1) / MS_FLAT_SEGMENT, CV_32FC1);
+		}
+
+		// a single thread gains nothing from the graph
+		plan->input = NULL;
+		plan->schedule = (threads > 1) && plan->levels ? MS_SCHEDULE_GRAPH : MS_SCHEDULE_LEVELS;
+		if (plan->levels) MSPlanBuildGraph(plan, threads);
+	}
+	catch (const cv::Exception &){
+		delete plan;
+		*status = MS_ERR_OPENCV;
+		return NULL;
+	}
+
+	return plan;
+}
+
+void MSPlanDestroy(MSPlan *plan)
+{
+	delete plan;
+}
+
+// Adds the time since *mark to the stage and restarts the mark
+static void MSStageLap(double *stageUs, int stage, double *mark)
+{
+	double now;
+
+	if (!stageUs) return;
+	now = MSNowUs();
+	stageUs[stage] += now - *mark;
+	*mark = now;
+}
+
+// Conversion and preprocessing into gauss[0], raw frames in one pass with
+// their calibration
+static void MSPlanInput(MSPlan *plan, const Mat &in)
+{
+	MSPyramid &pyr = plan->pyr;
+	const MSIngest *ingest = MSPlanIngest(plan, in);
+
+	MS_PROFILE(MS_PROF_INPUT);
+	if (ingest){
+		MSIngestRun(plan->ctx, ingest, in, pyr.gauss[0], plan->preKernel, plan->grains[0]);
+		return;
+	}
+	in.convertTo(pyr.gauss[0], CV_32FC1);
+	if (!plan->preKernel.empty())
+		filter2D(pyr.gauss[0], pyr.gauss[0], -1, plan->preKernel, Point(-1, -1), 0, BORDER_REFLECT_101);
+}
+
+// bands[k] = gauss[k] - up[k], with the segment and band max on the way
+static void MSPlanBand(MSPlan *plan, int k)
+{
+	MSPyramid &pyr = plan->pyr;
+	double max;
+
+	plan->ctx->pool.parallelFor(plan->sizes[k].height, plan->grains[k], [&](int begin, int end){
+		Mat seg = plan->segMax[k].rowRange(begin, end), band = pyr.bands[k].rowRange(begin, end);
+		MSSubtractSegmentMax(pyr.gauss[k].rowRange(begin, end), pyr.up[k].rowRange(begin, end), band, seg);
+	});
+	minMaxLoc(plan->segMax[k], NULL, &max);
+	plan->bandMax[k] = max;
+}
+
+static void MSPlanDecompose(MSPlan *plan)
+{
+	MSPyramid &pyr = plan->pyr;
+
+	for (int k = 0; k < plan->levels; k++){
+		MS_PROFILE(MS_PROF_DECOMPOSE + k);
+		pyrDown(pyr.gauss[k], pyr.gauss[k + 1], plan->sizes[k + 1]);
+		pyrUp(pyr.gauss[k + 1], pyr.up[k], plan->sizes[k]);
+		MSPlanBand(plan, k);
+	}
+}
+
+// Filter of band k in place, runs of MS_FLAT_SEGMENT rows that are 0 after
+// the tone curve are left out. The runs that are filtered take the rows
+// around them along, the rows in between stay 0 and keep them apart
+static void MSPlanFilterFlat(MSPlan *plan, int k, Mat &band, float limit)
+{
+	const Mat &kernel = plan->kernels[k];
+	int halo = kernel.rows / 2, chunks = (band.rows + MS_FLAT_SEGMENT - 1) / MS_FLAT_SEGMENT, c, e;
+	std::vector<uint8_t> flat(chunks);
+
+	if ((limit < 0) || (4 * halo > MS_FLAT_SEGMENT)){
+		filter2D(band, band, -1, kernel, Point(-1, -1), 0, BORDER_REFLECT_101);
+		return;
+	}
+	for (c = 0; c < chunks; c++) flat[c] = MSPlanRowsFlat(plan, k, c * MS_FLAT_SEGMENT, (c + 1) * MS_FLAT_SEGMENT, limit);
+	for (c = 0; c < chunks; c = e){
+		for (e = c + 1; (e < chunks) && (flat[e] == flat[c]); e++);
+		if (flat[c]) continue;
+		Mat rows = band.rowRange(std::max(0, c * MS_FLAT_SEGMENT - halo), std::min(band.rows, e * MS_FLAT_SEGMENT + halo));
+		filter2D(rows, rows, -1, kernel, Point(-1, -1), 0, BORDER_REFLECT_101);
+	}
+}
+
+// Reconstruction into the gauss levels from level coarsest to finest,
+// gauss[coarsest + 1] must hold its reconstruction or the residual
+static void MSPlanReconstruct(MSPlan *plan, int coarsest, int finest, const std::vector<Mat> &bands)
+{
+	MSPyramid &pyr = plan->pyr;
+
+	MS_PROFILE(MS_PROF_RECONSTRUCT);
+	for (int k = coarsest; k >= finest; k--){
+		pyrUp(pyr.gauss[k + 1], pyr.up[k], plan->sizes[k]);
+		add(bands[k], pyr.up[k], pyr.gauss[k]);
+	}
+}
+
+// Post power in place on gauss[0] or a window of it, the table maps negative values to 0
+static void MSPlanPost(MSPlan *plan, Mat &result, int shed)
+{
+	if (!plan->postPower) return;
+	MS_PROFILE(MS_PROF_POST);
+	plan->ctx->pool.parallelFor(result.rows, plan->grains[0], [&](int begin, int end){
+		if (!(shed & MS_SHED_FAST_POW)) MSApplyPowerTable(result, begin, end, plan->post);
+		else for (int y = begin; y < end; y++){
+			float *ptr = result.ptr<float>(y);
+			for (int x = 0; x < result.cols; x++) ptr[x] = ptr[x] > 0 ? (float)MSFastPow(ptr[x], plan->params.xValuePostProc) : 0.0f;
+		}
+	});
+}
+
+// Level after level, each step split into row chunks across the threads.
+// shed is a mask of MSShed, stageUs (may be NULL) receives the time per MSStage.
+// The reconstruction stops at level finest, the post power needs level 0
+static void MSPlanRunLevels(MSPlan *plan, const Mat &in, int shed, double *stageUs, int finest)
+{
+	MSContext *ctx = plan->ctx;
+	MSPyramid &pyr = plan->pyr;
+	double mark = stageUs ? MSNowUs() : 0;
+	int k;
+
+	MSPlanInput(plan, in);
+	MSStageLap(stageUs, MS_STAGE_INPUT, &mark);
+	MSPlanDecompose(plan);
+	MSStageLap(stageUs, MS_STAGE_DECOMPOSE, &mark);
+
+	// per level tone curve and filter, one profile sample per frame and pass
+	uint64_t toneTicks = 0, filterTicks = 0;
+	for (k = 0; k < plan->levels; k++){
+		Mat &band = pyr.bands[k];
+		const MSPowTable &tone = plan->tone[k];
+		double divider = plan->params.divider > 0 ? plan->params.divider : plan->bandMax[k];
+		double power = plan->params.lutPower[k], multiplier = plan->params.lutMultiplier[k];
+		bool exact = !(shed & MS_SHED_FAST_POW) && (k || !(shed & MS_SHED_LEVEL0));
+		float limit = exact ? MSPlanFlatLimit(plan, k, divider) : -1; //only the tables zero flat segments
+		if (divider > 0){
+			MS_PROFILE_PART(MS_PROF_TRANSFORM, k, &toneTicks);
+			ctx->pool.parallelFor(band.rows, plan->grains[k], [&](int begin, int end){
+				if (!k && (shed & MS_SHED_LEVEL0)) MSApplyTransformCoarse(band, begin, end, divider, plan->coarse0, power, multiplier);
+				else if (shed & MS_SHED_FAST_POW) MSApplyTransform(band, begin, end, divider, power, multiplier);
+				else MSPlanToneRows(plan, k, band, begin, end, divider, limit);
+			});
+		}
+		MSStageLap(stageUs, MS_STAGE_TONE, &mark);
+		if (!plan->kernels[k].empty() && !(shed & MS_SHED_FILTERS)){
+			MS_PROFILE_PART(MS_PROF_FILTERS, k, &filterTicks);
+			MSPlanFilterFlat(plan, k, band, limit);
+		}
+		MSStageLap(stageUs, MS_STAGE_FILTERS, &mark);
+	}
+	if (toneTicks) MSProfileRecord(MS_PROF_TRANSFORM, toneTicks);
+	if (filterTicks) MSProfileRecord(MS_PROF_FILTERS, filterTicks);
+
+	MSPlanReconstruct(plan, plan->levels - 1, finest, pyr.bands);
+	if (!finest) MSPlanPost(plan, pyr.gauss[0], shed);
+	MSStageLap(stageUs, MS_STAGE_RECONSTRUCT, &mark);
+}
+
+static int MSPlanCheck(const MSPlan *plan, const Mat &in, const Mat &out)
+{
+	if ((in.cols != plan->width) || (in.rows != plan->height)) return MS_ERR_INVALID_PARAMETER;
+	if (in.type() != plan->type) return MS_ERR_INVALID_TYPE;
+	if (!out.empty()){
+		if ((out.type() != CV_16UC1) && (out.type() != CV_32FC1)) return MS_ERR_INVALID_TYPE;
+		if (out.size() != in.size()) return MS_ERR_INVALID_PARAMETER;
+	}
+	return MS_OK;
+}
+
+// Unsharp mask or plain conversion of gauss[0] into out
+static void MSPlanOutput(MSPlan *plan, const Mat &in, Mat &out, int shed, double *stageUs)
+{
+	Mat &result = plan->pyr.gauss[0];
+	double mark = stageUs ? MSNowUs() : 0;
+
+	if ((plan->params.unsharp.amount != 0) && !(shed & MS_SHED_UNSHARP)){
+		MSUnsharpMask(result, out, plan->params.unsharp, plan->ctx->scratch);
+		MSStageLap(stageUs, MS_STAGE_UNSHARP, &mark);
+	}
+	else{
+		MS_PROFILE(MS_PROF_OUTPUT);
+		result.convertTo(out, out.empty() ? in.type() : out.type());
+		MSStageLap(stageUs, MS_STAGE_OUTPUT, &mark);
+	}
+}
+
+static int MSPlanRun(MSPlan *plan, const Mat &in, Mat &out, int shed, double *stageUs,
+	double *criticalPathUs, double *workUs)
+{
+	int status;
+
+	if ((status = MSPlanCheck(plan, in, out)) != MS_OK) return status;
+	if (stageUs) for (int i = 0; i < MS_STAGE_COUNT; i++) stageUs[i] = 0;
+	if (MSCountersOn()) MSCountersAddPixels((int64_t)in.total());
+	plan->cacheHash = 0; //the incremental cache shares the gauss levels
+	plan->flat = (shed & MS_SHED_FLAT) != 0;
+
+	try {
+		// shedding and stage timing need the stages one after the other,
+		// the graph tasks leave out the flat segments themselves
+		if ((plan->schedule == MS_SCHEDULE_GRAPH) && !(shed & ~MS_SHED_FLAT) && !stageUs){
+			MS_PROFILE(MS_PROF_GRAPH);
+			plan->input = &in;
+			bool ok = plan->graph.run(plan->ctx->pool, criticalPathUs, workUs);
+			plan->input = NULL;
+			if (!ok) status = MS_ERR_OPENCV;
+		}
+		else MSPlanRunLevels(plan, in, shed, stageUs, 0);
+		if (status == MS_OK) MSPlanOutput(plan, in, out, shed, stageUs);
+	}
+	catch (const cv::Exception &){
+		status = MS_ERR_OPENCV;
+	}
+
+	plan->flat = false;
+	return status;
+}
+
+bool MSPlanRetunable(const MSPlan *plan, int width, int height, int type, const MSParameters &params)
+{
+	const MSParameters &p = plan ? plan->params : params;
+
+	if (!plan || (plan->width != width) || (plan->height != height) || (plan->type != type)) return false;
+	if (plan->kernelGeneration != MSConvKernelGeneration()) return false;
+	if ((p.preprocessing != params.preprocessing) || (p.convolution != params.convolution) || (p.levels != params.levels)) return false;
+	if ((p.divider > 0) != (params.divider > 0)) return false;
+	if (plan->postPower != ((params.xValuePostProc > 0) && (params.xValuePostProc != 1.0))) return false;
+	for (int k = 0; k < plan->levels; k++)
+		if (MSGetConvKernel(params.filters[k]).size() != plan->kernels[k].size()) return false;
+	return true;
+}
+
+void MSPlanRetune(MSPlan *plan, const MSParameters &params)
+{
+	MSParameters &p = plan->params;
+
+	for (int k = 0; k < plan->levels; k++){
+		if ((p.lutPower[k] != params.lutPower[k]) || (p.lutMultiplier[k] != params.lutMultiplier[k])){
+			MSPowTableInit(plan->tone[k], params.lutPower[k], params.lutMultiplier[k]);
+			if (!k) MSCoarseTableInit(plan->coarse0, params.lutPower[0], params.lutMultiplier[0]);
+		}
+		if (p.filters[k] != params.filters[k]) plan->kernels[k] = MSGetConvKernel(params.filters[k]);
+	}
+	if (plan->postPower && (p.xValuePostProc != params.xValuePostProc)) MSPowTableInit(plan->post, params.xValuePostProc, 1.0);
+	p = params;
+}
+
+uint64_t MSImageHash(const Mat &img)
+{
+	const uint64_t prime = 0x9E3779B97F4A7C15ull;
+	size_t rowBytes = img.cols * img.elemSize(), words = rowBytes / 8;
+	uint64_t h[4] = { (uint64_t)img.cols, (uint64_t)img.rows, (uint64_t)img.type(), prime }, w;
+
+	for (int y = 0; y < img.rows; y++){
+		const uint8_t *row = img.ptr<uint8_t>(y);
+		size_t i = 0;
+
+		// four independent lanes keep the multiplier busy
+		for (; i + 4 <= words; i += 4){
+			for (int l = 0; l < 4; l++){
+				memcpy(&w, row + (i + l) * 8, 8);
+				h[l] = (h[l] ^ w) * prime;
+				h[l] ^= h[l] >> 29;
+			}
+		}
+		for (; i < words; i++){
+			memcpy(&w, row + i * 8, 8);
+			h[0] = ((h[0] ^ w) * prime) ^ (h[0] >> 29);
+		}
+		if (rowBytes % 8){
+			w = 0;
+			memcpy(&w, row + words * 8, rowBytes % 8);
+			h[1] = ((h[1] ^ w) * prime) ^ (h[1] >> 29);
+		}
+	}
+	w = h[0] ^ (h[1] * 3) ^ (h[2] * 5) ^ (h[3] * 7);
+	w = (w ^ (w >> 31)) * prime;
+	return w ? w : 1;
+}
+
+// Input and decomposition of a new frame, keeps the untouched bands
+static void MSPlanCacheFrame(MSPlan *plan, const Mat &in)
+{
+	plan->cacheHash = 0;
+	plan->tunedValid = plan->reconstructed = false;
+	MSPlanInput(plan, in);
+	MSPlanDecompose(plan);
+	plan->raw.resize(plan->levels);
+	plan->tuned.resize(plan->levels);
+	plan->rawMax.resize(plan->levels);
+	for (int k = 0; k < plan->levels; k++){
+		plan->pyr.bands[k].copyTo(plan->raw[k]);
+		plan->rawMax[k] = plan->bandMax[k];
+	}
+}
+
+// Tone curve and filter of raw into band, both the same window of level k
+// or the same Mat, divider 0 - max |coefficient| of the whole raw band.
+// Whole levels take the flat segments of the last decomposition into account
+static void MSPlanTune(MSPlan *plan, int k, const Mat &raw, Mat &band, double divider, int border)
+{
+	bool whole = raw.size() == plan->sizes[k];
+	float limit;
+
+	if (plan->params.divider > 0) divider = plan->params.divider;
+	limit = whole ? MSPlanFlatLimit(plan, k, divider) : -1;
+	if (raw.data != band.data) raw.copyTo(band);
+	if (divider > 0){
+		plan->ctx->pool.parallelFor(band.rows, plan->grains[k], [&](int begin, int end){
+			MSPlanToneRows(plan, k, band, begin, end, divider, limit);
+		});
+	}
+	if (plan->kernels[k].empty()) return;
+	if (whole) MSPlanFilterFlat(plan, k, band, limit);
+	else filter2D(band, band, -1, plan->kernels[k], Point(-1, -1), 0, border);
+}
+
+int MSPlanExecuteIncremental(MSPlan *plan, const Mat &in, Mat &out, bool *decomposed, int *retuned)
+{
+	const MSParameters &params = plan->params, &applied = plan->applied;
+	uint64_t hash;
+	int status, dirty = 0, coarsest = 0, k;
+
+	if ((status = MSPlanCheck(plan, in, out)) != MS_OK) return status;
+	if (decomposed) *decomposed = false;
+	if (retuned) *retuned = 0;
+	if (MSCountersOn()) MSCountersAddPixels((int64_t)in.total());
+	hash = MSImageHash(in);
+
+	try {
+		// without levels gauss[0] holds the post power of the last frame
+		if ((hash != plan->cacheHash) || !plan->levels){
+			MSPlanCacheFrame(plan, in);
+			if (decomposed) *decomposed = true;
+		}
+		plan->cacheHash = 0;
+		for (k = 0; k < plan->levels; k++){
+			if (!plan->tunedValid || (params.lutPower[k] != applied.lutPower[k]) ||
+				(params.lutMultiplier[k] != applied.lutMultiplier[k]) ||
+				(params.filters[k] != applied.filters[k]) || (params.divider != applied.divider)) dirty |= 1 << k;
+		}
+
+		// tone curve and filter of the changed levels, from the untouched bands
+		{
+			MS_PROFILE(MS_PROF_TRANSFORM);
+			for (k = 0; k < plan->levels; k++){
+				if (!(dirty & (1 << k))) continue;
+				MSPlanTune(plan, k, plan->raw[k], plan->tuned[k], plan->rawMax[k], BORDER_REFLECT_101);
+				coarsest = k;
+			}
+		}
+
+		// level 0 always, its post power is applied in place
+		if (!plan->reconstructed) coarsest = plan->levels - 1;
+		if (plan->levels) MSPlanReconstruct(plan, coarsest, 0, plan->tuned);
+		MSPlanPost(plan, plan->pyr.gauss[0], 0);
+		MSPlanOutput(plan, in, out, 0, NULL);
+	}
+	catch (const cv::Exception &){
+		return MS_ERR_OPENCV;
+	}
+
+	plan->applied = params;
+	plan->tunedValid = plan->reconstructed = true;
+	plan->cacheHash = hash;
+	if (retuned) *retuned = dirty;
+	return MS_OK;
+}
+
+// Parameter sets whose tone curves share one pass over the raw bands, bounds
+// the tuned band buffers of a sweep to this many pyramids
+#define MS_SWEEP_GROUP 4
+
+int MSPlanExecuteSweep(MSPlan *plan, const Mat &in, Mat *out, const MSParameters *params, int count,
+	MSSweepStats *stats)
+{
+	const MSParameters &p = plan->params;
+	int group = std::min(count, MS_SWEEP_GROUP), status, g, n, i, k;
+	std::vector<std::vector<Mat> > bands(group);
+	std::vector<MSPowTable> tone(group * plan->levels), post(group);
+	std::vector<const MSPowTable *> tables(group);
+	std::vector<Mat> dst(group);
+	std::vector<double> divider(group);
+	bool decomposed = false;
+	double start, mark;
+	uint64_t hash;
+
+	if (stats) memset(stats, 0, sizeof(MSSweepStats));
+	if (count <= 0) return MS_ERR_INVALID_PARAMETER;
+	for (i = 0; i < count; i++){
+		if ((status = MSPlanCheck(plan, in, out[i])) != MS_OK) return status;
+		if ((params[i].preprocessing != p.preprocessing) || (params[i].convolution != p.convolution) ||
+			(params[i].levels != p.levels)) return MS_ERR_INVALID_PARAMETER;
+	}
+	if (MSCountersOn()) MSCountersAddPixels((int64_t)in.total() * count);
+	hash = MSImageHash(in);
+	start = mark = MSNowUs();
+
+	try {
+		if ((hash != plan->cacheHash) || !plan->levels){
+			MSPlanCacheFrame(plan, in);
+			decomposed = true;
+		}
+		mark = MSNowUs();
+		plan->cacheHash = 0;
+		plan->reconstructed = false;
+		for (i = 0; i < group; i++){
+			bands[i].resize(plan->levels);
+			for (k = 0; k < plan->levels; k++) bands[i][k].create(plan->sizes[k], CV_32FC1);
+		}
+
+		for (g = 0; g < count; g += group){
+			const MSParameters *set = params + g;
+			n = std::min(group, count - g);
+
+			for (i = 0; i < n; i++){
+				for (k = 0; k < plan->levels; k++) MSPowTableInit(tone[i * plan->levels + k], set[i].lutPower[k], set[i].lutMultiplier[k]);
+				if ((set[i].xValuePostProc > 0) && (set[i].xValuePostProc != 1.0)) MSPowTableInit(post[i], set[i].xValuePostProc, 1.0);
+			}
+
+			// tone curves of the whole group, raw rows stay in cache across the sets
+			{
+				MS_PROFILE(MS_PROF_TRANSFORM);
+				for (k = 0; k < plan->levels; k++){
+					int active = 0;
+					for (i = 0; i < n; i++){
+						double d = set[i].divider > 0 ? set[i].divider : plan->rawMax[k];
+						if (!(d > 0)){
+							plan->raw[k].copyTo(bands[i][k]);
+							continue;
+						}
+						dst[active] = bands[i][k];
+						divider[active] = d;
+						tables[active++] = &tone[i * plan->levels + k];
+					}
+					if (!active) continue;
+					plan->ctx->pool.parallelFor(plan->sizes[k].height, plan->grains[k], [&](int begin, int end){
+						MSApplyTransformTableMulti(plan->raw[k], dst.data(), active, begin, end, divider.data(), tables.data());
+					});
+				}
+			}
+
+			for (i = 0; i < n; i++){
+				Mat &result = plan->pyr.gauss[0];
+				{
+					MS_PROFILE(MS_PROF_FILTERS);
+					for (k = 0; k < plan->levels; k++){
+						Mat kernel = MSGetConvKernel(set[i].filters[k]);
+						if (!kernel.empty()) filter2D(bands[i][k], bands[i][k], -1, kernel, Point(-1, -1), 0, BORDER_REFLECT_101);
+					}
+				}
+				if (plan->levels) MSPlanReconstruct(plan, plan->levels - 1, 0, bands[i]);
+				else if (i || g) MSPlanInput(plan, in);
+				if ((set[i].xValuePostProc > 0) && (set[i].xValuePostProc != 1.0)){
+					MS_PROFILE(MS_PROF_POST);
+					plan->ctx->pool.parallelFor(result.rows, plan->grains[0], [&](int begin, int end){
+						MSApplyPowerTable(result, begin, end, post[i]);
+					});
+				}
+				if (set[i].unsharp.amount != 0) MSUnsharpMask(result, out[g + i], set[i].unsharp, plan->ctx->scratch);
+				else{
+					MS_PROFILE(MS_PROF_OUTPUT);
+					result.convertTo(out[g + i], out[g + i].empty() ? in.type() : out[g + i].type());
+				}
+			}
+		}
+	}
+	catch (const cv::Exception &){
+		return MS_ERR_OPENCV;
+	}
+
+	// raw stays valid, tuned was not touched
+	plan->cacheHash = hash;
+	if (stats){
+		stats->count = count;
+		stats->decomposed = decomposed ? 1 : 0;
+		stats->decomposeUs = mark - start;
+		stats->sweepUs = MSNowUs() - mark;
+		stats->perSetUs = stats->sweepUs / count;
+	}
+	return MS_OK;
+}
+
+static Rect MSWindowExpand(const Rect &window, int halo, const Size &size)
+{
+	return Rect(window.x - halo, window.y - halo, window.width + 2 * halo, window.height + 2 * halo) & Rect(Point(0, 0), size);
+}
+
+// Level k source of the pyrDown of the level k + 1 window, even start and a
+// halo past the end as in MSTileDown, in both directions
+static Rect MSWindowDown(const MSPlan *plan, int k, const Rect &coarse)
+{
+	const Size &size = plan->sizes[k];
+	int x0 = std::max(0, 2 * coarse.x - MS_TILE_HALO), x1 = std::min(size.width, 2 * (coarse.x + coarse.width) + MS_TILE_HALO);
+	int y0 = std::max(0, 2 * coarse.y - MS_TILE_HALO), y1 = std::min(size.height, 2 * (coarse.y + coarse.height) + MS_TILE_HALO);
+
+	return Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Level k + 1 source of the pyrUp of the level k window, as MSTileUpRows
+static Rect MSWindowUpSource(const MSPlan *plan, int k, const Rect &fine)
+{
+	const Size &size = plan->sizes[k + 1];
+	int x0 = std::max(0, fine.x / 2 - 2), x1 = std::min(size.width, (fine.x + fine.width + 1) / 2 + 2);
+	int y0 = std::max(0, fine.y / 2 - 2), y1 = std::min(size.height, (fine.y + fine.height + 1) / 2 + 2);
+
+	return Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Rows and columns of the level k window from the pyrUp of the level k + 1
+// source window, the odd last row or column of level k comes with the last one
+static Mat MSWindowUpRun(MSPlan *plan, int k, const Rect &source, const Rect &fine, Mat &tile)
+{
+	const Size &size = plan->sizes[k + 1], &full = plan->sizes[k];
+
+	pyrUp(plan->pyr.gauss[k + 1](source), tile, Size(source.x + source.width == size.width ? full.width - 2 * source.x : 2 * source.width,
+		source.y + source.height == size.height ? full.height - 2 * source.y : 2 * source.height));
+	return tile(fine - 2 * source.tl());
+}
+
+void MSPlanROIWindows(const MSPlan *plan, const Rect &roi, std::vector<Rect> &windows)
+{
+	windows.resize(plan->levels + 1);
+	windows[0] = MSWindowExpand(roi, MS_ROI_HALO, plan->sizes[0]);
+	for (int k = 0; k < plan->levels; k++) windows[k + 1] = MSWindowUpSource(plan, k, windows[k]);
+}
+
+// With a fixed divider nothing of the tone curves depends on the whole band,
+// so only what the windows read is decomposed: the bands on areas (the
+// windows plus the filter halo), the gauss levels they and the pyrUp/pyrDown
+// sources need, and the input under the finest of them. The results equal
+// the ones of the whole frame on areas, windows[levels] is left in gauss
+static void MSPlanDecomposeWindows(MSPlan *plan, const Mat &in, const std::vector<Rect> &areas, const Rect &coarsest)
+{
+	MSPyramid &pyr = plan->pyr;
+	const MSIngest *ingest = MSPlanIngest(plan, in);
+	std::vector<Rect> need(plan->levels + 1);
+	int k;
+
+	plan->tunedValid = plan->reconstructed = false;
+	need[plan->levels] = coarsest;
+	if (plan->levels) need[plan->levels] |= MSWindowUpSource(plan, plan->levels - 1, areas[plan->levels - 1]);
+	for (k = plan->levels - 1; k >= 0; k--){
+		need[k] = areas[k] | MSWindowDown(plan, k, need[k + 1]);
+		if (k) need[k] |= MSWindowUpSource(plan, k - 1, areas[k - 1]);
+	}
+
+	{
+		MS_PROFILE(MS_PROF_INPUT);
+		const Rect &w = need[0];
+		if (ingest){
+			plan->ctx->pool.parallelFor(w.height, plan->grains[0], [&](int begin, int end){
+				MSIngestRows(ingest, in, pyr.gauss[0], w.y + begin, w.y + end, plan->preKernel);
+			});
+		}
+		else if (plan->preKernel.empty()){
+			Mat dst = pyr.gauss[0](w);
+			in(w).convertTo(dst, CV_32FC1);
+		}
+		else{
+			// the kernel halo is real inside the frame, reflected at its edges
+			Rect source = MSWindowExpand(w, plan->preKernel.rows / 2, plan->sizes[0]);
+			Mat tile;
+			in(source).convertTo(tile, CV_32FC1);
+			filter2D(tile, tile, -1, plan->preKernel, Point(-1, -1), 0, BORDER_REFLECT_101);
+			tile(w - source.tl()).copyTo(pyr.gauss[0](w));
+		}
+	}
+
+	for (k = 0; k < plan->levels; k++){
+		MS_PROFILE(MS_PROF_DECOMPOSE + k);
+		const Size &fine = plan->sizes[k], &size = plan->sizes[k + 1];
+		Rect s = MSWindowDown(plan, k, need[k + 1]), a = MSWindowUpSource(plan, k, areas[k]);
+		Mat tile;
+
+		pyrDown(pyr.gauss[k](s), tile, Size(s.x + s.width == fine.width ? size.width - s.x / 2 : s.width / 2,
+			s.y + s.height == fine.height ? size.height - s.y / 2 : s.height / 2));
+		tile(need[k + 1] - Point(s.x / 2, s.y / 2)).copyTo(pyr.gauss[k + 1](need[k + 1]));
+
+		// a whole level goes the usual way, the flat segments of its tone pass need segMax
+		if (areas[k].size() == fine){
+			pyrUp(pyr.gauss[k + 1], pyr.up[k], fine);
+			MSPlanBand(plan, k);
+			continue;
+		}
+		subtract(pyr.gauss[k](areas[k]), MSWindowUpRun(plan, k, a, areas[k], tile), pyr.bands[k](areas[k]));
+	}
+}
+
+int MSPlanExecuteROI(MSPlan *plan, const Mat &in, Mat &out, const Rect &roi, bool *decomposed)
+{
+	MSPyramid &pyr = plan->pyr;
+	std::vector<Rect> windows, areas(plan->levels);
+	uint64_t hash;
+	bool windowed = false;
+	int status, k;
+
+	if ((status = MSPlanCheck(plan, in, Mat())) != MS_OK) return status;
+	if (roi.empty() || ((roi & Rect(0, 0, plan->width, plan->height)) != roi)) return MS_ERR_INVALID_PARAMETER;
+	if (!out.empty()){
+		if ((out.type() != CV_16UC1) && (out.type() != CV_32FC1)) return MS_ERR_INVALID_TYPE;
+		if (out.size() != roi.size()) return MS_ERR_INVALID_PARAMETER;
+	}
+	if (decomposed) *decomposed = false;
+	if (MSCountersOn()) MSCountersAddPixels((int64_t)roi.area());
+	hash = MSImageHash(in);
+
+	MSPlanROIWindows(plan, roi, windows);
+	for (k = 0; k < plan->levels; k++) areas[k] = MSWindowExpand(windows[k], plan->kernels[k].rows / 2, plan->sizes[k]);
+
+	try {
+		if ((hash != plan->cacheHash) || !plan->levels){
+			// the adaptive divider is the max of the whole band, the frame is
+			// decomposed and cached, a fixed one needs only the windows
+			windowed = plan->params.divider > 0;
+			if (windowed) MSPlanDecomposeWindows(plan, in, areas, windows[plan->levels]);
+			else MSPlanCacheFrame(plan, in);
+			if (decomposed) *decomposed = true;
+		}
+		plan->cacheHash = 0;
+		plan->reconstructed = false;
+
+		// tone curves and filters on the windows plus the filter halo,
+		// isolated since the bands around them are stale
+		{
+			MS_PROFILE(MS_PROF_TRANSFORM);
+			for (k = 0; k < plan->levels; k++){
+				Mat band = pyr.bands[k](areas[k]);
+				if (windowed) MSPlanTune(plan, k, band, band, 0, BORDER_REFLECT_101 | BORDER_ISOLATED);
+				else MSPlanTune(plan, k, plan->raw[k](areas[k]), band, plan->rawMax[k], BORDER_REFLECT_101 | BORDER_ISOLATED);
+			}
+		}
+
+		{
+			MS_PROFILE(MS_PROF_RECONSTRUCT);
+			for (k = plan->levels - 1; k >= 0; k--){
+				Mat tile, gauss = pyr.gauss[k](windows[k]);
+				add(pyr.bands[k](windows[k]), MSWindowUpRun(plan, k, windows[k + 1], windows[k], tile), gauss);
+			}
+		}
+
+		Mat result = pyr.gauss[0](windows[0]);
+		Rect inner = roi - windows[0].tl();
+		MSPlanPost(plan, result, 0);
+		if (plan->params.unsharp.amount != 0){
+			Mat sharp(result.size(), out.empty() ? in.type() : out.type());
+			MSUnsharpMask(result, sharp, plan->params.unsharp, plan->ctx->scratch);
+			sharp(inner).copyTo(out);
+		}
+		else{
+			MS_PROFILE(MS_PROF_OUTPUT);
+			result(inner).convertTo(out, out.empty() ? in.type() : out.type());
+		}
+	}
+	catch (const cv::Exception &){
+		return MS_ERR_OPENCV;
+	}
+
+	plan->cacheHash = windowed ? 0 : hash; //a windowed frame is not cached
+	return MS_OK;
+}
+
+// Reconstructed level k with post power, upsampled into out for display
+static void MSPlanPreview(MSPlan *plan, int k, Mat &out, double start, MSPreviewCallback callback, void *user)
+{
+	MSPreviewInfo info;
+	Mat level;
+
+	plan->pyr.gauss[k].copyTo(level);
+	MSPlanPost(plan, level, 0);
+	level.convertTo(level, out.type());
+	resize(level, out, out.size(), 0, 0, INTER_LINEAR);
+
+	info.level = k;
+	info.width = plan->sizes[k].width;
+	info.height = plan->sizes[k].height;
+	info.elapsedUs = MSNowUs() - start;
+	callback(&info, out, user);
+}
+
+int MSPlanExecuteProgressive(MSPlan *plan, const Mat &in, Mat &out, int previewLevel,
+	MSPreviewCallback callback, void *user)
+{
+	MSPyramid &pyr = plan->pyr;
+	double start = MSNowUs();
+	uint64_t toneTicks = 0; //one profile sample per frame
+	int status, p, k;
+	Mat saved;
+
+	if ((status = MSPlanCheck(plan, in, out)) != MS_OK) return status;
+	if (MSCountersOn()) MSCountersAddPixels((int64_t)in.total());
+	plan->cacheHash = 0;
+	p = std::min(std::max(previewLevel, 1), plan->levels);
+
+	try {
+		if (out.empty()) out.create(in.size(), in.type());
+		MSPlanInput(plan, in);
+
+		// all gaussian levels, bands only from the preview level on
+		for (k = 0; k < plan->levels; k++){
+			MS_PROFILE(MS_PROF_DECOMPOSE + k);
+			pyrDown(pyr.gauss[k], pyr.gauss[k + 1], plan->sizes[k + 1]);
+			if (k < p) continue;
+			pyrUp(pyr.gauss[k + 1], pyr.up[k], plan->sizes[k]);
+			MSPlanBand(plan, k);
+		}
+		for (k = p; k < plan->levels; k++){
+			MS_PROFILE_PART(MS_PROF_TRANSFORM, k, &toneTicks);
+			MSPlanTune(plan, k, pyr.bands[k], pyr.bands[k], plan->bandMax[k], BORDER_REFLECT_101);
+		}
+
+		// the reconstruction overwrites the gaussian level the next band needs
+		if (p) pyr.gauss[p].copyTo(saved);
+		if (p < plan->levels) MSPlanReconstruct(plan, plan->levels - 1, p, pyr.bands);
+		if (p && callback) MSPlanPreview(plan, p, out, start, callback, user);
+
+		// one level finer per refinement
+		for (k = p - 1; k >= 0; k--){
+			{
+				MS_PROFILE(MS_PROF_DECOMPOSE + k);
+				pyrUp(saved, pyr.up[k], plan->sizes[k]);
+				MSPlanBand(plan, k);
+			}
+			{
+				MS_PROFILE_PART(MS_PROF_TRANSFORM, k, &toneTicks);
+				MSPlanTune(plan, k, pyr.bands[k], pyr.bands[k], plan->bandMax[k], BORDER_REFLECT_101);
+			}
+			if (k) pyr.gauss[k].copyTo(saved);
+			MSPlanReconstruct(plan, k, k, pyr.bands);
+			if (k && callback) MSPlanPreview(plan, k, out, start, callback, user);
+		}
+		if (toneTicks) MSProfileRecord(MS_PROF_TRANSFORM, toneTicks);
+
+		MSPlanPost(plan, pyr.gauss[0], 0);
+		MSPlanOutput(plan, in, out, 0, NULL);
+	}
+	catch (const cv::Exception &){
+		return MS_ERR_OPENCV;
+	}
+
+	if (callback){
+		MSPreviewInfo info = { 0, plan->width, plan->height, MSNowUs() - start };
+		callback(&info, out, user);
+	}
+	return MS_OK;
+}
+
+void MSTileMaskBuild(const Mat &level, int tile, double flatness, MSTileMask &mask)
+{
+	double lo, hi, limit;
+
+	minMaxLoc(level, &lo, &hi);
+	limit = flatness * (hi - lo);
+	mask.cols = (level.cols + tile - 1) / tile;
+	mask.rows = (level.rows + tile - 1) / tile;
+	mask.dead.assign(mask.cols * mask.rows, 0);
+	mask.deadTiles = 0;
+	for (int ty = 0; ty < mask.rows; ty++){
+		for (int tx = 0; tx < mask.cols; tx++){
+			Rect window = MSWindowExpand(Rect(tx * tile, ty * tile, tile, tile), MS_MASK_HALO, level.size());
+			minMaxLoc(level(window), &lo, &hi);
+			if (hi - lo <= limit){
+				mask.dead[ty * mask.cols + tx] = 1;
+				mask.deadTiles++;
+			}
+		}
+	}
+}
+
+// Calls fn(span, dead) for the runs of dead and live tiles in mask row ty,
+// as windows of a level of size with tiles of tile pixels. The last tile
+// row and column take the odd remainder of the finer levels
+template <class F> static void MSMaskSpans(const MSTileMask &mask, int ty, int tile, const Size &size, F fn)
+{
+	const uint8_t *dead = &mask.dead[ty * mask.cols];
+	int y0 = ty * tile, y1 = ty + 1 == mask.rows ? size.height : y0 + tile, t0, t1;
+
+	for (t0 = 0; t0 < mask.cols; t0 = t1){
+		for (t1 = t0 + 1; (t1 < mask.cols) && (dead[t1] == dead[t0]); t1++);
+		int x0 = t0 * tile, x1 = t1 == mask.cols ? size.width : t1 * tile;
+		fn(Rect(x0, y0, x1 - x0, y1 - y0), dead[t0] != 0);
+	}
+}
+
+// Tone curve of the live tiles of level k, dead ones are zeroed. Returns
+// the band to reconstruct from, the filtered copy if the level has a filter.
+// The tone and filter ticks are added to ticks[0] and ticks[1]
+static Mat MSPlanTuneMasked(MSPlan *plan, int k, const MSTileMask &mask, int64_t *skipped, uint64_t ticks[2])
+{
+	Mat &band = plan->pyr.bands[k], filtered;
+	const Mat &kernel = plan->kernels[k];
+	double divider = plan->params.divider > 0 ? plan->params.divider : plan->bandMax[k];
+	int tile = MS_MASK_TILE >> k;
+
+	for (int ty = 0; ty < mask.rows; ty++)
+		MSMaskSpans(mask, ty, tile, band.size(), [&](const Rect &span, bool dead){ if (dead) *skipped += span.area(); });
+
+	{
+		MS_PROFILE_PART(MS_PROF_TRANSFORM, k, &ticks[0]);
+		plan->ctx->pool.parallelFor(mask.rows, 1, [&](int begin, int end){
+			for (int ty = begin; ty < end; ty++){
+				MSMaskSpans(mask, ty, tile, band.size(), [&](const Rect &span, bool dead){
+					Mat window = band(span);
+					if (dead) window = Scalar(0);
+					else if (divider > 0) MSApplyTransformTable(window, 0, window.rows, divider, plan->tone[k]);
+				});
+			}
+		});
+	}
+	if (kernel.empty()) return band;
+
+	// the live windows read their neighbours, so the filter cannot run in place
+	MS_PROFILE_PART(MS_PROF_FILTERS, k, &ticks[1]);
+	filtered.create(band.size(), CV_32FC1);
+	plan->ctx->pool.parallelFor(mask.rows, 1, [&](int begin, int end){
+		for (int ty = begin; ty < end; ty++){
+			MSMaskSpans(mask, ty, tile, band.size(), [&](const Rect &span, bool dead){
+				if (dead){
+					filtered(span) = Scalar(0);
+					return;
+				}
+				Rect area = MSWindowExpand(span, kernel.rows / 2, band.size());
+				Mat tmp;
+				filter2D(band(area), tmp, -1, kernel, Point(-1, -1), 0, BORDER_REFLECT_101 | BORDER_ISOLATED);
+				tmp(span - area.tl()).copyTo(filtered(span));
+			});
+		}
+	});
+	return filtered;
+}
+
+int MSPlanExecuteMasked(MSPlan *plan, const Mat &in, Mat &out, double flatness, MSMaskStats *stats)
+{
+	MSPyramid &pyr = plan->pyr;
+	std::vector<Mat> bands(plan->levels);
+	MSTileMask mask;
+	int64_t skipped = 0, total = 0;
+	uint64_t ticks[2] = { 0, 0 }; //tone and filters, one profile sample per frame
+	int status, m, k;
+
+	if (stats) memset(stats, 0, sizeof(MSMaskStats));
+	if ((status = MSPlanCheck(plan, in, out)) != MS_OK) return status;
+	if (!(flatness > 0)) flatness = MS_MASK_FLATNESS;
+	if (MSCountersOn()) MSCountersAddPixels((int64_t)in.total());
+	plan->cacheHash = 0;
+
+	try {
+		MSPlanInput(plan, in);
+		MSPlanDecompose(plan);
+
+		// tiles are MS_MASK_TILE >> m pixels on the detection level, coarser
+		// levels are too small to be worth masking
+		m = std::min(MS_MASK_LEVEL, plan->levels);
+		MSTileMaskBuild(pyr.gauss[m], MS_MASK_TILE >> m, flatness, mask);
+		for (k = 0; k < plan->levels; k++){
+			int64_t dead = 0;
+			if (k <= m) bands[k] = MSPlanTuneMasked(plan, k, mask, &dead, ticks);
+			else{
+				MS_PROFILE_PART(MS_PROF_TRANSFORM, k, &ticks[0]);
+				MSPlanTune(plan, k, pyr.bands[k], pyr.bands[k], plan->bandMax[k], BORDER_REFLECT_101);
+				bands[k] = pyr.bands[k];
+			}
+			skipped += dead * (plan->kernels[k].empty() ? 1 : 2);
+			total += (int64_t)plan->sizes[k].area() * (plan->kernels[k].empty() ? 1 : 2);
+		}
+		if (ticks[0]) MSProfileRecord(MS_PROF_TRANSFORM, ticks[0]);
+		if (ticks[1]) MSProfileRecord(MS_PROF_FILTERS, ticks[1]);
+
+		if (plan->levels) MSPlanReconstruct(plan, plan->levels - 1, 0, bands);
+		MSPlanPost(plan, pyr.gauss[0], 0);
+		MSPlanOutput(plan, in, out, 0, NULL);
+	}
+	catch (const cv::Exception &){
+		return MS_ERR_OPENCV;
+	}
+
+	if (stats){
+		stats->tiles = mask.cols * mask.rows;
+		stats->deadTiles = mask.deadTiles;
+		stats->skipped = total ? (double)skipped / total : 0;
+	}
+	return MS_OK;
+}
+
+int MSPlanExecuteDisplay(MSPlan *plan, const Mat &in, Mat &out, const MSDisplayParams &display)
+{
+	MSPyramid &pyr = plan->pyr;
+	MSDisplayTable table;
+	bool sharpen = plan->params.unsharp.amount != 0;
+	int status;
+
+	if ((status = MSPlanCheck(plan, in, Mat())) != MS_OK) return status;
+	if (!(display.width > 0)) return MS_ERR_INVALID_PARAMETER;
+	if (!out.empty()){
+		if ((out.type() != CV_8UC1) && (out.type() != CV_16UC1)) return MS_ERR_INVALID_TYPE;
+		if (out.size() != in.size()) return MS_ERR_INVALID_PARAMETER;
+	}
+	if (MSCountersOn()) MSCountersAddPixels((int64_t)in.total());
+	plan->cacheHash = 0;
+
+	try {
+		if (out.empty()) out.create(in.size(), CV_8UC1);
+		double maxOut = out.type() == CV_8UC1 ? 255 : 65535;
+
+		// the unsharp mask needs the whole result, the table then only windows it
+		MSPlanRunLevels(plan, in, 0, NULL, sharpen ? 0 : 1);
+		if (sharpen){
+			Mat sharp(in.size(), CV_32FC1);
+			MSUnsharpMask(pyr.gauss[0], sharp, plan->params.unsharp, plan->ctx->scratch);
+			MSDisplayTableInit(table, display, 0, maxOut);
+			MS_PROFILE(MS_PROF_OUTPUT);
+			plan->ctx->pool.parallelFor(out.rows, plan->grains[0], [&](int begin, int end){
+				Mat dst = out.rowRange(begin, end);
+				MSApplyDisplay(sharp.rowRange(begin, end), NULL, dst, table);
+			});
+		}
+		else{
+			// level 0 as band plus pyrUp tile straight into the display rows
+			MSDisplayTableInit(table, display, plan->postPower ? plan->params.xValuePostProc : 0, maxOut);
+			MS_PROFILE(MS_PROF_OUTPUT);
+			plan->ctx->pool.parallelFor(out.rows, plan->grains[0], [&](int begin, int end){
+				Mat dst = out.rowRange(begin, end), tile;
+				if (!plan->levels) MSApplyDisplay(pyr.gauss[0].rowRange(begin, end), NULL, dst, table);
+				else{
+					Mat up = MSTileUp(plan, 0, begin, end, tile);
+					MSApplyDisplay(pyr.bands[0].rowRange(begin, end), &up, dst, table);
+				}
+			});
+		}
+	}
+	catch (const cv::Exception &){
+		return MS_ERR_OPENCV;
+	}
+
+	return MS_OK;
+}
+
+int MSPlanExecute(MSPlan *plan, const Mat &in, Mat &out)
+{
+	return MSPlanRun(plan, in, out, 0, NULL, NULL, NULL);
+}
+
+int MSPlanExecuteShed(MSPlan *plan, const Mat &in, Mat &out, int shed, double stageUs[MS_STAGE_COUNT])
+{
+	return MSPlanRun(plan, in, out, shed, stageUs, NULL, NULL);
+}
+
+int MSPlanBenchmark(MSContext *ctx, int width, int height, int type, const MSParameters &params,
+	int iterations, double *replanUs, double *executeUs)
+{
+	MSPlan *plan;
+	Mat in, out;
+	double t0;
+	int status = MS_OK;
+
+	if (iterations <= 0) iterations = 100;
+	if ((type != CV_16UC1) && (type != CV_32FC1)) return MS_ERR_INVALID_TYPE;
+
+	in.create(height, width, type);
+	randu(in, 0, type == CV_16UC1 ? 4096 : 1);
+
+	// planning every frame, as MultiscaleProcess without a plan cache would
+	t0 = MSNowUs();
+	for (int i = 0; (i < iterations) && (status == MS_OK); i++){
+		if (!(plan = MSPlanCreate(ctx, width, height, type, params, &status))) return status;
+		status = MSPlanExecute(plan, in, out);
+		MSPlanDestroy(plan);
+	}
+	*replanUs = (MSNowUs() - t0) / iterations;
+
+	if (!(plan = MSPlanCreate(ctx, width, height, type, params, &status))) return status;
+	status = MSPlanExecute(plan, in, out); //warm up
+	t0 = MSNowUs();
+	for (int i = 0; (i < iterations) && (status == MS_OK); i++) status = MSPlanExecute(plan, in, out);
+	*executeUs = (MSNowUs() - t0) / iterations;
+	MSPlanDestroy(plan);
+
+	return status;
+}
+
+int MSPlanScheduleBenchmark(MSContext *ctx, int width, int height, int type, const MSParameters &params,
+	int iterations, double *levelsUs, double *graphUs, double *criticalPathUs, double *workUs)
+{
+	MSPlan *plan;
+	Mat in, out;
+	double t0;
+	int status = MS_OK;
+
+	if (iterations <= 0) iterations = 100;
+	if ((type != CV_16UC1) && (type != CV_32FC1)) return MS_ERR_INVALID_TYPE;
+
+	in.create(height, width, type);
+	randu(in, 0, type == CV_16UC1 ? 4096 : 1);
+	if (!(plan = MSPlanCreate(ctx, width, height, type, params, &status))) return status;
+
+	plan->schedule = MS_SCHEDULE_LEVELS;
+	status = MSPlanExecute(plan, in, out); //warm up
+	t0 = MSNowUs();
+	for (int i = 0; (i < iterations) && (status == MS_OK); i++) status = MSPlanExecute(plan, in, out);
+	*levelsUs = (MSNowUs() - t0) / iterations;
+
+	*graphUs = *criticalPathUs = *workUs = 0;
+	if (plan->graph.size() && (status == MS_OK)){
+		plan->schedule = MS_SCHEDULE_GRAPH;
+		status = MSPlanRun(plan, in, out, 0, NULL, criticalPathUs, workUs);
+		t0 = MSNowUs();
+		for (int i = 0; (i < iterations) && (status == MS_OK); i++) status = MSPlanExecute(plan, in, out);
+		*graphUs = (MSNowUs() - t0) / iterations;
+	}
+	MSPlanDestroy(plan);
+
+	return status;
+}
@@ -0,0 +1,188 @@
+//==============================================================================
+//
+// Title:       Plan
+// Purpose:     Plan/execute API for repeated same-geometry processing.
+//
+//              A plan is created once for (width, height, type, parameters)
+//              and precomputes level layout, tone-curve tables, kernels,
+//              thread partitioning and buffers, so executing it per frame
+//              only does arithmetic.
+//
+//==============================================================================
+
+#ifndef __Plan_H__
+#define __Plan_H__
+
+#include <stdint.h>
+#include <vector>
+#include "opencv2/core.hpp"
+#include "Multiscale.h"
+#include "Pipeline.h"
+#include "TaskGraph.h"
+
+struct MSContext;
+
+// Work dropped by the deadline mode, in the order it is shed
+enum MSShed {
+	MS_SHED_UNSHARP = 1,     // no unsharp mask
+	MS_SHED_FILTERS = 2,     // no per-level filter kernels
+	MS_SHED_FAST_POW = 4,    // Schraudolph pow instead of the tables
+	MS_SHED_LEVEL0 = 8,      // level 0 tone curve from a coarse table
+	MS_SHED_FLAT = 16        // bands the tone curve maps to almost 0 are set to 0, not filtered
+};
+
+// Stages timed by MSPlanExecuteShed
+enum MSStage {
+	MS_STAGE_INPUT = 0,      // conversion and preprocessing
+	MS_STAGE_DECOMPOSE,
+	MS_STAGE_TONE,
+	MS_STAGE_FILTERS,
+	MS_STAGE_RECONSTRUCT,    // including the post power
+	MS_STAGE_UNSHARP,
+	MS_STAGE_OUTPUT,         // conversion when there is no unsharp mask
+	MS_STAGE_COUNT
+};
+
+enum MSSchedule {
+	MS_SCHEDULE_LEVELS = 0,  // level after level, rows split across threads
+	MS_SCHEDULE_GRAPH        // tile task graph across levels, work stealing
+};
+
+struct MSPlan {
+	MSContext *ctx;             //threads and unsharp scratch, must outlive the plan
+	int width, height, type;
+	int levels;
+	MSParameters params;
+
+	std::vector<cv::Size> sizes; //sizes[0] - input, sizes[levels] - residual
+	std::vector<int> grains;     //rows per parallel chunk of every level
+	std::vector<MSPowTable> tone;
+	MSPowTable post;
+	bool postPower;
+
+	cv::Mat preKernel;           //empty - no preprocessing
+	std::vector<cv::Mat> kernels;//empty - no filter on the level
+	uint64_t kernelGeneration;   //MSConvKernelGeneration the kernels were taken at
+
+	MSPyramid pyr;
+
+	int schedule;                //MSSchedule, graph when the context has threads to spare
+	std::vector<std::vector<int> > strips;    //tile row starts of every level, last entry is the height
+	std::vector<std::vector<double> > tileMax;//max |coefficient| of every band tile
+	std::vector<cv::Mat> segMax; //max |coefficient| of every MS_FLAT_SEGMENT pixels of every band row
+	std::vector<double> bandMax; //max |coefficient| of every band, from segMax
+	MSTaskGraph graph;
+	std::vector<cv::Mat> tiles;  //pyrDown/pyrUp scratch of the graph tasks
+	const cv::Mat *input;        //frame of the running graph
+
+	std::vector<float> coarse0;  //level 0 tone curve for MS_SHED_LEVEL0
+	double stageCost[MS_STAGE_COUNT]; //running averages of the deadline mode, 0 - not measured yet
+	double toneCost[3];          //tone stage with tables, fast pow, fast pow and coarse level 0
+	double graphCost;            //whole frame in the graph schedule, which is not timed per stage
+
+	// incremental re-render, every other execute drops it since it shares the gauss levels
+	uint64_t cacheHash;          //content hash of the decomposed frame, 0 - nothing cached
+	MSParameters applied;        //parameters of tuned and the reconstructed gauss levels
+	bool tunedValid;             //tuned belongs to the cached frame
+	bool reconstructed;          //gauss levels hold the reconstruction of tuned, not of a viewport
+	bool flat;                   //MS_SHED_FLAT in the running frame, off by default
+	std::vector<cv::Mat> raw;    //bands before the tone curve
+	std::vector<cv::Mat> tuned;  //bands after tone curve and filter
+	std::vector<double> rawMax;  //max |coefficient| of every raw band
+};
+
+// type is CV_16UC1 or CV_32FC1, returns NULL and sets status on failure
+MSPlan* MSPlanCreate(MSContext *ctx, int width, int height, int type, const MSParameters &params, int *status);
+void MSPlanDestroy(MSPlan *plan);
+
+bool MSPlanMatches(const MSPlan *plan, int width, int height, int type, const MSParameters &params);
+bool MSParametersEqual(const MSParameters &a, const MSParameters &b);
+
+// Parameter changes that keep the decomposition and the tile graph: tone curves,
+// filters of the same kernel size, post power of the same presence, divider
+// of the same kind, unsharp mask
+bool MSPlanRetunable(const MSPlan *plan, int width, int height, int type, const MSParameters &params);
+// Takes over such a change, only the tables of changed levels are rebuilt
+void MSPlanRetune(MSPlan *plan, const MSParameters &params);
+
+// in must match the plan, out U16 or SGL of the same size (created if empty)
+int MSPlanExecute(MSPlan *plan, const cv::Mat &in, cv::Mat &out);
+
+// Same result, keeps the decomposition keyed by the content hash of in. For
+// the same frame only levels whose tone curve or filter changed are redone,
+// and the reconstruction from the coarsest of them. decomposed and retuned
+// (mask of levels) may be NULL
+int MSPlanExecuteIncremental(MSPlan *plan, const cv::Mat &in, cv::Mat &out, bool *decomposed, int *retuned);
+
+// Only the roi of the output (out roi.size()), for zoomed viewing. Tone
+// curves, filters and reconstruction run only on the windows of every level
+// that contribute to roi, so pan and zoom cost scales with the viewport. With
+// a fixed divider a new frame is decomposed only on these windows and their
+// halos. The adaptive divider is the max of the whole band, then the
+// decomposition of the frame is cached as above. decomposed may be NULL
+int MSPlanExecuteROI(MSPlan *plan, const cv::Mat &in, cv::Mat &out, const cv::Rect &roi, bool *decomposed);
+
+// Windows of MSPlanExecuteROI, levels + 1 of them from fine to coarse: roi
+// with the unsharp mask halo, then each the pyrUp source of the finer one,
+// about half of it plus 2 pixels, so together they are O(roi.area())
+void MSPlanROIWindows(const MSPlan *plan, const cv::Rect &roi, std::vector<cv::Rect> &windows);
+
+// Same result, coarse to fine: the bands of levels below previewLevel are
+// made only after the coarser levels are reconstructed, and every level from
+// previewLevel to 1 is shown as soon as it is ready, with post power and
+// upsampled to the size of out, without unsharp mask. callback gets every
+// preview and the final result (level 0), it may be NULL
+int MSPlanExecuteProgressive(MSPlan *plan, const cv::Mat &in, cv::Mat &out, int previewLevel,
+	MSPreviewCallback callback, void *user);
+
+// Results of count parameter sets from one decomposition of in, cached as
+// above. params must match the plan in preprocessing, convolution and levels,
+// the rest may differ. Tone curves run on groups of sets at a time, reading
+// every raw band row once for the whole group. stats may be NULL
+int MSPlanExecuteSweep(MSPlan *plan, const cv::Mat &in, cv::Mat *out, const MSParameters *params, int count,
+	MSSweepStats *stats);
+
+// MSPlanExecute into a display buffer, out U8 or U16 (U8 if empty). Post
+// power, window/level, clamp and gamma run through one MSDisplayTable in the
+// pass that reconstructs level 0, so no full resolution SGL result is
+// written. With an unsharp mask the table is applied after it instead
+int MSPlanExecuteDisplay(MSPlan *plan, const cv::Mat &in, cv::Mat &out, const MSDisplayParams &display);
+
+// Coarse tile mask of flat regions: saturated direct beam, collimator shutters
+#define MS_MASK_TILE	64  //tile edge at level 0, halves with every level
+#define MS_MASK_LEVEL	3   //level the flat tiles are detected on
+#define MS_MASK_HALO	2   //pixels around a tile on that level that must be flat too
+#define MS_MASK_FLATNESS	(1.0 / 1024) //default max - min of a flat tile, fraction of the frame range
+
+typedef struct {
+	int cols, rows;
+	int deadTiles;
+	std::vector<uint8_t> dead;   //row major, 1 - flat
+} MSTileMask;
+
+// Tiles of tile pixels of level whose window and MS_MASK_HALO around it vary
+// by at most flatness times the range of the whole level
+void MSTileMaskBuild(const cv::Mat &level, int tile, double flatness, MSTileMask &mask);
+
+// MSPlanExecute that skips the flat tiles found on level MS_MASK_LEVEL. Their
+// bands are set to 0 on that level and all finer ones instead of running
+// tone curve and filter, so the result there is the smooth reconstruction of
+// the coarse levels. flatness 0 - MS_MASK_FLATNESS, stats may be NULL
+int MSPlanExecuteMasked(MSPlan *plan, const cv::Mat &in, cv::Mat &out, double flatness, MSMaskStats *stats);
+
+// 64-bit content hash of the pixels, type and size, never 0
+uint64_t MSImageHash(const cv::Mat &img);
+
+// Same with the MSShed work left out, level after level, stageUs may be NULL
+int MSPlanExecuteShed(MSPlan *plan, const cv::Mat &in, cv::Mat &out, int shed, double stageUs[MS_STAGE_COUNT]);
+
+// Per-frame time of planning every frame versus executing a prepared plan
+int MSPlanBenchmark(MSContext *ctx, int width, int height, int type, const MSParameters &params,
+	int iterations, double *replanUs, double *executeUs);
+
+// Wall time per frame of both schedules, and the measured critical path and
+// total task time of the graph
+int MSPlanScheduleBenchmark(MSContext *ctx, int width, int height, int type, const MSParameters &params,
+	int iterations, double *levelsUs, double *graphUs, double *criticalPathUs, double *workUs);
+
+#endif  /* ndef __Plan_H__ */
@@ -0,0 +1,446 @@
+//==============================================================================
+//
+// Title:       Profile
+// Purpose:     Always-on per-stage timing with latency histograms.
+//
+//==============================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <climits>
+#include <algorithm>
+#include "Profile.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define MS_PROF_SUB_BITS	4
+#define MS_PROF_SUB		(1 << MS_PROF_SUB_BITS)
+#define MS_PROF_MAX_BITS	40 //about 6 minutes at 3 GHz
+#define MS_PROF_BUCKETS	((MS_PROF_MAX_BITS - MS_PROF_SUB_BITS + 1) * MS_PROF_SUB)
+
+// Written by its thread only, relaxed loads and stores are enough
+typedef struct {
+	std::atomic<uint32_t> counts[MS_PROF_COUNT][MS_PROF_BUCKETS];
+	std::atomic<uint64_t> total[MS_PROF_COUNT];
+	std::atomic<uint64_t> max[MS_PROF_COUNT];
+} MSProfileThread;
+
+// Blocks of finished threads are handed to new ones, their counts stay
+static std::mutex MSProfileLock;
+static std::vector<MSProfileThread*> MSProfileThreads, MSProfileFree;
+
+// Ticks and clock at load time, the tick rate is taken from the time since
+static const uint64_t MSProfileTicks0 = MSProfileTicks();
+static const std::chrono::steady_clock::time_point MSProfileClock0 = std::chrono::steady_clock::now();
+
+struct MSProfileOwner {
+	MSProfileThread *block;
+	MSProfileOwner() : block(NULL) {}
+	~MSProfileOwner()
+	{
+		if (!block) return;
+		std::lock_guard<std::mutex> guard(MSProfileLock);
+		MSProfileFree.push_back(block);
+	}
+};
+
+static thread_local MSProfileOwner MSProfileLocal;
+
+typedef struct {
+	uint64_t begin, end;
+	int32_t id, level, row, thread;
+} MSTraceEvent;
+
+std::atomic<bool> MSTraceEnabled(false);
+static std::vector<MSTraceEvent> MSTraceEvents;
+static std::atomic<uint64_t> MSTraceCount(0); //claimed slots, keeps counting past the end as dropped
+static std::atomic<int> MSTraceThreads(0), MSTraceWriters(0);
+static uint64_t MSTraceTicks0;
+static thread_local int MSTraceThread = 0;
+
+// Counter group of a thread, the leader counts cycles and reads all members
+struct MSCounterThread {
+	int fds[MS_CNT_COUNT];
+	int slots[MS_CNT_COUNT];  //position in the group read, -1 not opened
+	bool tried;
+	MSCounterThread() : tried(false)
+	{
+		for (int i = 0; i < MS_CNT_COUNT; i++) fds[i] = slots[i] = -1;
+	}
+	~MSCounterThread()
+	{
+#if defined(__linux__)
+		for (int i = MS_CNT_COUNT - 1; i >= 0; i--) if (fds[i] >= 0) close(fds[i]);
+#endif
+	}
+};
+
+std::atomic<bool> MSCountersEnabled(false);
+static std::atomic<int64_t> MSCounterTotals[MS_PROF_COUNT][MS_CNT_COUNT], MSCounterPixels(0);
+static std::atomic<int> MSCounterMissing(0); //mask of counters the CPU does not have
+static thread_local MSCounterThread MSCounterLocal;
+static thread_local int MSCounterStageLocal = -1;
+
+uint64_t MSProfileTicks()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static int MSProfileBucket(uint64_t ticks)
+{
+	int exp = 0;
+
+	if (ticks < MS_PROF_SUB) return (int)ticks;
+	if (ticks >> MS_PROF_MAX_BITS) return MS_PROF_BUCKETS - 1;
+	for (uint64_t v = ticks; v >>= 1; ) exp++;
+	return (exp - MS_PROF_SUB_BITS + 1) * MS_PROF_SUB + (int)((ticks >> (exp - MS_PROF_SUB_BITS)) & (MS_PROF_SUB - 1));
+}
+
+// Middle of the bucket in ticks
+static double MSProfileBucketValue(int bucket)
+{
+	int exp;
+
+	if (bucket < MS_PROF_SUB) return bucket;
+	exp = bucket / MS_PROF_SUB + MS_PROF_SUB_BITS - 1;
+	return (double)((uint64_t)(MS_PROF_SUB + bucket % MS_PROF_SUB) << (exp - MS_PROF_SUB_BITS)) +
+		(double)((uint64_t)1 << (exp - MS_PROF_SUB_BITS)) / 2;
+}
+
+static MSProfileThread* MSProfileThreadBlock()
+{
+	MSProfileThread *block = MSProfileLocal.block;
+
+	if (block) return block;
+	std::lock_guard<std::mutex> guard(MSProfileLock);
+	if (!MSProfileFree.empty()){
+		block = MSProfileFree.back();
+		MSProfileFree.pop_back();
+	}
+	else if ((block = new (std::nothrow) MSProfileThread())) MSProfileThreads.push_back(block);
+	return MSProfileLocal.block = block;
+}
+
+void MSProfileRecord(int stage, uint64_t ticks)
+{
+	MSProfileThread *block = MSProfileThreadBlock();
+	std::atomic<uint32_t> *count;
+
+	if (!block || (stage < 0) || (stage >= MS_PROF_COUNT)) return;
+	count = &block->counts[stage][MSProfileBucket(ticks)];
+	count->store(count->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	block->total[stage].store(block->total[stage].load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+	if (ticks > block->max[stage].load(std::memory_order_relaxed)) block->max[stage].store(ticks, std::memory_order_relaxed);
+}
+
+double MSProfileTicksPerUs()
+{
+	double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - MSProfileClock0).count();
+	uint64_t ticks = MSProfileTicks() - MSProfileTicks0;
+
+	return (us > 0) && ticks ? ticks / us : 1000.0;
+}
+
+void MSProfileQuery(int stage, MSProfileStats *stats)
+{
+	std::vector<uint64_t> merged(MS_PROF_BUCKETS, 0);
+	uint64_t count = 0, total = 0, max = 0, p50 = 0, p99 = 0, seen = 0;
+	double perUs = MSProfileTicksPerUs();
+	int p50Bucket = -1, p99Bucket = -1;
+
+	stats->count = 0;
+	stats->meanUs = stats->p50Us = stats->p99Us = stats->maxUs = 0;
+	if ((stage < 0) || (stage >= MS_PROF_COUNT)) return;
+
+	{
+		std::lock_guard<std::mutex> guard(MSProfileLock);
+		for (size_t t = 0; t < MSProfileThreads.size(); t++){
+			MSProfileThread *block = MSProfileThreads[t];
+			for (int b = 0; b < MS_PROF_BUCKETS; b++) merged[b] += block->counts[stage][b].load(std::memory_order_relaxed);
+			total += block->total[stage].load(std::memory_order_relaxed);
+			if (block->max[stage].load(std::memory_order_relaxed) > max) max = block->max[stage].load(std::memory_order_relaxed);
+		}
+	}
+	for (int b = 0; b < MS_PROF_BUCKETS; b++) count += merged[b];
+	if (!count) return;
+
+	p50 = (count + 1) / 2;
+	p99 = count - count / 100;
+	for (int b = 0; b < MS_PROF_BUCKETS; b++){
+		seen += merged[b];
+		if ((p50Bucket < 0) && (seen >= p50)) p50Bucket = b;
+		if ((p99Bucket < 0) && (seen >= p99)) p99Bucket = b;
+	}
+
+	stats->count = (int64_t)count;
+	stats->meanUs = total / perUs / count;
+	stats->p50Us = MSProfileBucketValue(p50Bucket) / perUs;
+	stats->p99Us = MSProfileBucketValue(p99Bucket) / perUs;
+	stats->maxUs = max / perUs;
+	if (stats->p50Us > stats->maxUs) stats->p50Us = stats->maxUs; //bucket middle above the largest sample
+	if (stats->p99Us > stats->maxUs) stats->p99Us = stats->maxUs;
+}
+
+// Samples recorded while resetting may survive or get lost
+void MSProfileReset()
+{
+	std::lock_guard<std::mutex> guard(MSProfileLock);
+
+	for (size_t t = 0; t < MSProfileThreads.size(); t++){
+		MSProfileThread *block = MSProfileThreads[t];
+		for (int s = 0; s < MS_PROF_COUNT; s++){
+			for (int b = 0; b < MS_PROF_BUCKETS; b++) block->counts[s][b].store(0, std::memory_order_relaxed);
+			block->total[s].store(0, std::memory_order_relaxed);
+			block->max[s].store(0, std::memory_order_relaxed);
+		}
+	}
+	for (int s = 0; s < MS_PROF_COUNT; s++)
+		for (int i = 0; i < MS_CNT_COUNT; i++) MSCounterTotals[s][i].store(0, std::memory_order_relaxed);
+	MSCounterPixels = 0;
+}
+
+const char* MSProfileStageName(int stage)
+{
+	static char levels[MS_MAX_LEVELS][16];
+	static std::once_flag named;
+
+	std::call_once(named, []{
+		for (int k = 0; k < MS_MAX_LEVELS; k++) snprintf(levels[k], sizeof(levels[k]), "decompose %d", k);
+	});
+	if ((stage >= MS_PROF_DECOMPOSE) && (stage < MS_PROF_DECOMPOSE + MS_MAX_LEVELS)) return levels[stage - MS_PROF_DECOMPOSE];
+
+	switch (stage){
+		case MS_PROF_MARSHAL: return "marshal";
+		case MS_PROF_INPUT: return "input";
+		case MS_PROF_TRANSFORM: return "transform";
+		case MS_PROF_FILTERS: return "filters";
+		case MS_PROF_RECONSTRUCT: return "reconstruct";
+		case MS_PROF_POST: return "post power";
+		case MS_PROF_UNSHARP: return "unsharp";
+		case MS_PROF_CLAHE: return "clahe";
+		case MS_PROF_OUTPUT: return "output";
+		case MS_PROF_GRAPH: return "tile graph";
+		case MS_TRACE_CHUNK: return "chunk";
+		case MS_TRACE_TILE_INPUT: return "tile input";
+		case MS_TRACE_TILE_DOWN: return "tile down";
+		case MS_TRACE_TILE_BAND: return "tile band";
+		case MS_TRACE_TILE_TONE: return "tile tone";
+		case MS_TRACE_TILE_FILTER: return "tile filter";
+		case MS_TRACE_TILE_RECON: return "tile reconstruct";
+		default: return "unknown";
+	}
+}
+
+#if defined(__linux__)
+static int MSPerfOpen(uint32_t type, uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+#define MS_PERF_CACHE_MISS(cache) \
+	((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+// Opens the group of the calling thread on its first use
+static MSCounterThread* MSCounterThreadGroup()
+{
+	MSCounterThread *group = &MSCounterLocal;
+
+#if defined(__linux__)
+	static const uint32_t types[MS_CNT_COUNT] = {
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE };
+	static const uint64_t configs[MS_CNT_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		MS_PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_LL), MS_PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) };
+	int slot = 0;
+
+	if (group->tried) return group->fds[0] >= 0 ? group : NULL;
+	group->tried = true;
+	for (int i = 0; i < MS_CNT_COUNT; i++){
+		group->fds[i] = MSPerfOpen(types[i], configs[i], i ? group->fds[0] : -1);
+		if (group->fds[i] >= 0) group->slots[i] = slot++;
+		else if (!i) return NULL;
+	}
+	return group;
+#else
+	(void)group;
+	return NULL;
+#endif
+}
+
+bool MSCountersStart()
+{
+	MSCounterThread *group = MSCounterThreadGroup();
+	int missing = 0;
+
+	if (!group) return false;
+	for (int i = 0; i < MS_CNT_COUNT; i++) if (group->slots[i] < 0) missing |= 1 << i;
+	MSCounterMissing = missing;
+	MSCountersEnabled = true;
+	return true;
+}
+
+void MSCountersStop()
+{
+	MSCountersEnabled = false;
+}
+
+bool MSCountersRead(uint64_t counts[MS_CNT_COUNT])
+{
+#if defined(__linux__)
+	MSCounterThread *group = MSCounterThreadGroup();
+	uint64_t values[1 + MS_CNT_COUNT];
+
+	if (!group || (read(group->fds[0], values, sizeof(values)) < (ssize_t)sizeof(uint64_t))) return false;
+	for (int i = 0; i < MS_CNT_COUNT; i++)
+		counts[i] = (group->slots[i] >= 0) && ((uint64_t)group->slots[i] < values[0]) ? values[1 + group->slots[i]] : 0;
+	return true;
+#else
+	(void)counts;
+	return false;
+#endif
+}
+
+void MSCountersAdd(int stage, const uint64_t begin[MS_CNT_COUNT])
+{
+	uint64_t end[MS_CNT_COUNT];
+
+	if ((stage < 0) || (stage >= MS_PROF_COUNT) || !MSCountersRead(end)) return;
+	for (int i = 0; i < MS_CNT_COUNT; i++)
+		MSCounterTotals[stage][i].fetch_add((int64_t)(end[i] - begin[i]), std::memory_order_relaxed);
+}
+
+void MSCountersAddPixels(int64_t pixels)
+{
+	MSCounterPixels.fetch_add(pixels, std::memory_order_relaxed);
+}
+
+int MSCountersStage()
+{
+	return MSCounterStageLocal;
+}
+
+void MSCountersSetStage(int stage)
+{
+	MSCounterStageLocal = stage;
+}
+
+void MSCountersQuery(int stage, MSCounterStats *stats)
+{
+	int missing = MSCounterMissing.load();
+
+	memset(stats, 0, sizeof(MSCounterStats));
+	if ((stage < 0) || (stage >= MS_PROF_COUNT)) return;
+
+	for (int i = 0; i < MS_CNT_COUNT; i++)
+		stats->counts[i] = missing & (1 << i) ? -1 : MSCounterTotals[stage][i].load(std::memory_order_relaxed);
+	stats->pixels = MSCounterPixels.load(std::memory_order_relaxed);
+	if ((stats->counts[MS_CNT_CYCLES] > 0) && (stats->counts[MS_CNT_INSTRUCTIONS] >= 0))
+		stats->ipc = (double)stats->counts[MS_CNT_INSTRUCTIONS] / stats->counts[MS_CNT_CYCLES];
+	if ((stats->pixels > 0) && (stats->counts[MS_CNT_LLC_MISSES] >= 0))
+		stats->bytesPerPixel = (double)stats->counts[MS_CNT_LLC_MISSES] * MS_CNT_LINE_BYTES / stats->pixels;
+}
+
+int MSTraceStart(int capacity)
+{
+	if (MSTraceEnabled) return MS_ERR_INVALID_PARAMETER;
+	// recorders that saw tracing on before the stop still write into the buffer
+	while (MSTraceWriters.load()) std::this_thread::yield();
+	try {
+		MSTraceEvents.assign(capacity > 0 ? capacity : 1, MSTraceEvent());
+	}
+	catch (const std::bad_alloc &){
+		MSTraceEvents.clear();
+		return MS_ERR_OUT_OF_MEMORY;
+	}
+	MSTraceCount = 0;
+	MSTraceTicks0 = MSProfileTicks();
+	MSTraceEnabled = true;
+	return MS_OK;
+}
+
+void MSTraceStop()
+{
+	MSTraceEnabled = false;
+}
+
+void MSTraceRecord(int id, int level, int row, uint64_t begin, uint64_t end)
+{
+	uint64_t index;
+	MSTraceEvent *event;
+
+	// registered before tracing is checked, MSTraceStart does the opposite,
+	// so the buffer is never replaced under a recorder
+	MSTraceWriters.fetch_add(1);
+	if (MSTraceEnabled.load()){
+		index = MSTraceCount.fetch_add(1, std::memory_order_relaxed);
+		if (index < MSTraceEvents.size()){ //else counted as dropped
+			if (!MSTraceThread) MSTraceThread = ++MSTraceThreads;
+			event = &MSTraceEvents[index];
+			event->begin = begin;
+			event->end = end;
+			event->id = id;
+			event->level = level;
+			event->row = row;
+			event->thread = MSTraceThread;
+		}
+	}
+	MSTraceWriters.fetch_sub(1, std::memory_order_release);
+}
+
+bool MSTraceWrite(const char *path, int *events, int *dropped)
+{
+	FILE *file = fopen(path, "w");
+	uint64_t claimed = MSTraceCount.load();
+	int count = (int)std::min<uint64_t>(claimed, MSTraceEvents.size());
+	double perUs = MSProfileTicksPerUs();
+
+	if (events) *events = count;
+	if (dropped) *dropped = (int)std::min<uint64_t>(claimed - count, INT_MAX);
+	if (!file) return false;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"multiscale\"}}");
+	for (int t = 1; t <= MSTraceThreads.load(); t++)
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", t, t);
+	for (int i = 0; i < count; i++){
+		const MSTraceEvent &event = MSTraceEvents[i];
+		fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"multiscale\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+			MSProfileStageName(event.id), event.thread, (double)(int64_t)(event.begin - MSTraceTicks0) / perUs,
+			(double)(event.end - event.begin) / perUs);
+		if (event.level >= 0) fprintf(file, ",\"args\":{\"level\":%d,\"row\":%d}", event.level, event.row);
+		else if (event.row >= 0) fprintf(file, ",\"args\":{\"row\":%d}", event.row);
+		fprintf(file, "}");
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
@@ -0,0 +1,214 @@
+//==============================================================================
+//
+// Title:       Profile
+// Purpose:     Always-on per-stage timing with latency histograms.
+//
+//              Stages are timed with the CPU time stamp counter and counted
+//              into log-linear (HDR) histograms, 16 buckets per power of two
+//              or about 6 % resolution. Every thread writes only its own
+//              histograms, so recording takes no lock and no atomic
+//              read-modify-write; queries merge all threads.
+//
+//              Optionally every scope is also recorded as a begin/end event
+//              with its thread into a preallocated trace buffer, which is
+//              written as Chrome trace JSON for chrome://tracing or Perfetto.
+//              Tile tasks and thread pool chunks are traced as well.
+//
+//              On Linux the hardware counters (cycles, instructions, LLC and
+//              dTLB misses) can be opened with perf_event_open on every
+//              thread that records a stage or runs pool chunks for it. They
+//              are attributed to the stage of the calling thread, so IPC and
+//              memory traffic per pixel show which stage is compute bound and
+//              which waits for memory. Threads of OpenCV's own pool are not
+//              counted, run the core with setNumThreads(1) for complete counts.
+//
+//==============================================================================
+
+#ifndef __Profile_H__
+#define __Profile_H__
+
+#include <stdint.h>
+#include <atomic>
+#include "Pipeline.h"
+
+enum MSProfileStage {
+	MS_PROF_MARSHAL = 0,      // LabVIEW image to pointer
+	MS_PROF_INPUT,            // conversion and preprocessing
+	MS_PROF_DECOMPOSE,        // level 0, then one stage per level
+	MS_PROF_TRANSFORM = MS_PROF_DECOMPOSE + MS_MAX_LEVELS,
+	MS_PROF_FILTERS,
+	MS_PROF_RECONSTRUCT,
+	MS_PROF_POST,
+	MS_PROF_UNSHARP,
+	MS_PROF_CLAHE,
+	MS_PROF_OUTPUT,
+	MS_PROF_GRAPH,            // whole tile graph, its stages overlap
+	MS_PROF_COUNT,
+
+	// trace only, no histograms
+	MS_TRACE_CHUNK = MS_PROF_COUNT, // thread pool chunk
+	MS_TRACE_TILE_INPUT,
+	MS_TRACE_TILE_DOWN,
+	MS_TRACE_TILE_BAND,
+	MS_TRACE_TILE_TONE,
+	MS_TRACE_TILE_FILTER,
+	MS_TRACE_TILE_RECON,
+	MS_TRACE_COUNT
+};
+
+enum MSCounter {
+	MS_CNT_CYCLES = 0,
+	MS_CNT_INSTRUCTIONS,
+	MS_CNT_LLC_MISSES,       // last level cache read misses
+	MS_CNT_DTLB_MISSES,      // data TLB read misses
+	MS_CNT_COUNT
+};
+
+#define MS_CNT_LINE_BYTES	64 //memory traffic per LLC miss
+
+typedef struct {
+	int64_t counts[MS_CNT_COUNT]; // -1 where the CPU has no such counter
+	int64_t pixels;          // frame pixels processed while counting
+	double ipc;              // instructions per cycle
+	double bytesPerPixel;    // LLC miss traffic per frame pixel
+} MSCounterStats;
+
+typedef struct {
+	int64_t count;
+	double meanUs;
+	double p50Us;
+	double p99Us;
+	double maxUs;
+} MSProfileStats;
+
+uint64_t MSProfileTicks();
+double MSProfileTicksPerUs();
+void MSProfileRecord(int stage, uint64_t ticks);
+
+// Merged over all threads since the last reset
+void MSProfileQuery(int stage, MSProfileStats *stats);
+void MSProfileReset();
+const char* MSProfileStageName(int stage);
+
+extern std::atomic<bool> MSTraceEnabled;
+extern std::atomic<bool> MSCountersEnabled;
+
+// Starts counting on every thread from its next stage, false where
+// perf_event_open is not available (not Linux, perf_event_paranoid > 2)
+bool MSCountersStart();
+void MSCountersStop();
+// Counters of the calling thread, false if it has none
+bool MSCountersRead(uint64_t counts[MS_CNT_COUNT]);
+// Adds the difference since begin to the stage
+void MSCountersAdd(int stage, const uint64_t begin[MS_CNT_COUNT]);
+// Frame pixels for the traffic per pixel, once per frame
+void MSCountersAddPixels(int64_t pixels);
+// Stage counted on this thread, -1 outside of stages
+int MSCountersStage();
+void MSCountersSetStage(int stage);
+// Merged over all threads since the last reset, MSProfileReset clears them too
+void MSCountersQuery(int stage, MSCounterStats *stats);
+
+// Allocates room for capacity events and starts recording, between frames only.
+// MS_ERR_INVALID_PARAMETER while recording, MSTraceStop first
+int MSTraceStart(int capacity);
+void MSTraceStop();
+// level and row are shown with the event, -1 for none
+void MSTraceRecord(int id, int level, int row, uint64_t begin, uint64_t end);
+// Chrome trace JSON of the recorded events, false if the file cannot be written
+bool MSTraceWrite(const char *path, int *events, int *dropped);
+
+inline bool MSTraceOn()
+{
+	return MSTraceEnabled.load(std::memory_order_relaxed);
+}
+
+inline bool MSCountersOn()
+{
+	return MSCountersEnabled.load(std::memory_order_relaxed);
+}
+
+class MSProfileScope
+{
+public:
+	explicit MSProfileScope(int stage) : stage(stage), outer(-1), counting(false)
+	{
+		if (MSCountersOn() && MSCountersRead(counts)){
+			counting = true;
+			outer = MSCountersStage();
+			MSCountersSetStage(stage);
+		}
+		start = MSProfileTicks();
+	}
+	~MSProfileScope()
+	{
+		uint64_t end = MSProfileTicks();
+		MSProfileRecord(stage, end - start);
+		if (MSTraceOn()) MSTraceRecord(stage, -1, -1, start, end);
+		if (counting){
+			MSCountersAdd(stage, counts);
+			MSCountersSetStage(outer);
+		}
+	}
+
+private:
+	int stage, outer;
+	bool counting;
+	uint64_t start;
+	uint64_t counts[MS_CNT_COUNT];
+};
+
+// Piece of a stage that runs interleaved with others, such as the tone and
+// filter pass of every level. Counts hardware counters to the stage and
+// traces like MSProfileScope, but only adds its ticks to total. The caller
+// records total once per frame, so the histograms keep one sample per frame
+class MSProfilePart
+{
+public:
+	MSProfilePart(int stage, int level, uint64_t *total) : stage(stage), level(level), outer(-1), counting(false), total(total)
+	{
+		if (MSCountersOn() && MSCountersRead(counts)){
+			counting = true;
+			outer = MSCountersStage();
+			MSCountersSetStage(stage);
+		}
+		start = MSProfileTicks();
+	}
+	~MSProfilePart()
+	{
+		uint64_t end = MSProfileTicks();
+		*total += end - start;
+		if (MSTraceOn()) MSTraceRecord(stage, level, -1, start, end);
+		if (counting){
+			MSCountersAdd(stage, counts);
+			MSCountersSetStage(outer);
+		}
+	}
+
+private:
+	int stage, level, outer;
+	bool counting;
+	uint64_t *total;
+	uint64_t start;
+	uint64_t counts[MS_CNT_COUNT];
+};
+
+// Trace only, costs one relaxed load while tracing is off
+class MSTraceScope
+{
+public:
+	MSTraceScope(int id, int level, int row) : id(id), level(level), row(row), start(MSTraceOn() ? MSProfileTicks() : 0) {}
+	~MSTraceScope() { if (start && MSTraceOn()) MSTraceRecord(id, level, row, start, MSProfileTicks()); }
+
+private:
+	int id, level, row;
+	uint64_t start;
+};
+
+#define MS_PROFILE_CAT2(a, b) a##b
+#define MS_PROFILE_CAT(a, b) MS_PROFILE_CAT2(a, b)
+#define MS_PROFILE(stage) MSProfileScope MS_PROFILE_CAT(profileScope, __LINE__)(stage)
+#define MS_PROFILE_PART(stage, level, total) MSProfilePart MS_PROFILE_CAT(profilePart, __LINE__)(stage, level, total)
+#define MS_TRACE(id, level, row) MSTraceScope MS_PROFILE_CAT(traceScope, __LINE__)(id, level, row)
+
+#endif  /* ndef __Profile_H__ */
@@ -0,0 +1,61 @@
+//==============================================================================
+//
+// Title:       Quality
+// Purpose:     Image quality of an output against its golden reference.
+//
+//==============================================================================
+
+#include <math.h>
+#include "opencv2/imgproc.hpp"
+#include "Quality.h"
+
+using namespace cv;
+
+// Mean SSIM as in Wang et al. 2004, computed in double for the U16 range
+static double MSSsim(const Mat &a, const Mat &b, double peak)
+{
+	const double c1 = (0.01 * peak) * (0.01 * peak), c2 = (0.03 * peak) * (0.03 * peak);
+	Mat x, y, mx, my, sxx, syy, sxy, num, den;
+
+	a.convertTo(x, CV_64F);
+	b.convertTo(y, CV_64F);
+	GaussianBlur(x, mx, Size(11, 11), 1.5);
+	GaussianBlur(y, my, Size(11, 11), 1.5);
+	GaussianBlur(x.mul(x), sxx, Size(11, 11), 1.5);
+	GaussianBlur(y.mul(y), syy, Size(11, 11), 1.5);
+	GaussianBlur(x.mul(y), sxy, Size(11, 11), 1.5);
+
+	Mat mxx = mx.mul(mx), myy = my.mul(my), mxy = mx.mul(my);
+	sxx -= mxx;
+	syy -= myy;
+	sxy -= mxy;
+
+	num = (2 * mxy + c1).mul(2 * sxy + c2);
+	den = (mxx + myy + c1).mul(sxx + syy + c2);
+	return mean(num / den)[0];
+}
+
+bool MSQualityCompare(const Mat &a, const Mat &b, MSQuality *quality)
+{
+	double peak, mse;
+	Mat diff;
+
+	if ((a.size() != b.size()) || (a.type() != b.type()) || (a.channels() != 1)) return false;
+	if ((a.depth() != CV_8U) && (a.depth() != CV_16U) && (a.depth() != CV_32F)) return false;
+	peak = a.depth() == CV_8U ? 255.0 : (a.depth() == CV_16U ? 65535.0 : norm(b, NORM_INF));
+	if (peak <= 0) peak = 1;
+
+	absdiff(a, b, diff);
+	diff.convertTo(diff, CV_64F);
+	quality->maxAbs = norm(diff, NORM_INF);
+	mse = diff.dot(diff) / (double)diff.total();
+	quality->psnr = mse > 0 ? 10 * log10(peak * peak / mse) : MS_QUALITY_PSNR_EQUAL;
+	quality->ssim = quality->maxAbs > 0 ? MSSsim(a, b, peak) : 1.0;
+	return true;
+}
+
+bool MSQualityPasses(const MSQuality &quality, const MSQualityTolerance &tolerance)
+{
+	return (quality.maxAbs <= tolerance.maxAbs) && (quality.psnr >= tolerance.minPsnr) &&
+		(quality.ssim >= tolerance.minSsim);
+}
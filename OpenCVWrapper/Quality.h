@@ -0,0 +1,38 @@
+//==============================================================================
+//
+// Title:       Quality
+// Purpose:     Image quality of an output against its golden reference.
+//
+//              Every fast path (approximate pow, coarse tables, reduced
+//              precision) is checked against the output of the reference
+//              path by maximum absolute error, PSNR and SSIM, with a
+//              tolerance per processing mode.
+//
+//==============================================================================
+
+#ifndef __Quality_H__
+#define __Quality_H__
+
+#include <stdint.h>
+#include "opencv2/core.hpp"
+
+#define MS_QUALITY_PSNR_EQUAL	999.0 //PSNR reported for identical images
+
+typedef struct {
+	double maxAbs;           // in output units
+	double psnr;             // dB, peak 65535 for U16, the maximum of b for SGL
+	double ssim;             // mean SSIM, 11x11 gaussian window, sigma 1.5
+} MSQuality;
+
+typedef struct {
+	double maxAbs;           // upper limits, 0 - must be identical
+	double minPsnr;
+	double minSsim;
+} MSQualityTolerance;
+
+// a against the reference b, same size and type, U8 (display), U16 or SGL. False on a mismatch
+bool MSQualityCompare(const cv::Mat &a, const cv::Mat &b, MSQuality *quality);
+
+bool MSQualityPasses(const MSQuality &quality, const MSQualityTolerance &tolerance);
+
+#endif  /* ndef __Quality_H__ */
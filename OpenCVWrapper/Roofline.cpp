@@ -0,0 +1,158 @@
+//==============================================================================
+//
+// Title:       Roofline
+// Purpose:     Memory traffic and arithmetic model of every pipeline stage.
+//
+//==============================================================================
+
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "Roofline.h"
+#include "Context.h"
+
+using namespace cv;
+
+// Flops per output pixel of the kernels the model cannot count from sizes
+#define MS_ROOF_PYRDOWN_FLOPS	20 //separable 5 taps, multiply-add
+#define MS_ROOF_PYRUP_FLOPS	12 //separable, 3 taps per output on average
+#define MS_ROOF_TABLE_FLOPS	6  //abs, scale, interpolation, sign
+#define MS_ROOF_FASTPOW_FLOPS	10
+#define MS_ROOF_UNSHARP_FLOPS	28 //3x3 gaussian, difference, 3x3 box, threshold and add
+
+#define MS_ROOF_STREAM_FLOATS	(8 << 20) //three 32 MB arrays
+#define MS_ROOF_PEAK_FLOATS	256       //L1 resident
+#define MS_ROOF_PEAK_REPEATS	20000
+
+static double MSNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static void MSRoofAdd(MSRooflineStage *stage, double bytes, double flops)
+{
+	stage->bytes += bytes;
+	stage->flops += flops;
+}
+
+void MSRooflineModel(const MSPlan *plan, MSRooflineStage stages[MS_STAGE_COUNT])
+{
+	double inBytes = plan->type == CV_16UC1 ? 2 : 4, p0 = (double)plan->width * plan->height;
+
+	memset(stages, 0, sizeof(MSRooflineStage) * MS_STAGE_COUNT);
+
+	// conversion to float, preprocessing kernel
+	MSRoofAdd(&stages[MS_STAGE_INPUT], p0 * (inBytes + 4), p0);
+	if (!plan->preKernel.empty())
+		MSRoofAdd(&stages[MS_STAGE_INPUT], p0 * 8, p0 * 2 * plan->preKernel.total());
+
+	for (int k = 0; k < plan->levels; k++){
+		double pk = (double)plan->sizes[k].area(), pn = (double)plan->sizes[k + 1].area();
+
+		// pyrDown, pyrUp, subtract
+		MSRoofAdd(&stages[MS_STAGE_DECOMPOSE], 4 * pk + 4 * pn, MS_ROOF_PYRDOWN_FLOPS * pn);
+		MSRoofAdd(&stages[MS_STAGE_DECOMPOSE], 4 * pn + 4 * pk, MS_ROOF_PYRUP_FLOPS * pk);
+		MSRoofAdd(&stages[MS_STAGE_DECOMPOSE], 12 * pk, pk);
+
+		// divider from the band maximum, then the tone curve in place
+		if (!(plan->params.divider > 0)) MSRoofAdd(&stages[MS_STAGE_TONE], 4 * pk, pk);
+		MSRoofAdd(&stages[MS_STAGE_TONE], 8 * pk, MS_ROOF_TABLE_FLOPS * pk);
+
+		if (!plan->kernels[k].empty())
+			MSRoofAdd(&stages[MS_STAGE_FILTERS], 8 * pk, pk * 2 * plan->kernels[k].total());
+
+		// pyrUp of the coarser result, add
+		MSRoofAdd(&stages[MS_STAGE_RECONSTRUCT], 4 * pn + 4 * pk, MS_ROOF_PYRUP_FLOPS * pk);
+		MSRoofAdd(&stages[MS_STAGE_RECONSTRUCT], 12 * pk, pk);
+	}
+	if (plan->postPower) MSRoofAdd(&stages[MS_STAGE_RECONSTRUCT], 8 * p0, MS_ROOF_TABLE_FLOPS * p0);
+
+	// copy, gaussian, subtract, box, apply, convert to the output type
+	if (plan->params.unsharp.amount != 0) MSRoofAdd(&stages[MS_STAGE_UNSHARP], p0 * (52 + inBytes), MS_ROOF_UNSHARP_FLOPS * p0);
+	else MSRoofAdd(&stages[MS_STAGE_OUTPUT], p0 * (4 + inBytes), p0);
+
+	for (int s = 0; s < MS_STAGE_COUNT; s++)
+		stages[s].intensity = stages[s].bytes > 0 ? stages[s].flops / stages[s].bytes : 0;
+}
+
+double MSRooflineBandwidth(MSContext *ctx)
+{
+	std::vector<float> a(MS_ROOF_STREAM_FLOATS), b(MS_ROOF_STREAM_FLOATS, 1.0f), c(MS_ROOF_STREAM_FLOATS, 2.0f);
+	const int grain = MS_ROOF_STREAM_FLOATS / (ctx->pool.size() * 4);
+	double best = 0;
+
+	// first touch by the threads that stream it later
+	ctx->pool.parallelFor(MS_ROOF_STREAM_FLOATS, grain, [&](int begin, int end){
+		for (int i = begin; i < end; i++) a[i] = 0;
+	});
+	for (int r = 0; r < 5; r++){
+		double t0 = MSNowUs(), us;
+		ctx->pool.parallelFor(MS_ROOF_STREAM_FLOATS, grain, [&](int begin, int end){
+			for (int i = begin; i < end; i++) a[i] = b[i] + 3.0f * c[i];
+		});
+		us = MSNowUs() - t0;
+		if (us > 0) best = std::max(best, 3.0 * 4 * MS_ROOF_STREAM_FLOATS / (us * 1e3));
+	}
+	return best;
+}
+
+double MSRooflinePeak(MSContext *ctx)
+{
+	const int threads = ctx->pool.size();
+	std::vector<float> sink(threads); //keeps the loop
+	double t0 = MSNowUs(), us;
+
+	ctx->pool.parallelFor(threads, 1, [&](int begin, int end){
+		for (int t = begin; t < end; t++){
+			float x[MS_ROOF_PEAK_FLOATS];
+			for (int i = 0; i < MS_ROOF_PEAK_FLOATS; i++) x[i] = (float)i;
+			for (int r = 0; r < MS_ROOF_PEAK_REPEATS; r++)
+				for (int i = 0; i < MS_ROOF_PEAK_FLOATS; i++) x[i] = x[i] * 0.999999f + 0.5f;
+			sink[t] = x[t % MS_ROOF_PEAK_FLOATS];
+		}
+	});
+	us = MSNowUs() - t0;
+	return us > 0 ? 2.0 * MS_ROOF_PEAK_FLOATS * MS_ROOF_PEAK_REPEATS * threads / (us * 1e3) : 0;
+}
+
+int MSRoofline(MSContext *ctx, int width, int height, int type, const MSParameters &params, int iterations,
+	double *bandwidth, double *peak, MSRooflineStage stages[MS_STAGE_COUNT])
+{
+	double stageUs[MS_STAGE_COUNT], totalUs[MS_STAGE_COUNT] = { 0 }, ridge;
+	int status = MS_OK;
+	MSPlan *plan;
+	Mat in, out;
+
+	if (iterations <= 0) iterations = 20;
+	if ((type != CV_16UC1) && (type != CV_32FC1)) return MS_ERR_INVALID_TYPE;
+	if (*bandwidth <= 0) *bandwidth = MSRooflineBandwidth(ctx);
+	if (*peak <= 0) *peak = MSRooflinePeak(ctx);
+
+	in.create(height, width, type);
+	randu(in, 0, type == CV_16UC1 ? 4096 : 1);
+	if (!(plan = MSPlanCreate(ctx, width, height, type, params, &status))) return status;
+
+	MSRooflineModel(plan, stages);
+	status = MSPlanExecuteShed(plan, in, out, 0, stageUs); //warm up
+	for (int i = 0; (i < iterations) && (status == MS_OK); i++){
+		status = MSPlanExecuteShed(plan, in, out, 0, stageUs);
+		for (int s = 0; s < MS_STAGE_COUNT; s++) totalUs[s] += stageUs[s];
+	}
+	MSPlanDestroy(plan);
+	if (status != MS_OK) return status;
+
+	ridge = *bandwidth > 0 ? *peak / *bandwidth : 0;
+	for (int s = 0; s < MS_STAGE_COUNT; s++){
+		MSRooflineStage &stage = stages[s];
+		stage.us = totalUs[s] / iterations;
+		stage.boundUs = std::max(*bandwidth > 0 ? stage.bytes / (*bandwidth * 1e3) : 0, *peak > 0 ? stage.flops / (*peak * 1e3) : 0);
+		stage.memoryBound = stage.intensity < ridge;
+		if (stage.us > 0){
+			stage.gbPerSec = stage.bytes / (stage.us * 1e3);
+			stage.gflopsPerSec = stage.flops / (stage.us * 1e3);
+			stage.efficiency = stage.boundUs / stage.us;
+		}
+	}
+	return MS_OK;
+}
@@ -0,0 +1,50 @@
+//==============================================================================
+//
+// Title:       Roofline
+// Purpose:     Memory traffic and arithmetic model of every pipeline stage.
+//
+//              For a plan the model counts the bytes every full-image pass
+//              has to stream and the floating point operations it does, one
+//              pass per OpenCV call or row loop, assuming frames larger than
+//              the last level cache. Against the measured stage times and
+//              the bandwidth and peak FLOPs of the machine it gives the time
+//              the roofline allows and how far each stage is from it.
+//
+//==============================================================================
+
+#ifndef __Roofline_H__
+#define __Roofline_H__
+
+#include <stdint.h>
+#include "opencv2/core.hpp"
+#include "Pipeline.h"
+#include "Plan.h"
+
+struct MSContext;
+
+typedef struct {
+	double bytes;            // DRAM traffic per frame
+	double flops;            // floating point operations per frame
+	double intensity;        // flops per byte
+	double us;               // measured time per frame, level schedule
+	double gbPerSec;         // achieved
+	double gflopsPerSec;     // achieved
+	double boundUs;          // roofline time, max(bytes / bandwidth, flops / peak)
+	double efficiency;       // boundUs / us, 1 - on the roofline
+	int32_t memoryBound;     // intensity below the ridge point
+} MSRooflineStage;
+
+// Bytes and flops of every MSStage of one frame through the plan
+void MSRooflineModel(const MSPlan *plan, MSRooflineStage stages[MS_STAGE_COUNT]);
+
+// STREAM triad bandwidth in GB/s with all threads of the context
+double MSRooflineBandwidth(MSContext *ctx);
+// Multiply-add throughput in GFLOP/s with all threads, the compiler's vector
+// code sets the limit, so the datasheet peak is usually higher
+double MSRooflinePeak(MSContext *ctx);
+
+// Model and measurement for a width x height frame, bandwidth and peak <= 0 are measured
+int MSRoofline(MSContext *ctx, int width, int height, int type, const MSParameters &params, int iterations,
+	double *bandwidth, double *peak, MSRooflineStage stages[MS_STAGE_COUNT]);
+
+#endif  /* ndef __Roofline_H__ */
@@ -0,0 +1,126 @@
+//==============================================================================
+//
+// Title:       Settings
+// Purpose:     Reads the LabVIEW Settings.ini into MSParameters.
+//
+//==============================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "Settings.h"
+
+static std::string Trim(const std::string &s)
+{
+	size_t begin = s.find_first_not_of(" \t\r\n");
+	size_t end = s.find_last_not_of(" \t\r\n");
+	return begin == std::string::npos ? std::string() : s.substr(begin, end - begin + 1);
+}
+
+static std::string Unquote(const std::string &s)
+{
+	if ((s.size() >= 2) && (s[0] == '"') && (s[s.size() - 1] == '"')) return s.substr(1, s.size() - 2);
+	return s;
+}
+
+//LabVIEW writes numbers with the locale decimal separator
+static double ToNumber(std::string s)
+{
+	for (size_t i = 0; i < s.size(); i++) if (s[i] == ',') s[i] = '.';
+	return strtod(s.c_str(), NULL);
+}
+
+//"<size(s)=12> 0,58 0,43 ..."
+static std::vector<double> ToArray(const std::string &s)
+{
+	std::vector<double> values;
+	size_t pos = s.find('>');
+	std::istringstream items(pos == std::string::npos ? s : s.substr(pos + 1));
+	std::string item;
+
+	while (items >> item) values.push_back(ToNumber(item));
+	return values;
+}
+
+bool MSLoadSettings(const char *path, MSParameters *params, std::string *error)
+{
+	std::ifstream file(path);
+	std::string line, section;
+	std::vector<double> power, multiplier;
+	int filters = -1;
+
+	if (!file){
+		*error = std::string("cannot open ") + path;
+		return false;
+	}
+
+	MSDefaultParameters(params);
+
+	while (std::getline(file, line)){
+		line = Trim(line);
+		if (line.empty() || (line[0] == ';')) continue;
+		if (line[0] == '['){
+			section = Trim(line.substr(1, line.find(']') - 1));
+			continue;
+		}
+
+		size_t eq = line.find('=');
+		if (eq == std::string::npos) continue;
+		std::string key = Trim(line.substr(0, eq));
+		std::string value = Unquote(Trim(line.substr(eq + 1)));
+
+		if (section == "MultiScale Parameters In"){
+			if (key == "Preprocessing") params->preprocessing = (value == "Convolution") ? MS_PREPROC_CONVOLUTION : MS_PREPROC_NONE;
+			else if (key == "Convolution") params->convolution = MSConvPresetFromName(value.c_str());
+			else if (key == "LUT Power") power = ToArray(value);
+			else if (key == "LUT Multiplier") multiplier = ToArray(value);
+			else if (key == "Filters.<size(s)>") filters = (int)ToNumber(value);
+			else if (key == "X Value PostProc") params->xValuePostProc = ToNumber(value);
+			else if (key.compare(0, 8, "Filters ") == 0){
+				int level = atoi(key.c_str() + 8);
+				int preset = MSConvPresetFromName(value.c_str());
+				if (preset < 0){
+					*error = "unknown filter \"" + value + "\" in " + key;
+					return false;
+				}
+				if ((level >= 0) && (level < MS_MAX_LEVELS)) params->filters[level] = preset;
+			}
+		}
+		else if (section == "Unsharp Mask Params"){
+			if (key == "Amount") params->unsharp.amount = (float)ToNumber(value);
+			else if (key == "Radius") params->unsharp.radius = (float)ToNumber(value);
+			else if (key == "Threshold") params->unsharp.threshold = (float)ToNumber(value);
+		}
+		else if (section == "Kernels"){
+			std::vector<double> values = ToArray(value);
+			std::vector<float> kernel(values.begin(), values.end());
+			int size = 1;
+			while (size * size < (int)kernel.size()) size++;
+			if ((size * size != (int)kernel.size()) || !MSSetConvKernel(MSConvPresetFromName(key.c_str()), kernel.data(), size)){
+				*error = "invalid kernel " + key;
+				return false;
+			}
+		}
+	}
+
+	if (params->convolution < 0){
+		*error = "unknown Convolution preset";
+		return false;
+	}
+	if (power.size() != multiplier.size()){
+		*error = "LUT Power and LUT Multiplier differ in size";
+		return false;
+	}
+	if (!power.empty()){
+		params->levels = (int)power.size() < MS_MAX_LEVELS ? (int)power.size() : MS_MAX_LEVELS;
+		if ((filters >= 0) && (filters < params->levels)) params->levels = filters;
+		for (int k = 0; k < params->levels; k++){
+			params->lutPower[k] = (float)power[k];
+			params->lutMultiplier[k] = (float)multiplier[k];
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,22 @@
+//==============================================================================
+//
+// Title:       Settings
+// Purpose:     Reads the LabVIEW Settings.ini into MSParameters.
+//
+//              Understands the LabVIEW config format: quoted values, decimal
+//              comma, "<size(s)=N> a b c" arrays and "Filters N" elements.
+//              An optional [Kernels] section overrides the preset kernels,
+//              e.g. Seifert 5x5 = "<size(s)=25> 1 4 6 4 1 ...".
+//
+//==============================================================================
+
+#ifndef __Settings_H__
+#define __Settings_H__
+
+#include <string>
+#include "Pipeline.h"
+
+// Starts from MSDefaultParameters, false and error text if the file is unusable
+bool MSLoadSettings(const char *path, MSParameters *params, std::string *error);
+
+#endif  /* ndef __Settings_H__ */
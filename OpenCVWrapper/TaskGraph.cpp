@@ -0,0 +1,171 @@
+//==============================================================================
+//
+// Title:       TaskGraph
+// Purpose:     Dependency graph of small tasks run with work stealing.
+//
+//==============================================================================
+
+#include <algorithm>
+#include <chrono>
+#include "TaskGraph.h"
+
+static double MSNowUs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+int MSTaskGraph::add(std::function<void()> run)
+{
+	MSTask task;
+
+	task.run = std::move(run);
+	task.dependencies = 0;
+	tasks.push_back(std::move(task));
+	return (int)tasks.size() - 1;
+}
+
+void MSTaskGraph::depend(int task, int on)
+{
+	std::vector<int> &next = tasks[on].successors;
+
+	if (std::find(next.begin(), next.end(), task) != next.end()) return;
+	next.push_back(task);
+	tasks[task].dependencies++;
+}
+
+void MSTaskGraph::push(int id, int task)
+{
+	{
+		std::lock_guard<std::mutex> guard(queues[id].lock);
+		queues[id].items.push_back(task);
+	}
+	// queued is raised before sleeping is read and wait() does the opposite,
+	// so either the sleeper sees the task or the task sees the sleeper
+	queued.fetch_add(1);
+	if (sleeping.load()){
+		std::lock_guard<std::mutex> guard(idleLock);
+		idle.notify_one();
+	}
+}
+
+// Blocks until a task is queued or the run is over
+void MSTaskGraph::wait()
+{
+	std::unique_lock<std::mutex> guard(idleLock);
+
+	sleeping.fetch_add(1);
+	idle.wait(guard, [this]{ return (queued.load() > 0) || (remaining.load() <= 0); });
+	sleeping.fetch_sub(1);
+}
+
+int MSTaskGraph::pop(int id, int count)
+{
+	int task = -1;
+
+	{
+		std::lock_guard<std::mutex> guard(queues[id].lock);
+		if (!queues[id].items.empty()){
+			task = queues[id].items.back();
+			queues[id].items.pop_back();
+			queued.fetch_sub(1);
+			return task;
+		}
+	}
+	for (int i = 1; i < count; i++){
+		Queue &victim = queues[(id + i) % count];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.items.empty()){
+			task = victim.items.front();
+			victim.items.pop_front();
+			queued.fetch_sub(1);
+			return task;
+		}
+	}
+	return -1;
+}
+
+void MSTaskGraph::worker(int id, int count)
+{
+	int task;
+
+	while (remaining.load(std::memory_order_acquire) > 0){
+		if ((task = pop(id, count)) < 0){
+			wait();
+			continue;
+		}
+
+		if (timing) started[task] = MSNowUs();
+		try {
+			tasks[task].run();
+		}
+		catch (...){
+			failed = true;
+		}
+		if (timing) finished[task] = MSNowUs();
+
+		const std::vector<int> &next = tasks[task].successors;
+		for (size_t i = 0; i < next.size(); i++)
+			if (pending[next[i]].fetch_sub(1, std::memory_order_acq_rel) == 1) push(id, next[i]);
+		if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1){
+			std::lock_guard<std::mutex> guard(idleLock);
+			idle.notify_all();
+		}
+	}
+}
+
+bool MSTaskGraph::run(MSThreadPool &pool, double *criticalPathUs, double *workUs)
+{
+	int n = (int)tasks.size(), threads = pool.size(), root = 0;
+
+	if (!n) return true;
+
+	if (!queues || (queueCount != threads)){
+		queues.reset(new Queue[threads]);
+		queueCount = threads;
+	}
+	if (pendingCount != n){
+		pending.reset(new std::atomic<int>[n]);
+		pendingCount = n;
+	}
+	timing = criticalPathUs || workUs;
+	if (timing){
+		started.assign(n, 0);
+		finished.assign(n, 0);
+	}
+
+	// roots are dealt round robin so every thread starts with local work
+	for (int i = 0; i < n; i++){
+		pending[i] = tasks[i].dependencies;
+		if (!tasks[i].dependencies) queues[root++ % threads].items.push_back(i);
+	}
+	queued = root;
+	sleeping = 0;
+	remaining = n;
+	failed = false;
+
+	pool.parallelFor(threads, 1, [&](int begin, int end){
+		for (int id = begin; id < end; id++) worker(id, threads);
+	});
+
+	// tasks were added in a sequential order, so one forward pass finds the longest chain
+	if (timing){
+		std::vector<double> path(n, 0);
+		double longest = 0, work = 0;
+
+		for (int i = 0; i < n; i++){
+			double us = finished[i] - started[i];
+			path[i] += us;
+			work += us;
+			longest = std::max(longest, path[i]);
+			for (size_t s = 0; s < tasks[i].successors.size(); s++){
+				int next = tasks[i].successors[s];
+				path[next] = std::max(path[next], path[i]);
+			}
+		}
+		if (criticalPathUs) *criticalPathUs = longest;
+		if (workUs) *workUs = work;
+	}
+
+	return !failed;
+}
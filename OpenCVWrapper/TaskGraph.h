@@ -0,0 +1,78 @@
+//==============================================================================
+//
+// Title:       TaskGraph
+// Purpose:     Dependency graph of small tasks run with work stealing.
+//
+//              Tasks are added in a valid sequential order, every task runs
+//              once all tasks it depends on are done. Each thread of the pool
+//              owns a deque: it pushes the tasks it makes ready and pops them
+//              back LIFO (still warm in cache), idle threads steal FIFO from
+//              the others and sleep while nothing is queued. The graph is
+//              built once and run many times.
+//
+//==============================================================================
+
+#ifndef __TaskGraph_H__
+#define __TaskGraph_H__
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include "ThreadPool.h"
+
+struct MSTask {
+	std::function<void()> run;
+	std::vector<int> successors;
+	int dependencies;
+};
+
+class MSTaskGraph
+{
+public:
+	MSTaskGraph() : pendingCount(0), queueCount(0), queued(0), sleeping(0), remaining(0), failed(false), timing(false) {}
+
+	int add(std::function<void()> run);
+	// task runs after on, on must have been added before task
+	void depend(int task, int on);
+
+	int size() const { return (int)tasks.size(); }
+	void clear() { tasks.clear(); pending.reset(); pendingCount = 0; }
+
+	// Runs every task on the pool, false if a task threw. With timing,
+	// criticalPathUs is the longest chain of measured task times and
+	// workUs the sum of all of them
+	bool run(MSThreadPool &pool, double *criticalPathUs = NULL, double *workUs = NULL);
+
+private:
+	struct alignas(64) Queue {
+		std::mutex lock;
+		std::deque<int> items;
+	};
+
+	void worker(int id, int queues);
+	void push(int id, int task);
+	int pop(int id, int queues);
+	void wait();
+
+	std::vector<MSTask> tasks;
+
+	// state of the current run, allocated by the first run of the graph
+	std::unique_ptr<std::atomic<int>[]> pending;
+	int pendingCount;
+	std::unique_ptr<Queue[]> queues;
+	int queueCount;
+	std::atomic<int> queued;   //tasks in all queues
+	std::atomic<int> sleeping; //workers blocked in wait()
+	std::mutex idleLock;
+	std::condition_variable idle;
+	std::atomic<int> remaining;
+	std::atomic<bool> failed;
+	std::vector<double> started, finished;
+	bool timing;
+};
+
+#endif  /* ndef __TaskGraph_H__ */
@@ -0,0 +1,94 @@
+//==============================================================================
+//
+// Title:       ThreadPool
+// Purpose:     Small fixed-size worker pool owned by a processing context.
+//
+//==============================================================================
+
+#include "ThreadPool.h"
+#include "Profile.h"
+#include "MatPool.h"
+
+MSThreadPool::MSThreadPool(int numThreads)
+	: stop(false), generation(0), busy(0), body(nullptr), count(0), grain(1), stage(-1), pooled(false), next(0)
+{
+	for (int i = 1; i < numThreads; i++) workers.emplace_back(&MSThreadPool::workerLoop, this);
+}
+
+MSThreadPool::~MSThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void MSThreadPool::runChunks()
+{
+	int begin;
+
+	while ((begin = next.fetch_add(grain)) < count){
+		int end = begin + grain < count ? begin + grain : count;
+		MS_TRACE(MS_TRACE_CHUNK, -1, begin);
+		(*body)(begin, end);
+	}
+}
+
+void MSThreadPool::workerLoop()
+{
+	unsigned seen = 0;
+	uint64_t counts[MS_CNT_COUNT];
+	int counted;
+	bool adopted;
+
+	for (;;){
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [&]{ return stop || generation != seen; });
+			if (stop) return;
+			seen = generation;
+			counted = stage;
+			adopted = pooled;
+		}
+		if ((counted >= 0) && !(MSCountersOn() && MSCountersRead(counts))) counted = -1;
+		MatPoolAdopt(adopted);
+		runChunks();
+		MatPoolAdopt(false);
+		if (counted >= 0) MSCountersAdd(counted, counts);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (--busy == 0) done.notify_one();
+		}
+	}
+}
+
+void MSThreadPool::parallelFor(int count, int grain, const std::function<void(int, int)> &body)
+{
+	if (count <= 0) return;
+	grain = grain > 0 ? grain : 1;
+
+	if (workers.empty() || count <= grain){
+		body(0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		this->body = &body;
+		this->count = count;
+		this->grain = grain;
+		stage = MSCountersStage();
+		pooled = MatPoolActive();
+		next = 0;
+		busy = (int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	runChunks();
+
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [&]{ return busy == 0; });
+}
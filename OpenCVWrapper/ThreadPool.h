@@ -0,0 +1,54 @@
+//==============================================================================
+//
+// Title:       ThreadPool
+// Purpose:     Small fixed-size worker pool owned by a processing context.
+//
+//              Each context gets its own slice of worker threads, so several
+//              contexts (cameras, reentrant VI clones) never queue behind each
+//              other's jobs.
+//
+//==============================================================================
+
+#ifndef __ThreadPool_H__
+#define __ThreadPool_H__
+
+#include <functional>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+class MSThreadPool
+{
+public:
+	// numThreads includes the calling thread, 1 runs everything inline
+	explicit MSThreadPool(int numThreads);
+	~MSThreadPool();
+
+	int size() const { return (int)workers.size() + 1; }
+
+	// Runs body(begin, end) over [0, count) in chunks of grain items,
+	// the calling thread takes part and returns when all chunks are done
+	void parallelFor(int count, int grain, const std::function<void(int, int)> &body);
+
+private:
+	void workerLoop();
+	void runChunks();
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake, done;
+	bool stop;
+	unsigned generation;
+	int busy;
+
+	// current job
+	const std::function<void(int, int)> *body;
+	int count, grain;
+	int stage;               // profile stage of the caller, hardware counters of the workers go there
+	bool pooled;             // caller inside a MATPOOL_SCOPE, the workers take from the pool too
+	std::atomic<int> next;
+};
+
+#endif  /* ndef __ThreadPool_H__ */